@@ -14,6 +14,8 @@
 #include "azureKinectPlayback.h"
 #include "azureKinectRecord.h"
 #include "azureKinectServer.h"
+#include "cloudWriter.h"
+#include "benchmark.h"
 
 //constexpr auto FFMPEG_DIR = R"(C:\Users\bwysonggrass\Desktop\ffmpeg-20190826-0821bc4-win64-static\bin\)";
 
@@ -40,7 +42,7 @@ namespace kinectCloud {
 
 	// parameter stuff
 	std::string mode = "-n";
-	std::string inPath, outPath;
+	std::string inPath, outPath, calibrationPath;
 	std::vector<std::string> specifiedSerialNums;
 	std::map<std::string, deviceInitInfo> deviceInfo;
 	std::set<std::string> otherOptions;
@@ -51,12 +53,59 @@ namespace kinectCloud {
 	int consecutiveCount = 1;
 	int colorExposure = 0; // in nanoseconds
 	int colorWhiteBalance = 0; // in kelvin
+	int formatThreads = std::max(1u, std::thread::hardware_concurrency());
+	cloudSpace pointSpace = cloudSpace::color;
+	cloudFormat outputFormat = cloudFormat::pts;
+	outputBackend fileBackend = outputBackend::stdio;
+	bool largePages = false;
+	int serverQuantization = 1; // mm
+	kinectCloud::tcpStreamOptions serverTcp;
+	int octreeLeafSize = 1; // mm
+	float meshJump = 0.05f; // relative to depth
+	int voxelSize = 0; // mm, 0 => no downsampling
+	voxelMode voxelPosition = voxelMode::centroid;
+	int outlierRadius = 0; // pixels, 0 => no outlier removal
+	float outlierDeviations = 1.f;
+	float flyingPixelJump = 0.f; // relative to depth, 0 => keep flying pixels
+	temporalMode temporal = temporalMode::off;
+	float temporalWeight = 0.3f;
+	int temporalFrames = 5;
+	float temporalReset = 0.05f; // relative to depth
+	cloudCrop crop; // mm, in the camera coordinates of pointSpace
+	normalFormat pointNormals = normalFormat::off;
+	int writerQueueDepth = 8; // 0 => save synchronously
+	int writerThreads = 2;
+	queuePolicy writerPolicy = queuePolicy::block;
 	bool verbose = false;
 	k4a_color_resolution_t allResolution = K4A_COLOR_RESOLUTION_OFF;
 	k4a_depth_mode_t allDepth = K4A_DEPTH_MODE_OFF;
 
 	// runtime stuff
 	std::vector<azureKinectDK> devices;
+	std::unique_ptr<fileOutput> fileOut;
+
+	// point cloud options selected by the input parameters
+	cloudOptions pointCloudOptions() {
+		cloudOptions opts;
+		opts.space = pointSpace;
+		opts.format = outputFormat;
+		opts.output = fileOut.get();
+		opts.leafSize = octreeLeafSize;
+		opts.meshJump = meshJump;
+		opts.voxelSize = voxelSize;
+		opts.voxels = voxelPosition;
+		opts.outlierRadius = outlierRadius;
+		opts.outlierDeviations = outlierDeviations;
+		opts.flyingPixelJump = flyingPixelJump;
+		opts.temporal = temporal;
+		opts.temporalWeight = temporalWeight;
+		opts.temporalFrames = temporalFrames;
+		opts.temporalReset = temporalReset;
+		opts.crop = crop;
+		opts.normals = pointNormals;
+		opts.threads = formatThreads;
+		return opts;
+	}
 
 	// load and start all devices specified by the input parameters, if no specifications open default device only
 	void startDevices() {
@@ -107,6 +156,7 @@ namespace kinectCloud {
 			}
 
 			dev.start(confToUse);
+			dev.arena().useLargePages(largePages);
 		}
 		if (colorExposure) {
 			for (auto &dev : devices) {
@@ -124,10 +174,11 @@ namespace kinectCloud {
 	// this will extract frames from a video
 	int extractMode() {
 		auto pb = azureKinectPlayback(inPath);
+		pb.arena().useLargePages(largePages);
 
 		if (extractFrame >= 0) {
 			pb.seekTime(extractFrame * 1000000 / pb.framerate());
-			pb.saveCurrentPointCloud(formatFilePath(outPath, "e", std::to_string(extractFrame)));
+			pb.saveCurrentPointCloud(formatFilePath(outPath, "e", std::to_string(extractFrame)), pointCloudOptions());
 		} else {
 			int fps = pb.framerate();
 			int frame = 0;
@@ -138,7 +189,7 @@ namespace kinectCloud {
 
 				// check if we have surpassed min wait threshold
 				if ((int64_t(frame) - int64_t(lastFrame)) / (double)fps > minFrameDif) {
-					if (pb.saveCurrentPointCloud(formatFilePath(outPath, "e", std::to_string(frame)))) {
+					if (pb.saveCurrentPointCloud(formatFilePath(outPath, "e", std::to_string(frame)), pointCloudOptions())) {
 						lastFrame = frame;
 					}
 				}
@@ -146,6 +197,9 @@ namespace kinectCloud {
 			}
 		}
 
+		fileOut->flush();
+		if (verbose) std::cout << "Frame buffers: " << pb.arena().summary() << "\n";
+
 		return 0;
 	}
 
@@ -168,18 +222,45 @@ namespace kinectCloud {
 				frameNum++;
 				if (frameNum >= consecutiveCount) break;
 			}
+		} else if (writerQueueDepth > 0) {
+			// capture keeps going while writer threads format and save
+			std::vector<k4a_calibration_t> calibrations;
+			for (auto& device : devices) {
+				calibrations.push_back(device.getCalibration());
+			}
+			cloudWriter writer(calibrations, pointCloudOptions(), writerThreads, writerQueueDepth, writerPolicy, largePages);
+			while (true) {
+				for (auto& device : devices) {
+					device.captureFrame();
+				}
+				for (size_t i = 0; i < devices.size(); i++) {
+					bool queued = writer.push(i, devices[i].getCurrCapture(), formatFilePath(outPath, devices[i].getSerialNum(), std::to_string(frameNum)));
+					if (verbose && !queued) std::cout << "Dropped " << formatFilePath(outPath, devices[i].getSerialNum(), std::to_string(frameNum)) << "\n";
+				}
+				frameNum++;
+				if (frameNum >= consecutiveCount) break;
+			}
+			writer.finish();
+			fileOut->flush();
+			if (verbose) std::cout << "Point clouds: " << writer.summary() << "\n";
 		} else {
 			while (true) {
 				for (auto& device : devices) {
 					device.captureFrame();
 				}
 				for (auto& device : devices) {
-					device.saveCurrentPointCloud(formatFilePath(outPath, device.getSerialNum(), std::to_string(frameNum)));
+					device.saveCurrentPointCloud(formatFilePath(outPath, device.getSerialNum(), std::to_string(frameNum)), pointCloudOptions());
 				}
 				if (verbose) std::cout << "Saved " << formatFilePath(outPath, "%s", std::to_string(frameNum)) << "\n";
 				frameNum++;
 				if (frameNum >= consecutiveCount) break;
 			}
+			fileOut->flush();
+			if (verbose) {
+				for (auto& device : devices) {
+					std::cout << "Frame buffers " << device.getSerialNum() << ": " << device.arena().summary() << "\n";
+				}
+			}
 		}
 
 		return 0;
@@ -195,7 +276,8 @@ namespace kinectCloud {
 		conf.synchronized_images_only = true;
 		conf.wired_sync_mode = K4A_WIRED_SYNC_MODE_STANDALONE;
 		kc->start(conf);
-		auto abc = new kinectCloud::azureKinectServer(kc, 10);
+		kc->arena().useLargePages(largePages);
+		auto abc = new kinectCloud::azureKinectServer(kc, 10, pointCloudOptions(), serverQuantization, serverTcp);
 
 		return 0;
 	}
@@ -204,8 +286,6 @@ namespace kinectCloud {
 	int main(int argc, char** argv) {
 		bool badParams = argc == 1;
 
-		initFastString();
-
 		std::vector<std::string> alerts;
 
 		for (int i = 1; i < argc; i++) {
@@ -213,7 +293,6 @@ namespace kinectCloud {
 				otherOptions.insert(argv[i]);
 			} else if (argv[i] == std::string("-e")) { // extract pointcloud from video
 				mode = "-e";
-				if (outPath.empty()) outPath = "e_%f.pts";
 				if (++i != argc) {
 					inPath = argv[i];
 				} else {
@@ -238,6 +317,57 @@ namespace kinectCloud {
 			else if (argv[i] == std::string("-h")) {
 				mode = "-h";
 			}
+			else if (argv[i] == std::string("-hq")) { // server compression quantization
+				if (++i != argc) {
+					serverQuantization = std::atoi(argv[i]);
+				} else {
+					alerts.push_back("Error: -hq must be followed by integer");
+					badParams = true;
+				}
+				if (serverQuantization < 1) serverQuantization = 1;
+			}
+			else if (argv[i] == std::string("-ht")) { // server tcp stream port
+				if (++i != argc) {
+					char* end = nullptr;
+					long port = std::strtol(argv[i], &end, 10);
+					if (end == argv[i] || *end != 0 || port < 0 || port > 65535) {
+						alerts.push_back("Error: -ht must be a port between 1 and 65535, or 0 for off");
+						badParams = true;
+					} else {
+						serverTcp.port = int(port);
+					}
+				} else {
+					alerts.push_back("Error: -ht must be followed by integer");
+					badParams = true;
+				}
+			}
+			else if (argv[i] == std::string("-hn")) { // TCP_NODELAY of the tcp stream
+				if (++i != argc) {
+					serverTcp.noDelay = std::atoi(argv[i]) != 0;
+				} else {
+					alerts.push_back("Error: -hn must be followed by 0 or 1");
+					badParams = true;
+				}
+			}
+			else if (argv[i] == std::string("-hb")) { // send buffer of the tcp stream
+				if (++i != argc) {
+					serverTcp.sendBuffer = std::max(0, std::atoi(argv[i]));
+				} else {
+					alerts.push_back("Error: -hb must be followed by integer");
+					badParams = true;
+				}
+			}
+			else if (argv[i] == std::string("-b")) {
+				mode = "-b";
+			}
+			else if (argv[i] == std::string("-bc")) { // calibration used by benchmarks
+				if (++i != argc) {
+					calibrationPath = argv[i];
+				} else {
+					alerts.push_back("Error: -bc must be followed by a calibration file path");
+					badParams = true;
+				}
+			}
 			//else if(argv[i] == std::string("-fa")) { // capture and save pointcloud
 			//	if (++i != argc) {
 			//		incFrames = argv[i];
@@ -249,7 +379,6 @@ namespace kinectCloud {
 			//}
 			else if(argv[i] == std::string("-s")) { // capture and save pointcloud
 				mode = "-s";
-				if (outPath.empty()) outPath = "%s_%f.pts";
 			} else if(argv[i] == std::string("-o")) { // output path (default %s_%f.pts)
 				if (++i != argc) {
 					outPath = argv[i];
@@ -382,6 +511,193 @@ namespace kinectCloud {
 				if (++i != argc) {
 					colorWhiteBalance = std::atoi(argv[i]);
 				} else badParams = true;
+			} else if(argv[i] == std::string("-t")) { // threads used to generate and format point clouds
+				if (++i != argc) {
+					formatThreads = std::atoi(argv[i]);
+				} else {
+					alerts.push_back("Error: -t must be followed by integer");
+					badParams = true;
+				}
+				if (formatThreads < 1) formatThreads = 1;
+			} else if(argv[i] == std::string("-ps")) { // camera grid points are generated on
+				if (++i != argc) {
+					if (!cloudSpaceFromString(argv[i], pointSpace)) {
+						alerts.push_back("Error: -ps must be followed by color or depth");
+						badParams = true;
+					}
+				} else {
+					alerts.push_back("Error: -ps must be followed by color or depth");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-pn")) { // per point normals
+				if (++i != argc) {
+					if (!normalFormatFromString(argv[i], pointNormals)) {
+						alerts.push_back("Error: -pn must be followed by off, oct16 or float3");
+						badParams = true;
+					}
+				} else {
+					alerts.push_back("Error: -pn must be followed by off, oct16 or float3");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-of")) { // output file format
+				if (++i != argc) {
+					if (!cloudFormatFromString(argv[i], outputFormat)) {
+						alerts.push_back("Error: -of must be followed by pts, ply, oct or mesh");
+						badParams = true;
+					}
+				} else {
+					alerts.push_back("Error: -of must be followed by pts, ply, oct or mesh");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-ol")) { // octree leaf size
+				if (++i != argc) {
+					octreeLeafSize = std::atoi(argv[i]);
+				} else {
+					alerts.push_back("Error: -ol must be followed by integer");
+					badParams = true;
+				}
+				if (octreeLeafSize < 1) octreeLeafSize = 1;
+			} else if(argv[i] == std::string("-mj")) { // mesh depth jump
+				if (++i != argc) {
+					meshJump = float(std::atof(argv[i]));
+				} else {
+					alerts.push_back("Error: -mj must be followed by number");
+					badParams = true;
+				}
+				if (meshJump < 0.f) meshJump = 0.f;
+			} else if(argv[i] == std::string("-vs")) { // voxel grid downsampling
+				if (++i != argc) {
+					voxelSize = std::atoi(argv[i]);
+				} else {
+					alerts.push_back("Error: -vs must be followed by integer");
+					badParams = true;
+				}
+				if (voxelSize < 0) voxelSize = 0;
+			} else if(argv[i] == std::string("-vm")) { // voxel position
+				if (++i != argc) {
+					if (!voxelModeFromString(argv[i], voxelPosition)) {
+						alerts.push_back("Error: -vm must be followed by centroid or first");
+						badParams = true;
+					}
+				} else {
+					alerts.push_back("Error: -vm must be followed by centroid or first");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-sr")) { // outlier removal window radius
+				if (++i != argc) {
+					outlierRadius = std::atoi(argv[i]);
+				} else {
+					alerts.push_back("Error: -sr must be followed by integer");
+					badParams = true;
+				}
+				if (outlierRadius < 0) outlierRadius = 0;
+			} else if(argv[i] == std::string("-sd")) { // outlier removal standard deviations
+				if (++i != argc) {
+					outlierDeviations = float(std::atof(argv[i]));
+				} else {
+					alerts.push_back("Error: -sd must be followed by number");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-fp")) { // flying pixel removal
+				if (++i != argc) {
+					flyingPixelJump = float(std::atof(argv[i]));
+				} else {
+					alerts.push_back("Error: -fp must be followed by number");
+					badParams = true;
+				}
+				if (flyingPixelJump < 0.f) flyingPixelJump = 0.f;
+			} else if(argv[i] == std::string("-tf")) { // temporal depth filter
+				if (++i != argc) {
+					if (!temporalModeFromString(argv[i], temporal)) {
+						alerts.push_back("Error: -tf must be followed by off, ema or median");
+						badParams = true;
+					}
+				} else {
+					alerts.push_back("Error: -tf must be followed by off, ema or median");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-ta")) { // temporal moving average weight
+				if (++i != argc) {
+					temporalWeight = float(std::atof(argv[i]));
+				} else {
+					alerts.push_back("Error: -ta must be followed by number");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-tk")) { // temporal median frames
+				if (++i != argc) {
+					temporalFrames = std::atoi(argv[i]);
+				} else {
+					alerts.push_back("Error: -tk must be followed by integer");
+					badParams = true;
+				}
+				if (temporalFrames < 1 || temporalFrames > temporalFilter::maxFrames) {
+					alerts.push_back("Error: -tk must be between 1 and " + std::to_string(temporalFilter::maxFrames));
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-tr")) { // temporal motion reset
+				if (++i != argc) {
+					temporalReset = float(std::atof(argv[i]));
+				} else {
+					alerts.push_back("Error: -tr must be followed by number");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-xb")) { // crop box
+				int bounds[6];
+				int read = 0;
+				while (read < 6 && i + 1 != argc) bounds[read++] = std::atoi(argv[++i]);
+				if (read == 6 && bounds[0] <= bounds[3] && bounds[1] <= bounds[4] && bounds[2] <= bounds[5]) {
+					crop.min = glm::ivec3(bounds[0], bounds[1], bounds[2]);
+					crop.max = glm::ivec3(bounds[3], bounds[4], bounds[5]);
+				} else {
+					alerts.push_back("Error: -xb must be followed by minX minY minZ maxX maxY maxZ");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-xr")) { // crop range
+				if (i + 2 < argc) {
+					crop.minRange = std::max(0.f, float(std::atof(argv[++i])));
+					crop.maxRange = std::max(0.f, float(std::atof(argv[++i])));
+				} else {
+					alerts.push_back("Error: -xr must be followed by min and max");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-ob")) { // file output backend
+				if (++i != argc) {
+					if (!outputBackendFromString(argv[i], fileBackend)) {
+						alerts.push_back("Error: -ob must be followed by stdio, pwrite or uring");
+						badParams = true;
+					}
+				} else {
+					alerts.push_back("Error: -ob must be followed by stdio, pwrite or uring");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-q")) { // writer queue depth
+				if (++i != argc) {
+					writerQueueDepth = std::atoi(argv[i]);
+				} else {
+					alerts.push_back("Error: -q must be followed by integer");
+					badParams = true;
+				}
+				if (writerQueueDepth < 0) writerQueueDepth = 0;
+			} else if(argv[i] == std::string("-qw")) { // writer threads
+				if (++i != argc) {
+					writerThreads = std::atoi(argv[i]);
+				} else {
+					alerts.push_back("Error: -qw must be followed by integer");
+					badParams = true;
+				}
+				if (writerThreads < 1) writerThreads = 1;
+			} else if(argv[i] == std::string("-qp")) { // full writer queue policy
+				if (++i != argc) {
+					if (!queuePolicyFromString(argv[i], writerPolicy)) {
+						alerts.push_back("Error: -qp must be followed by block or drop");
+						badParams = true;
+					}
+				} else {
+					alerts.push_back("Error: -qp must be followed by block or drop");
+					badParams = true;
+				}
+			} else if(argv[i] == std::string("-lp")) {
+				largePages = true;
 			} else if(argv[i] == std::string("-v")) {
 				verbose = true;
 			} else {
@@ -389,6 +705,24 @@ namespace kinectCloud {
 			}
 		}
 
+		// normals and meshes come from the organized grid and only ply files have room for normals
+		if (pointNormals != normalFormat::off && voxelSize > 0) {
+			alerts.push_back("Error: -pn can't be combined with -vs");
+			badParams = true;
+		}
+		if (pointNormals != normalFormat::off && (mode == "-s" || mode == "-e") && !cloudFormatTakesNormals(outputFormat)) {
+			alerts.push_back("Error: -pn needs -of ply or -of mesh for -s and -e");
+			badParams = true;
+		}
+		if (outputFormat == cloudFormat::mesh && voxelSize > 0) {
+			alerts.push_back("Error: -of mesh can't be combined with -vs");
+			badParams = true;
+		}
+
+		// default output path, extension follows the output format
+		if (outPath.empty() && mode == "-e") outPath = "e_%f." + cloudFormatExtension(outputFormat);
+		if (outPath.empty() && mode == "-s") outPath = "%s_%f." + cloudFormatExtension(outputFormat);
+
 		if (badParams) {
 			for (int i = 0; i < alerts.size(); i++) {
 				std::cout << alerts[i] << "\n";
@@ -396,7 +730,7 @@ namespace kinectCloud {
 			if (true) {
 				std::cout << "options:\n";
 				std::cout << " -r              | record to a file (must also specify device options)\n";
-				std::cout << " -e              | extract all colored frames into pts files\n";
+				std::cout << " -e              | extract all colored frames into point cloud files\n";
 				std::cout << " -ei wait        | minimum time between extracted frame (seconds)\n";
 				std::cout << " -f n            | extract single frame n only (may do nothing)\n";
 				std::cout << " -fa n           | extract every n frames starting at 0 from video (1 = every frame)\n";
@@ -418,12 +752,44 @@ namespace kinectCloud {
 				std::cout << "   depth modes      : " VALID_DEPTHS ", default is NFOV_2X2BINNED\n";
 				std::cout << " -ce int         | color camera exposure time in nanoseconds for all devices\n";
 				std::cout << " -cw int         | color camera white balance in kelvin for all devices (must be % by 10)\n";
+				std::cout << " -t int          | threads used to generate and format point clouds (default all cores)\n";
+				std::cout << " -ps {space}     | generate points on the color or depth camera grid (default color)\n";
+				std::cout << "                 | depth: one point per depth pixel, xyz in depth camera coordinates\n";
+				std::cout << " -pn {format}    | per point normals from neighbouring pixels: off, oct16 (2 bytes) or float3, for -of ply, -of mesh and -h (default off)\n";
+				std::cout << " -of {format}    | point cloud file format for -s and -e, pts (text), ply (binary), oct (octree compressed) or mesh (ply with triangles), default pts\n";
+				std::cout << " -ol int         | leaf size in mm of -of oct, coordinates are snapped to leaf centers (default 1, lossless)\n";
+				std::cout << " -mj number      | largest depth difference within a triangle of -of mesh, as a fraction of depth (default 0.05)\n";
+				std::cout << " -vs int         | downsample -s, -e and -h to one point per voxel of this size in mm (default 0, off)\n";
+				std::cout << " -vm {mode}      | point of a voxel: centroid (average) or first (first point in row order), colors are averaged (default centroid)\n";
+				std::cout << " -sr int         | remove outliers of -s, -e and -h using neighbours within this many pixels (default 0, off; 1 or 2 work well)\n";
+				std::cout << " -sd number      | neighbour distance above its mean in standard deviations which -sr keeps (default 1)\n";
+				std::cout << " -fp number      | drop depth pixels whose jump to a neighbour is above this fraction of their depth (default 0, off; 0.05 works well)\n";
+				std::cout << " -tf {mode}      | smooth depth over consecutive frames of -s and -h: off, ema (moving average) or median (default off)\n";
+				std::cout << " -ta number      | weight of the newest frame in -tf ema (default 0.3)\n";
+				std::cout << " -tk int         | frames -tf median takes the median of, at most 9 (default 5)\n";
+				std::cout << " -tr number      | depth change, as a fraction of depth, which -tf treats as motion and restarts from (default 0.05)\n";
+				std::cout << " -xb x y z x y z | keep only points inside the box from min x y z to max x y z, mm in the camera coordinates of -ps\n";
+				std::cout << " -xr min max     | keep only points whose distance from the camera is between min and max mm, max 0 => no limit\n";
+				std::cout << " -ob {backend}   | how -s and -e write files: stdio, pwrite (thread pool) or uring (linux io_uring, else pwrite), default stdio\n";
+				std::cout << " -q int          | frames of -s which can wait for the writer threads (default 8, 0 = save before next capture)\n";
+				std::cout << " -qw int         | writer threads for -s (default 2)\n";
+				std::cout << " -qp {policy}    | when the -s writer queue is full, block capture or drop the frame (default block)\n";
+				std::cout << " -lp             | back reused frame buffers with large pages (windows needs the lock pages in memory right)\n";
 				std::cout << " -h              | (experimental) host server which serves point clouds, port 5687\n";
+				std::cout << " -hq int         | quantization step in mm of the compressed frames served by -h (default 1, lossless)\n";
+				std::cout << " -ht int         | port of the tcp frame stream of -h (default 5688, 0 = off)\n";
+				std::cout << " -hn int         | TCP_NODELAY on -ht connections, 1 or 0 (default 1)\n";
+				std::cout << " -hb int         | send buffer in bytes of -ht connections (default 0, os default)\n";
+				std::cout << " -b              | run synthetic benchmarks of the point cloud kernels (no device needed)\n";
+				std::cout << " -bc file        | raw calibration blob used by -b to compare against the sdk (uses -dma, -dra)\n";
 				std::cout << " -v              | verbose output\n";
 			}
 			return 0;
 		}
 	
+		fileOut = createFileOutput(fileBackend);
+		if (verbose && mode != "-b") std::cout << "Writing files with " << fileOut->name() << "\n";
+
 		if (mode == "-e") {
 			extractMode();
 		} else if(mode == "-s") {
@@ -431,6 +797,12 @@ namespace kinectCloud {
 			captureMode();
 		} else if (mode == "-h") {
 			serverMode();
+		} else if (mode == "-b") {
+			runBenchmarks(
+				calibrationPath,
+				(allDepth != K4A_DEPTH_MODE_OFF) ? allDepth : defaultDepthMode,
+				(allResolution != K4A_COLOR_RESOLUTION_OFF) ? allResolution : defaultColorRes
+			);
 		}
 
 		return 0;
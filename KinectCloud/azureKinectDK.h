@@ -1,15 +1,16 @@
 #pragma once
 
 #include "kinectUtil.h"
+#include "pipeline.h"
 
 namespace kinectCloud {
 	// wrapper for azure kinect
 	class azureKinectDK {
 		k4a_device_t _device = nullptr;
-		k4a_transformation_t _transform = nullptr;
 		k4a_capture_t _capture = nullptr;
 
 		k4a_calibration_t _cali;
+		cloudPipeline _pipeline;
 		std::string _serial;
 
 		k4a_device_configuration_t _config;
@@ -29,6 +30,11 @@ namespace kinectCloud {
 			return _config;
 		}
 
+		// get calibration, valid after start
+		inline k4a_calibration_t getCalibration() {
+			return _cali;
+		}
+
 		// call kinect api to retrieve serial number of this device
 		inline std::string getSerialNum() {
 			if (_serial.empty()) {
@@ -72,61 +78,9 @@ namespace kinectCloud {
 		}
 
 		// transform current frame into point cloud and save it
-		inline void saveCurrentPointCloud(std::string const& filePath) {
-			k4a_image_t depthImage = k4a_capture_get_depth_image(_capture);
-			k4a_image_t colorImage = k4a_capture_get_color_image(_capture);
-			k4a_image_t transformedDepthImage = nullptr;
-			k4a_image_t xyzImage = nullptr;
-
-			uint32_t resWidth = k4a_image_get_width_pixels(colorImage);
-			uint32_t resHeight = k4a_image_get_height_pixels(colorImage);
-			uint32_t colorStride = resWidth * sizeof(uint8_t) * 4;
-			uint32_t xyzStride = resWidth * sizeof(int16_t) * 3;
-			uint32_t transformedDepthStride = resWidth * sizeof(uint16_t);
-
-			if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16, resWidth, resHeight, transformedDepthStride, &transformedDepthImage)) {
-				k4a_image_release(depthImage);
-				k4a_image_release(colorImage);
-				throw std::runtime_error("failed to create mapped color image");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_color_camera(
-				_transform,
-				depthImage,
-				transformedDepthImage
-			)) {
-				k4a_image_release(depthImage);
-				k4a_image_release(colorImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to transform depth image to color image space");
-			}
-
-			k4a_image_release(depthImage);
-
-			if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM, resWidth, resHeight, xyzStride, &xyzImage)) {
-				k4a_image_release(colorImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to create point cloud image");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_point_cloud(
-				_transform,
-				transformedDepthImage,
-				K4A_CALIBRATION_TYPE_COLOR,
-				xyzImage
-			)) {
-				k4a_image_release(colorImage);
-				k4a_image_release(xyzImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to transform mapped depth to point cloud image");
-			}
-
-			k4a_image_release(transformedDepthImage);
-
-			savePointCloud(glm::uvec2(resWidth, resHeight), xyzImage, colorImage, filePath);
-
-			k4a_image_release(colorImage);
-			k4a_image_release(xyzImage);
+		// opts selects the grid the points are generated on, the threads used and the file format
+		inline void saveCurrentPointCloud(std::string const& filePath, cloudOptions const& opts = {}) {
+			_pipeline.save(_capture, filePath, opts);
 		}
 
 		// transform current frame into point cloud and load into data block
@@ -134,63 +88,28 @@ namespace kinectCloud {
 		//[int16 x 1][int16 y 1][int16 z 1][uint8 r 1][uint8 g 1][uint8 b 1]
 		//...
 		//[int16 x (numPoints-1)][int16 y (numPoints-1)] ... [uint8  (numPoints-1)]
-		inline uint64_t saveCurrentPointCloudRaw(uint8_t* data) {
-			k4a_image_t depthImage = k4a_capture_get_depth_image(_capture);
-			k4a_image_t colorImage = k4a_capture_get_color_image(_capture);
-			k4a_image_t transformedDepthImage = nullptr;
-			k4a_image_t xyzImage = nullptr;
-
-			uint32_t resWidth = k4a_image_get_width_pixels(colorImage);
-			uint32_t resHeight = k4a_image_get_height_pixels(colorImage);
-			uint32_t colorStride = resWidth * sizeof(uint8_t) * 4;
-			uint32_t xyzStride = resWidth * sizeof(int16_t) * 3;
-			uint32_t transformedDepthStride = resWidth * sizeof(uint16_t);
-
-			if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16, resWidth, resHeight, transformedDepthStride, &transformedDepthImage)) {
-				k4a_image_release(depthImage);
-				k4a_image_release(colorImage);
-				throw std::runtime_error("failed to create mapped color image");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_color_camera(
-				_transform,
-				depthImage,
-				transformedDepthImage
-			)) {
-				k4a_image_release(depthImage);
-				k4a_image_release(colorImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to transform depth image to color image space");
-			}
-
-			k4a_image_release(depthImage);
-
-			if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM, resWidth, resHeight, xyzStride, &xyzImage)) {
-				k4a_image_release(colorImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to create point cloud image");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_point_cloud(
-				_transform,
-				transformedDepthImage,
-				K4A_CALIBRATION_TYPE_COLOR,
-				xyzImage
-			)) {
-				k4a_image_release(colorImage);
-				k4a_image_release(xyzImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to transform mapped depth to point cloud image");
-			}
-
-			k4a_image_release(transformedDepthImage);
-
-			uint64_t finalSize = savePointCloudRaw(glm::uvec2(resWidth, resHeight), xyzImage, colorImage, data);
+		// with opts.normals the normals of the points follow in the same order, normalSize(opts.normals) bytes each
+		// data must hold 9 + normalSize(opts.normals) bytes for every pixel of cloudGridSize(opts.space)
+		inline uint64_t saveCurrentPointCloudRaw(uint8_t* data, cloudOptions const& opts = {}) {
+			// normals are packed behind the largest possible point block, then moved up to the points
+			uint64_t pixels = uint64_t(cloudGridSize(opts.space).x) * cloudGridSize(opts.space).y;
+			uint8_t* normals = opts.normals != normalFormat::off ? data + pixels * 9 : nullptr;
+			rawSink sink(data, normals, opts.normals);
+			_pipeline.run(_capture, opts, sink);
+			if (normals) memmove(data + sink.points() * 9, normals, sink.points() * normalSize(opts.normals));
+			return sink.points();
+		}
 
-			k4a_image_release(colorImage);
-			k4a_image_release(xyzImage);
+		// size of the point grid of the current calibration, the most points a cloud in space can have
+		inline glm::uvec2 cloudGridSize(cloudSpace space) const {
+			return _pipeline.gridSize(space);
+		}
 
-			return finalSize;
+		// transform current frame into point cloud and hand it to any sink, see pipeline.h
+		// returns false if the current capture is missing depth or color
+		template<class Sink>
+		inline bool emitCurrentPointCloud(Sink& sink, cloudOptions const& opts = {}) {
+			return _pipeline.run(_capture, opts, sink);
 		}
 
 		// get the next frame and keep it in memory until next frame is retrieved
@@ -224,7 +143,7 @@ namespace kinectCloud {
 				throw std::runtime_error("failed to get device calibration");
 			}
 
-			_transform = k4a_transformation_create(&_cali);
+			_pipeline = cloudPipeline(_cali);
 		}
 
 		// start cameras from arbitrary configuration
@@ -239,7 +158,7 @@ namespace kinectCloud {
 				throw std::runtime_error("failed to get device calibration");
 			}
 
-			_transform = k4a_transformation_create(&_cali);
+			_pipeline = cloudPipeline(_cali);
 		}
 
 		// open deviec with given serial number
@@ -285,9 +204,6 @@ namespace kinectCloud {
 
 		// destructor
 		inline ~azureKinectDK() {
-			if (_transform) {
-				k4a_transformation_destroy(_transform);
-			}
 			if (_capture) {
 				k4a_capture_release(_capture);
 			}
@@ -302,20 +218,24 @@ namespace kinectCloud {
 			return k4a_device_get_installed_count();
 		}
 
+		// buffers reused across frames, see frameArena
+		inline frameArena& arena() {
+			return _pipeline.arena();
+		}
+
 	private:
 
 		// copy values from other to this, then clear values from other
 		inline void move(azureKinectDK &other) {
 			_device = other._device;
 			_cali = other._cali;
-			_transform = other._transform;
+			_pipeline = std::move(other._pipeline);
 			_capture = other._capture;
 			_serial = other._serial;
 			_config = other._config;
 
 			other._device = nullptr;
 			other._capture = nullptr;
-			other._transform = nullptr;
 			other._serial.clear();
 			other._config = { };
 		}
@@ -1,16 +1,17 @@
 #pragma once
 
 #include "kinectUtil.h"
+#include "pipeline.h"
 #include "k4arecord/playback.h"
 
 namespace kinectCloud {
 	// wrapper for azure kinect
 	class azureKinectPlayback {
 		k4a_playback_t _playback = nullptr;
-		k4a_transformation_t _transform = nullptr;
 		k4a_capture_t _capture = nullptr;
 
 		k4a_calibration_t _cali;
+		cloudPipeline _pipeline;
 		bool _eof = false;
 	public:
 
@@ -37,68 +38,16 @@ namespace kinectCloud {
 		// transform current frame into point cloud and save it
 		// may not save anything, if the image is not synchronized
 		// returns false if capture is not valid, otherwise true
-		inline bool saveCurrentPointCloud(std::string const& filePath) {
-			k4a_image_t depthImage = k4a_capture_get_depth_image(_capture);
-			k4a_image_t colorImage = k4a_capture_get_color_image(_capture);
-			if (_capture == nullptr || depthImage == nullptr || colorImage == nullptr) return false;
-
-			auto a = k4a_image_get_stride_bytes(colorImage);
-			auto b = k4a_image_get_size(colorImage);
-			auto c = k4a_image_get_format(colorImage);
-			k4a_image_t transformedDepthImage = nullptr;
-			k4a_image_t xyzImage = nullptr;
-
-			uint32_t resWidth = k4a_image_get_width_pixels(colorImage);
-			uint32_t resHeight = k4a_image_get_height_pixels(colorImage);
-			uint32_t colorStride = resWidth * sizeof(uint8_t) * 4;
-			uint32_t xyzStride = resWidth * sizeof(int16_t) * 3;
-			uint32_t transformedDepthStride = resWidth * sizeof(uint16_t);
-
-			if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16, resWidth, resHeight, transformedDepthStride, &transformedDepthImage)) {
-				k4a_image_release(depthImage);
-				k4a_image_release(colorImage);
-				throw std::runtime_error("failed to create mapped color image");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_color_camera(
-				_transform,
-				depthImage,
-				transformedDepthImage
-			)) {
-				k4a_image_release(depthImage);
-				k4a_image_release(colorImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to transform depth image to color image space");
-			}
-
-			k4a_image_release(depthImage);
-
-			if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM, resWidth, resHeight, xyzStride, &xyzImage)) {
-				k4a_image_release(colorImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to create point cloud image");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_point_cloud(
-				_transform,
-				transformedDepthImage,
-				K4A_CALIBRATION_TYPE_COLOR,
-				xyzImage
-			)) {
-				k4a_image_release(colorImage);
-				k4a_image_release(xyzImage);
-				k4a_image_release(transformedDepthImage);
-				throw std::runtime_error("failed to transform mapped depth to point cloud image");
-			}
-
-			k4a_image_release(transformedDepthImage);
-
-			savePointCloud(glm::uvec2(resWidth, resHeight), xyzImage, colorImage, filePath);
-
-			k4a_image_release(colorImage);
-			k4a_image_release(xyzImage);
+		// opts selects the grid the points are generated on, the threads used and the file format
+		inline bool saveCurrentPointCloud(std::string const& filePath, cloudOptions const& opts = {}) {
+			return _pipeline.save(_capture, filePath, opts);
+		}
 
-			return true;
+		// transform current frame into point cloud and hand it to any sink, see pipeline.h
+		// returns false if capture is not valid, otherwise true
+		template<class Sink>
+		inline bool emitCurrentPointCloud(Sink& sink, cloudOptions const& opts = {}) {
+			return _pipeline.run(_capture, opts, sink);
 		}
 
 		// jump to frame with t >= time and load capture
@@ -142,7 +91,7 @@ namespace kinectCloud {
 			if (K4A_RESULT_SUCCEEDED != k4a_playback_get_calibration(_playback, &_cali)) {
 				throw std::runtime_error("failed to retrieve playback calibration");
 			}
-			_transform = k4a_transformation_create(&_cali);
+			_pipeline = cloudPipeline(_cali);
 		}
 
 		// copy constructor removed
@@ -163,9 +112,6 @@ namespace kinectCloud {
 
 		// destructor
 		inline ~azureKinectPlayback() {
-			if (_transform) {
-				k4a_transformation_destroy(_transform);
-			}
 			if (_capture) {
 				k4a_capture_release(_capture);
 			}
@@ -174,19 +120,23 @@ namespace kinectCloud {
 			}
 		}
 
+		// buffers reused across frames, see frameArena
+		inline frameArena& arena() {
+			return _pipeline.arena();
+		}
+
 	private:
 
 		// copy values from other to this, then clear values from other
 		inline void move(azureKinectPlayback& other) {
 			_playback = other._playback;
 			_cali = other._cali;
-			_transform = other._transform;
+			_pipeline = std::move(other._pipeline);
 			_capture = other._capture;
 			_eof = other._eof;
 
 			other._playback = nullptr;
 			other._capture = nullptr;
-			other._transform = nullptr;
 			_eof = false;
 		}
 	};
@@ -6,6 +6,9 @@
 #include <chrono>
 
 #include "azureKinectDK.h"
+#include "cloudCodec.h"
+#include "frameRing.h"
+#include "frameStream.h"
 #include "k4arecord/record.h"
 #include "httplib.h"
 
@@ -16,32 +19,102 @@ namespace kinectCloud {
 
 		azureKinectDK* _dev;
 
-		struct frame {
-			void* data;
-			uint64_t dataSize;
-			int frameNum;
-		};
+		cloudOptions _opts;
 
-		std::vector<frame> frames;
+		std::mutex _optsMut; // _opts can be changed through /filters while frames are captured
+
+		int _quantization;
+
+		cloudEncoder _encoder;
+
+		// published frames, viewers copy them out without ever holding up the capture loop
+		frameRing frames;
+
+		// the same stream as /stream over plain tcp, for viewers which don't need http
+		tcpFrameServer _tcp;
 
 		int curFrame = 0;
 
-		int maxFrames;
+		// milliseconds /frame/next waits by default and at most
+		static constexpr int defaultNextTimeout = 5000;
+		static constexpr int maxNextTimeout = 60000;
 
-		std::mutex framesMut;
+		// threads answering requests, every /stream viewer holds one for as long as it is connected
+		static constexpr int serverThreads = 32;
+
+		// /stream and /frame/next viewers hold at most half the threads, the others are answered with 503
+		static constexpr int maxViewers = serverThreads / 2;
+		viewerLimit _viewers{ maxViewers };
 
 		std::atomic_bool shouldClose;
 	public:
 		// open recording with device
-		inline azureKinectServer(azureKinectDK* dev, int cacheFrames) : _dev(dev) {
-			maxFrames = cacheFrames;
+		// opts selects the grid the served point clouds are generated on
+		// quantization = step in mm of the compressed frames, 1 is lossless
+		// tcp = port and socket options of the tcp listener
+		inline azureKinectServer(azureKinectDK* dev, int cacheFrames, cloudOptions const& opts = {}, int quantization = 1, tcpStreamOptions const& tcp = {}) :
+			_dev(dev), _opts(opts), _quantization(quantization), frames(cacheFrames, blobSize(dev, opts)), _tcp(frames, tcp) {
+			// encoded once, by the first viewer which asks for the frame compressed, every later one gets the cached blob
+			// the normals, if any, follow the points, the compressed blob only carries the points
+			frames.encodeWith([this](frameRing::frame const& f, std::vector<uint8_t>& out) {
+				uint64_t count = ((uint64_t const*)f.data)[0];
+				_encoder.encode(f.data + sizeof(uint64_t), count, _quantization, out);
+			});
 
 			std::thread t([this]() {
 				_server = new httplib::Server();
+				// a long polling or streaming viewer holds a thread while it waits, the default pool has one per core
+				_server->new_task_queue = [] { return new httplib::ThreadPool(serverThreads); };
 
 				_server->Get("/status", [this](httplib::Request const& req, httplib::Response& res) {
+					std::lock_guard<std::mutex> lock(_optsMut);
 					json j = {
-						{"cache frames", maxFrames},
+						{"cache frames", frames.capacity()},
+						{"space", cloudSpaceToString(_opts.space)},
+						{"quantization", _quantization},
+						{"flying pixel jump", _opts.flyingPixelJump},
+						{"temporal", temporalModeToString(_opts.temporal)},
+						{"normals", normalFormatToString(_opts.normals)},
+						{"slab bytes", frames.slabSize()},
+						{"cache bytes", frames.bytes()},
+						{"frames published", frames.published()},
+						{"frames dropped", frames.dropped()},
+						{"viewers", _viewers.viewers()},
+						{"max viewers", _viewers.max()},
+						{"tcp port", _tcp.port()},
+						{"tcp subscribers", _tcp.subscribers()},
+						{"tcp frames sent", _tcp.framesSent()},
+						{"tcp refused", _tcp.refused()},
+					};
+					res.set_content(j.dump(4), "application/json");
+				});
+
+				// change filters for the following frames, returns the current settings
+				// /filters?flying=0.05 (0 turns it off), /filters?temporal=median&frames=5&reset=0.05, /filters?temporal=ema&weight=0.3
+				_server->Get("/filters", [this](httplib::Request const& req, httplib::Response& res) {
+					std::lock_guard<std::mutex> lock(_optsMut);
+					if (req.has_param("flying")) {
+						_opts.flyingPixelJump = std::max(0.f, float(std::atof(req.get_param_value("flying").c_str())));
+					}
+					if (req.has_param("temporal")) {
+						temporalMode mode;
+						if (temporalModeFromString(req.get_param_value("temporal"), mode)) _opts.temporal = mode;
+					}
+					if (req.has_param("weight")) {
+						_opts.temporalWeight = std::max(0.f, std::min(1.f, float(std::atof(req.get_param_value("weight").c_str()))));
+					}
+					if (req.has_param("frames")) {
+						_opts.temporalFrames = std::max(1, std::min(temporalFilter::maxFrames, std::atoi(req.get_param_value("frames").c_str())));
+					}
+					if (req.has_param("reset")) {
+						_opts.temporalReset = std::max(0.f, float(std::atof(req.get_param_value("reset").c_str())));
+					}
+					json j = {
+						{"flying pixel jump", _opts.flyingPixelJump},
+						{"temporal", temporalModeToString(_opts.temporal)},
+						{"temporal weight", _opts.temporalWeight},
+						{"temporal frames", _opts.temporalFrames},
+						{"temporal reset", _opts.temporalReset},
 					};
 					res.set_content(j.dump(4), "application/json");
 				});
@@ -49,11 +122,10 @@ namespace kinectCloud {
 				_server->Get("/frames", [this](httplib::Request const& req, httplib::Response& res) {
 					std::string str;
 
-					{
-						std::lock_guard<std::mutex> lock(framesMut);
-						for (int i = 0; i < frames.size(); i++) {
-							str += std::to_string(frames[i].frameNum) + "\n";
-						}
+					auto latest = frames.latest();
+					int latestNum = latest ? latest->frameNum : -1;
+					for (int n = std::max(0, latestNum - frames.capacity() + 1); n <= latestNum; n++) {
+						if (frames.find(n)) str += std::to_string(n) + "\n";
 					}
 
 					res.set_content(str, "text/plain");
@@ -63,26 +135,91 @@ namespace kinectCloud {
 					auto m = req.matches[1].str();
 	
 					int frameNum = atoi(m.c_str());
-					std::lock_guard<std::mutex> lock(framesMut);
-
-					int index = -1;
-					for (int i = 0; i < frames.size(); i++) if (frames[i].frameNum == frameNum) { index = i; break; }
-					if (index == -1) return;
+					auto f = frames.find(frameNum);
+					if (!f) return;
 
-					res.set_content((char*)frames[index].data, frames[index].dataSize, "application/octet-stream");
+					res.set_content((char*)f->data, f->dataSize, "application/octet-stream");
 				});
 
 				_server->Get("/frame/latest", [this](httplib::Request const& req, httplib::Response& res) {
-					std::lock_guard<std::mutex> lock(framesMut);
+					auto f = frames.latest();
+					if (!f) return;
+
+					res.set_content((char*)f->data, f->dataSize, "application/octet-stream");
+				});
+
+				_server->Get(R"(/frame/(\d+)/compressed)", [this](httplib::Request const& req, httplib::Response& res) {
+					int frameNum = atoi(req.matches[1].str().c_str());
+					auto f = frames.find(frameNum);
+					if (!f) return;
+
+					auto const& blob = frames.compressed(*f);
+					res.set_content((char const*)blob.data(), blob.size(), "application/octet-stream");
+				});
+
+				_server->Get("/frame/latest/compressed", [this](httplib::Request const& req, httplib::Response& res) {
+					auto f = frames.latest();
+					if (!f) return;
+
+					auto const& blob = frames.compressed(*f);
+					res.set_content((char const*)blob.data(), blob.size(), "application/octet-stream");
+				});
 
-					int index = frames.empty() ? -1 : (frames.size() - 1);
-					if (index == -1) return;
+				// long poll, /frame/next?after=N waits until a frame newer than N exists and returns it with its number
+				// in X-Frame-Number. without after it waits for the next frame. 204 if none came within timeout ms
+				_server->Get("/frame/next", [this](httplib::Request const& req, httplib::Response& res) {
+					auto viewer = _viewers.acquire();
+					if (!viewer) {
+						tooManyViewers(res);
+						return;
+					}
+					auto f = nextFrame(req);
+					if (!f) {
+						res.status = 204;
+						return;
+					}
+					res.set_header("X-Frame-Number", std::to_string(f->frameNum));
+					res.set_content((char const*)f->data, f->dataSize, "application/octet-stream");
+				});
 
-					res.set_content((char*)frames[index].data, frames[index].dataSize, "application/octet-stream");
+				_server->Get("/frame/next/compressed", [this](httplib::Request const& req, httplib::Response& res) {
+					auto viewer = _viewers.acquire();
+					if (!viewer) {
+						tooManyViewers(res);
+						return;
+					}
+					auto f = nextFrame(req);
+					if (!f) {
+						res.status = 204;
+						return;
+					}
+					res.set_header("X-Frame-Number", std::to_string(f->frameNum));
+					auto const& blob = frames.compressed(*f);
+					res.set_content((char const*)blob.data(), blob.size(), "application/octet-stream");
+				});
+
+				// continuous stream of frames over one connection, see frameStream.h
+				_server->Get("/stream", [this](httplib::Request const& req, httplib::Response& res) {
+					auto viewer = _viewers.acquire();
+					if (!viewer) {
+						tooManyViewers(res);
+						return;
+					}
+					httpFrameStream(frames, res, false, std::move(viewer));
+				});
+
+				_server->Get("/stream/compressed", [this](httplib::Request const& req, httplib::Response& res) {
+					auto viewer = _viewers.acquire();
+					if (!viewer) {
+						tooManyViewers(res);
+						return;
+					}
+					httpFrameStream(frames, res, true, std::move(viewer));
 				});
 
 				_server->Get("/close", [this](httplib::Request const& req, httplib::Response& res) {
 					shouldClose = true;
+					frames.close();
 					_server->stop();
 				});
 
@@ -94,29 +231,28 @@ namespace kinectCloud {
 				_dev->captureFrame();
 				k4a_capture_t cap = _dev->getCurrCapture();
 				if (cap) {
-					uint8_t* rawMem = new uint8_t[1024 * 1024 * 128];
-					((uint64_t*)rawMem)[0] = _dev->saveCurrentPointCloudRaw(rawMem + sizeof(uint64_t));
-					
-					frame f;
-					f.data = rawMem;
-					f.dataSize = ((uint64_t*)rawMem)[0] * 9 + 8;
-					f.frameNum = curFrame;
-					curFrame++;
-
+					cloudOptions opts;
 					{
-						std::lock_guard<std::mutex> lock(framesMut);
+						std::lock_guard<std::mutex> lock(_optsMut);
+						opts = _opts;
+					}
 
-						if (frames.size() >= maxFrames) {
-							delete[] frames.begin()->data;
-							frames.erase(frames.begin());
-						}
+					// viewers still copying every spare slab, this frame is dropped rather than waiting for them
+					frameRing::frame* f = frames.acquire();
+					if (!f) continue;
 
-						frames.push_back(f);
-					}
+					uint8_t* rawMem = f->data;
+					uint64_t pointSize = 9 + normalSize(opts.normals);
+					((uint64_t*)rawMem)[0] = _dev->saveCurrentPointCloudRaw(rawMem + sizeof(uint64_t), opts);
+					f->dataSize = ((uint64_t*)rawMem)[0] * pointSize + 8;
+
+					frames.publish(f, curFrame);
+					curFrame++;
 				}
 			}
 
 			t.join();
+			_tcp.stop();
 		}
 
 		// copy constructor removed
@@ -142,6 +278,33 @@ namespace kinectCloud {
 
 	private:
 
+		// frame a /frame/next request waits for, see frameRing::next
+		inline std::shared_ptr<frameRing::frame const> nextFrame(httplib::Request const& req) {
+			int after;
+			if (req.has_param("after")) {
+				after = std::atoi(req.get_param_value("after").c_str());
+			} else {
+				auto latest = frames.latest();
+				after = latest ? latest->frameNum : -1;
+			}
+			int timeout = req.has_param("timeout") ? std::atoi(req.get_param_value("timeout").c_str()) : defaultNextTimeout;
+			timeout = std::max(0, std::min(timeout, maxNextTimeout));
+			return frames.next(after, std::chrono::milliseconds(timeout));
+		}
+
+		// answer to a /stream or /frame/next viewer beyond maxViewers
+		static inline void tooManyViewers(httplib::Response& res) {
+			res.status = 503;
+			res.set_header("Retry-After", "1");
+			res.set_content("too many viewers\n", "text/plain");
+		}
+
+		// bytes of the largest raw blob of dev: the point count followed by every point of the grid, and their normals
+		static inline uint64_t blobSize(azureKinectDK* dev, cloudOptions const& opts) {
+			glm::uvec2 grid = dev->cloudGridSize(opts.space);
+			return sizeof(uint64_t) + uint64_t(grid.x) * grid.y * (9 + normalSize(opts.normals));
+		}
+
 		// copy values from other to this, then clear values from other
 		inline void move(azureKinectServer& other) {
 			throw std::runtime_error("move not supported for azureKinectServer");
@@ -0,0 +1,1036 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+#include <limits>
+
+#include "kinectUtil.h"
+#include "pipeline.h"
+#include "cloudCodec.h"
+#include "frameRing.h"
+#include "frameStream.h"
+
+namespace kinectCloud {
+	// color resolutions the benchmarks run at
+	const std::vector<glm::uvec2> benchmarkSizes = {
+		glm::uvec2(1280, 720),
+		glm::uvec2(3840, 2160),
+		glm::uvec2(4096, 3072),
+	};
+
+	// fill xyz and bgra with a synthetic frame resembling a mapped depth image
+	// an ellipse of valid depth (the depth camera field of view) with a few random holes
+	void syntheticFrame(glm::uvec2 size, std::vector<int16_t>& xyz, std::vector<uint8_t>& bgra) {
+		std::mt19937 rng(1234);
+		std::uniform_int_distribution<int> dist(0, 255);
+		xyz.assign(uint64_t(size.x) * size.y * 3, 0);
+		bgra.resize(uint64_t(size.x) * size.y * 4);
+		for (uint32_t y = 0; y < size.y; y++) {
+			for (uint32_t x = 0; x < size.x; x++) {
+				uint64_t i = uint64_t(y) * size.x + x;
+				float dx = (x - size.x * 0.5f) / (size.x * 0.45f);
+				float dy = (y - size.y * 0.5f) / (size.y * 0.55f);
+				bool valid = dx * dx + dy * dy < 1.0f && (dist(rng) > 5);
+				if (valid) {
+					xyz[i * 3 + 0] = int16_t(x) - int16_t(size.x / 2);
+					xyz[i * 3 + 1] = int16_t(y) - int16_t(size.y / 2);
+					xyz[i * 3 + 2] = int16_t(500 + dist(rng) * 10);
+				}
+				for (int c = 0; c < 4; c++) {
+					bgra[i * 4 + c] = uint8_t(dist(rng));
+				}
+			}
+		}
+	}
+
+	// fill xyz and bgra with a synthetic frame resembling a real scene, for benchmarks where the content matters
+	// a floor, a back wall and a sphere seen through a pinhole camera, smooth colors with some sensor noise
+	void syntheticScene(glm::uvec2 size, std::vector<int16_t>& xyz, std::vector<uint8_t>& bgra) {
+		std::mt19937 rng(1234);
+		std::uniform_int_distribution<int> noise(-3, 3);
+		std::uniform_int_distribution<int> holes(0, 99);
+		xyz.assign(uint64_t(size.x) * size.y * 3, 0);
+		bgra.assign(uint64_t(size.x) * size.y * 4, 0);
+		float focal = size.x * 0.5f;
+		for (uint32_t y = 0; y < size.y; y++) {
+			for (uint32_t x = 0; x < size.x; x++) {
+				uint64_t i = uint64_t(y) * size.x + x;
+				glm::vec3 ray((x - size.x * 0.5f) / focal, (y - size.y * 0.5f) / focal, 1.0f);
+
+				// wall at 3 m, floor 1 m below the camera, sphere of 0.5 m radius at 1.8 m
+				float depth = 3000.0f;
+				if (ray.y > 0.0f) depth = std::min(depth, 1000.0f / ray.y);
+				glm::vec3 center(0.0f, 300.0f, 1800.0f);
+				float b = glm::dot(ray, center), c = glm::dot(center, center) - 500.0f * 500.0f, a = glm::dot(ray, ray);
+				float disc = b * b - a * c;
+				if (disc > 0.0f) depth = std::min(depth, (b - std::sqrt(disc)) / a);
+
+				if (holes(rng) < 3) continue;
+				glm::vec3 p = ray * depth;
+				xyz[i * 3 + 0] = int16_t(p.x);
+				xyz[i * 3 + 1] = int16_t(p.y);
+				xyz[i * 3 + 2] = int16_t(p.z);
+				for (int ch = 0; ch < 3; ch++) {
+					int value = int(64 + (ch + 1) * 40 * (x + y) / (size.x + size.y)) + noise(rng);
+					bgra[i * 4 + ch] = uint8_t(std::max(0, std::min(255, value)));
+				}
+				bgra[i * 4 + 3] = 255;
+			}
+		}
+	}
+
+	// run fn iterations times, returns average milliseconds per run
+	template<class F>
+	double timeMillis(int iterations, F&& fn) {
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			fn();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+	}
+
+	// compare scalar and vectorized point compaction
+	void benchmarkCompaction(glm::uvec2 size) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticFrame(size, xyz, bgra);
+		uint64_t count = uint64_t(size.x) * size.y;
+		std::vector<uint8_t> scalarOut(count * 9), simdOut(count * 9);
+
+		uint64_t scalarPoints = 0, simdPoints = 0;
+		double scalarMs = timeMillis(20, [&]() { scalarPoints = compactPointsScalar(xyz.data(), bgra.data(), count, scalarOut.data()); });
+		double simdMs = timeMillis(20, [&]() { simdPoints = compactPoints(xyz.data(), bgra.data(), count, simdOut.data()); });
+		bool identical = scalarPoints == simdPoints && memcmp(scalarOut.data(), simdOut.data(), scalarPoints * 9) == 0;
+
+		std::cout << "compaction " << size.x << "x" << size.y << ": " << simdPoints << " points"
+			<< ", scalar " << scalarMs << " ms"
+			<< ", simd " << simdMs << " ms"
+			<< ", output " << (identical ? "identical" : "DIFFERS") << "\n";
+	}
+
+	// wrap a buffer as a k4a image, buffer must outlive the image
+	k4a_image_t wrapImage(k4a_image_format_t format, glm::uvec2 size, uint32_t pixelSize, void* buffer) {
+		k4a_image_t res = nullptr;
+		if (K4A_RESULT_SUCCEEDED != k4a_image_create_from_buffer(
+			format, size.x, size.y, size.x * pixelSize,
+			(uint8_t*)buffer, size_t(size.x) * size.y * pixelSize,
+			nullptr, nullptr, &res
+		)) {
+			throw std::runtime_error("failed to wrap benchmark image");
+		}
+		return res;
+	}
+
+	// pts writer throughput from 1 thread up to every core, output is compared against 1 thread
+	void benchmarkPtsWriter(glm::uvec2 size) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticFrame(size, xyz, bgra);
+		k4a_image_t xyzImg = wrapImage(K4A_IMAGE_FORMAT_CUSTOM, size, sizeof(int16_t) * 3, xyz.data());
+		k4a_image_t colorImg = wrapImage(K4A_IMAGE_FORMAT_COLOR_BGRA32, size, sizeof(uint8_t) * 4, bgra.data());
+
+		const std::string loc = "kinectCloud_benchmark.pts";
+		savePointCloud(size, xyzImg, colorImg, loc, 1);
+		std::string reference = readEntireFile(loc);
+
+		int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+			double ms = timeMillis(3, [&]() { savePointCloud(size, xyzImg, colorImg, loc, threads); });
+			bool identical = readEntireFile(loc) == reference;
+			std::cout << "pts writer " << size.x << "x" << size.y << ", " << threads << " threads: "
+				<< ms << " ms, " << (reference.size() / (1024.0 * 1024.0)) / (ms / 1000.0) << " MB/s"
+				<< ", output " << (identical ? "identical" : "DIFFERS") << "\n";
+			if (threads == maxThreads) break;
+		}
+
+		remove(loc.c_str());
+		k4a_image_release(xyzImg);
+		k4a_image_release(colorImg);
+	}
+
+	// int16 formatting against snprintf and against a table of every int16 string (the previous approach)
+	void benchmarkFormatting() {
+		const int count = 1 << 22;
+		std::mt19937 rng(1234);
+		std::uniform_int_distribution<int> coord(-6000, 6000);
+		std::uniform_int_distribution<int> full(std::numeric_limits<int16_t>::min(), std::numeric_limits<int16_t>::max());
+		std::vector<int16_t> values(count);
+		for (int i = 0; i < count; i++) {
+			values[i] = int16_t((i % 8) ? coord(rng) : full(rng));
+		}
+
+		std::vector<char> cache;
+		std::vector<uint32_t> begins(65536), sizes(65536);
+		for (int i = 0; i < 65536; i++) {
+			char str[8];
+			sizes[i] = snprintf(str, sizeof(str), "%d", i + std::numeric_limits<int16_t>::min());
+			begins[i] = uint32_t(cache.size());
+			cache.insert(cache.end(), str, str + sizes[i]);
+		}
+
+		std::vector<char> out(size_t(count) * 7 + 8), expected(size_t(count) * 7 + 8);
+		size_t outSize = 0, expectedSize = 0;
+		double printfMs = timeMillis(3, [&]() {
+			char* current = expected.data();
+			for (int16_t v : values) current += snprintf(current, 8, "%d", v);
+			expectedSize = current - expected.data();
+		});
+		double cachedMs = timeMillis(3, [&]() {
+			char* current = out.data();
+			for (int16_t v : values) {
+				int i = v - std::numeric_limits<int16_t>::min();
+				memcpy(current, cache.data() + begins[i], sizes[i]);
+				current += sizes[i];
+			}
+		});
+		double fixedMs = timeMillis(3, [&]() {
+			char* current = out.data();
+			for (int16_t v : values) current = fastCopyInt16Str(current, v);
+			outSize = current - out.data();
+		});
+		bool identical = outSize == expectedSize && memcmp(out.data(), expected.data(), outSize) == 0;
+
+		std::cout << "int16 formatting " << count << " values: snprintf " << printfMs << " ms"
+			<< ", cached strings " << cachedMs << " ms"
+			<< ", fixed width " << fixedMs << " ms"
+			<< ", output " << (identical ? "identical" : "DIFFERS") << "\n";
+	}
+
+	// load a raw calibration blob, as stored in recordings or returned by k4a_device_get_raw_calibration
+	k4a_calibration_t loadCalibration(std::string const& path, k4a_depth_mode_t depthMode, k4a_color_resolution_t colorRes) {
+		std::vector<uint8_t> raw = readEntireFileBinary(path);
+		raw.push_back(0);
+		k4a_calibration_t cali;
+		if (K4A_RESULT_SUCCEEDED != k4a_calibration_get_from_raw((char*)raw.data(), raw.size(), depthMode, colorRes, &cali)) {
+			throw std::runtime_error("invalid calibration file " + path);
+		}
+		return cali;
+	}
+
+	// synthetic depth image in mm, a tilted plane with a step and some invalid pixels
+	std::vector<uint16_t> syntheticDepth(glm::uvec2 size) {
+		std::mt19937 rng(1234);
+		std::uniform_int_distribution<int> dist(0, 99);
+		std::vector<uint16_t> depth(uint64_t(size.x) * size.y);
+		for (uint32_t y = 0; y < size.y; y++) {
+			for (uint32_t x = 0; x < size.x; x++) {
+				uint16_t d = uint16_t(800 + x * 2000 / size.x + y * 1000 / size.y + ((x > size.x / 2) ? 600 : 0));
+				depth[uint64_t(y) * size.x + x] = (dist(rng) < 3) ? 0 : d;
+			}
+		}
+		return depth;
+	}
+
+	// compare the ray table against k4a_transformation_depth_image_to_point_cloud for the color camera
+	void benchmarkRayTable(std::string const& calibrationPath, k4a_depth_mode_t depthMode, k4a_color_resolution_t colorRes) {
+		k4a_calibration_t cali = loadCalibration(calibrationPath, depthMode, colorRes);
+		k4a_transformation_t transform = k4a_transformation_create(&cali);
+		rayTable rays;
+		double buildMs = timeMillis(1, [&]() { rays = createRayTable(cali, K4A_CALIBRATION_TYPE_COLOR); });
+
+		glm::uvec2 size = rays.size;
+		std::vector<uint16_t> depth = syntheticDepth(size);
+		std::vector<int16_t> sdkXyz(uint64_t(size.x) * size.y * 3), tableXyz(uint64_t(size.x) * size.y * 3);
+		k4a_image_t depthImg = wrapImage(K4A_IMAGE_FORMAT_DEPTH16, size, sizeof(uint16_t), depth.data());
+		k4a_image_t sdkImg = wrapImage(K4A_IMAGE_FORMAT_CUSTOM, size, sizeof(int16_t) * 3, sdkXyz.data());
+		k4a_image_t tableImg = wrapImage(K4A_IMAGE_FORMAT_CUSTOM, size, sizeof(int16_t) * 3, tableXyz.data());
+
+		double sdkMs = timeMillis(10, [&]() {
+			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_point_cloud(transform, depthImg, K4A_CALIBRATION_TYPE_COLOR, sdkImg)) {
+				throw std::runtime_error("failed to transform depth to point cloud");
+			}
+		});
+		double tableMs = timeMillis(10, [&]() { depthImageToXyz(rays, depthImg, tableImg); });
+
+		int maxError = 0;
+		for (size_t i = 0; i < sdkXyz.size(); i++) {
+			maxError = std::max(maxError, std::abs(int(sdkXyz[i]) - int(tableXyz[i])));
+		}
+
+		std::cout << "ray table " << size.x << "x" << size.y << ": build " << buildMs << " ms"
+			<< ", sdk " << sdkMs << " ms, table " << tableMs << " ms"
+			<< ", max error " << maxError << " mm\n";
+
+		k4a_image_release(depthImg);
+		k4a_image_release(sdkImg);
+		k4a_image_release(tableImg);
+		k4a_transformation_destroy(transform);
+	}
+
+	// binary ply writer next to the pts writer on the same frame
+	// the records are compared byte for byte against rawSink, both keep the points in row order
+	void benchmarkPlyWriter(glm::uvec2 size) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticFrame(size, xyz, bgra);
+		k4a_image_t xyzImg = wrapImage(K4A_IMAGE_FORMAT_CUSTOM, size, sizeof(int16_t) * 3, xyz.data());
+		k4a_image_t colorImg = wrapImage(K4A_IMAGE_FORMAT_COLOR_BGRA32, size, sizeof(uint8_t) * 4, bgra.data());
+
+		std::vector<uint8_t> raw(uint64_t(size.x) * size.y * 9);
+		uint64_t points = savePointCloudRaw(size, xyzImg, colorImg, raw.data());
+
+		const std::string ptsLoc = "kinectCloud_benchmark.pts", plyLoc = "kinectCloud_benchmark.ply";
+		frameArena arena;
+		int threads = std::max(1u, std::thread::hardware_concurrency());
+		double ptsMs = timeMillis(3, [&]() { savePointCloud(size, xyzImg, colorImg, ptsLoc, threads, &arena); });
+		double plyMs = timeMillis(3, [&]() { savePointCloudPly(size, xyzImg, colorImg, plyLoc, threads, &arena); });
+		uint64_t ptsBytes = std::filesystem::file_size(ptsLoc), plyBytes = std::filesystem::file_size(plyLoc);
+
+		std::vector<uint8_t> plyData = readEntireFileBinary(plyLoc);
+		std::string ply(plyData.begin(), plyData.end());
+		// "element vertex " + up to 20 digits + "\n"
+		char vertexLine[40];
+		snprintf(vertexLine, sizeof(vertexLine), "element vertex %010llu\n", (unsigned long long)points);
+		size_t body = ply.find("end_header\n");
+		bool identical = body != std::string::npos && ply.find(vertexLine) != std::string::npos &&
+			ply.size() - (body + 11) == points * 9 && memcmp(plyData.data() + body + 11, raw.data(), points * 9) == 0;
+
+		std::cout << "ply writer " << size.x << "x" << size.y << ", " << threads << " threads: "
+			<< plyMs << " ms / " << (plyBytes / (1024.0 * 1024.0)) << " MB, pts " << ptsMs << " ms / " << (ptsBytes / (1024.0 * 1024.0)) << " MB"
+			<< ", points " << (identical ? "identical" : "DIFFER") << "\n";
+
+		remove(ptsLoc.c_str());
+		remove(plyLoc.c_str());
+		k4a_image_release(xyzImg);
+		k4a_image_release(colorImg);
+	}
+
+	// the server's frame publication under load: a producer fills and publishes blobs of the raw size of a size cloud
+	// as fast as it can while viewer threads copy the latest frame into a string, as httplib does for a response.
+	// the frameRing is measured against a cache behind one mutex, which viewers hold while they copy.
+	// reports frames per second of the producer and the longest it waited to publish a frame, apart from filling it
+	void benchmarkFramePublication(glm::uvec2 size) {
+		const uint64_t blobBytes = sizeof(uint64_t) + uint64_t(size.x) * size.y * 9;
+		std::vector<uint8_t> source(blobBytes, 7);
+		for (bool lockFree : { false, true }) {
+			for (int viewers : { 0, 1, 4, 16 }) {
+				frameRing ring(10, blobBytes);
+				std::vector<uint8_t> locked(blobBytes);
+				std::mutex lock;
+				std::atomic_bool stop(false);
+				std::atomic<uint64_t> copies(0);
+
+				std::vector<std::thread> threads;
+				for (int v = 0; v < viewers; v++) {
+					threads.emplace_back([&]() {
+						std::string response;
+						while (!stop) {
+							if (lockFree) {
+								auto f = ring.latest();
+								if (!f) continue;
+								response.assign((char const*)f->data, f->dataSize);
+							} else {
+								std::lock_guard<std::mutex> guard(lock);
+								response.assign((char const*)locked.data(), locked.size());
+							}
+							copies++;
+						}
+					});
+				}
+
+				int frames = 0;
+				double longestWait = 0.0;
+				auto start = std::chrono::high_resolution_clock::now();
+				while (std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() < 1.0) {
+					auto waitStart = std::chrono::high_resolution_clock::now();
+					double waited = 0.0;
+					if (lockFree) {
+						frameRing::frame* f = ring.acquire();
+						waited = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+						if (!f) continue;
+						memcpy(f->data, source.data(), blobBytes);
+						f->dataSize = blobBytes;
+						auto publishStart = std::chrono::high_resolution_clock::now();
+						ring.publish(f, frames);
+						waited += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - publishStart).count();
+					} else {
+						std::lock_guard<std::mutex> guard(lock);
+						waited = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+						memcpy(locked.data(), source.data(), blobBytes);
+					}
+					longestWait = std::max(longestWait, waited);
+					frames++;
+				}
+				double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				stop = true;
+				for (auto& t : threads) t.join();
+
+				std::cout << "frame publication " << size.x << "x" << size.y << ", " << (lockFree ? "frame ring" : "mutex") << ", " << viewers
+					<< " viewers: " << frames / seconds << " fps, longest wait " << longestWait << " ms, " << copies / seconds << " copies/s"
+					<< (lockFree ? ", " + std::to_string(ring.dropped()) + " dropped" : "") << "\n";
+			}
+		}
+	}
+
+	// the server's /frame/latest under load over loopback: a producer publishes raw blobs of the size of a size cloud
+	// at 30 fps like a camera, or as fast as it can, into the cache of a real httplib server with the server's thread
+	// pool and handler, while viewer threads request /frame/latest with httplib's client in a loop. the frameRing is
+	// measured against a cache behind one mutex, which the handler holds while it copies the frame into the response.
+	// reports frames per second of the producer, the longest it waited to publish a frame apart from filling it,
+	// and responses per second the viewers receive
+	void benchmarkLatestFrame(glm::uvec2 size) {
+		const uint64_t blobBytes = sizeof(uint64_t) + uint64_t(size.x) * size.y * 9;
+		const int port = 5699;
+		std::vector<uint8_t> source(blobBytes, 7);
+		for (int fps : { 30, 0 }) for (bool lockFree : { false, true }) {
+			for (int viewers : { 0, 1, 4, 16 }) {
+				frameRing ring(10, blobBytes);
+				std::vector<uint8_t> locked(blobBytes);
+				std::mutex lock;
+				std::atomic_bool stop(false);
+				std::atomic<uint64_t> responses(0), bytes(0);
+
+				httplib::Server server;
+				server.new_task_queue = [] { return new httplib::ThreadPool(32); };
+				server.Get("/frame/latest", [&](httplib::Request const& req, httplib::Response& res) {
+					if (lockFree) {
+						auto f = ring.latest();
+						if (!f) return;
+						res.set_content((char*)f->data, f->dataSize, "application/octet-stream");
+					} else {
+						std::lock_guard<std::mutex> guard(lock);
+						res.set_content((char*)locked.data(), locked.size(), "application/octet-stream");
+					}
+				});
+				std::thread listener([&]() {
+					server.listen("127.0.0.1", port);
+				});
+				while (!server.is_running()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+				std::vector<std::thread> threads;
+				for (int v = 0; v < viewers; v++) {
+					threads.emplace_back([&]() {
+						httplib::Client client("127.0.0.1", port);
+						while (!stop) {
+							auto res = client.Get("/frame/latest");
+							if (res && res->status == 200 && !res->body.empty()) {
+								responses++;
+								bytes += res->body.size();
+							}
+						}
+					});
+				}
+
+				int frames = 0;
+				double longestWait = 0.0;
+				auto start = std::chrono::high_resolution_clock::now();
+				auto next = start;
+				while (std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() < 2.0) {
+					if (fps) {
+						next += std::chrono::microseconds(1000000 / fps);
+						std::this_thread::sleep_until(next);
+					}
+					auto waitStart = std::chrono::high_resolution_clock::now();
+					double waited = 0.0;
+					if (lockFree) {
+						frameRing::frame* f = ring.acquire();
+						waited = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+						if (!f) continue;
+						memcpy(f->data, source.data(), blobBytes);
+						f->dataSize = blobBytes;
+						auto publishStart = std::chrono::high_resolution_clock::now();
+						ring.publish(f, frames);
+						waited += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - publishStart).count();
+					} else {
+						std::lock_guard<std::mutex> guard(lock);
+						waited = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+						memcpy(locked.data(), source.data(), blobBytes);
+					}
+					longestWait = std::max(longestWait, waited);
+					frames++;
+				}
+				double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				stop = true;
+				for (auto& t : threads) t.join();
+				server.stop();
+				listener.join();
+
+				std::cout << "latest frame over http " << size.x << "x" << size.y << ", " << (fps ? std::to_string(fps) + " fps" : "unthrottled") << ", "
+					<< (lockFree ? "frame ring" : "mutex") << ", " << viewers << " viewers: " << frames / seconds << " fps, longest wait " << longestWait << " ms, " << responses / seconds << " responses/s, " << bytes / seconds / (1024 * 1024) << " MB/s"
+					<< (lockFree ? ", " + std::to_string(ring.dropped()) + " dropped" : "") << "\n";
+			}
+		}
+	}
+
+	// the server's two streaming transports over loopback: a producer publishes raw blobs of the size of a size cloud
+	// while one viewer reads them from /stream with httplib's client or from the tcp listener with tcpFrameClient.
+	// at 30 fps it reports the latency from publish until the viewer holds the whole frame, unthrottled the frames
+	// and megabytes per second the viewer receives
+	void benchmarkStreamTransports(glm::uvec2 size) {
+		const uint64_t blobBytes = sizeof(uint64_t) + uint64_t(size.x) * size.y * 9;
+		const int httpPort = 5697, tcpPort = 5698;
+		std::vector<uint8_t> source(blobBytes, 7);
+		for (bool tcp : { false, true }) {
+			for (int fps : { 30, 0 }) {
+				frameRing ring(10, blobBytes);
+				std::atomic_bool stop(false);
+
+				// every blob carries the time it was published, right after the point count
+				std::thread producer([&]() {
+					int n = 0;
+					auto next = std::chrono::steady_clock::now();
+					while (!stop) {
+						if (fps) {
+							next += std::chrono::microseconds(1000000 / fps);
+							std::this_thread::sleep_until(next);
+						}
+						frameRing::frame* f = ring.acquire();
+						if (!f) continue;
+						memcpy(f->data, source.data(), blobBytes);
+						f->dataSize = blobBytes;
+						int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+						memcpy(f->data + sizeof(uint64_t), &now, sizeof(now));
+						ring.publish(f, n++);
+					}
+				});
+
+				int received = 0;
+				uint64_t bytes = 0;
+				double latencySum = 0.0, longestLatency = 0.0;
+				auto start = std::chrono::steady_clock::now();
+				auto elapsed = [&]() {
+					return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				};
+				auto frameDone = [&](uint8_t const* blob, uint64_t size) {
+					int64_t published;
+					memcpy(&published, blob + sizeof(uint64_t), sizeof(published));
+					double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch() -
+						std::chrono::steady_clock::duration(published)).count();
+					latencySum += latency;
+					longestLatency = std::max(longestLatency, latency);
+					received++;
+					bytes += size;
+				};
+
+				if (tcp) {
+					tcpStreamOptions opts;
+					opts.port = tcpPort;
+					tcpFrameServer server(ring, opts);
+					{
+						tcpFrameClient client("127.0.0.1", tcpPort);
+						std::vector<uint8_t> blob;
+						while (elapsed() < 2.0) {
+							client.next(blob);
+							frameDone(blob.data(), blob.size());
+						}
+					}
+					ring.close();
+					server.stop();
+				} else {
+					httplib::Server server;
+					server.Get("/stream", [&](httplib::Request const& req, httplib::Response& res) {
+						httpFrameStream(ring, res, false);
+					});
+					std::thread listener([&]() {
+						server.listen("127.0.0.1", httpPort);
+					});
+					while (!server.is_running()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+					// records arrive in pieces of httplib's receive buffer
+					std::vector<uint8_t> record;
+					uint64_t header[2] = { 0, 0 };
+					uint64_t headerBytes = 0;
+					httplib::Client client("127.0.0.1", httpPort);
+					client.Get("/stream", [&](char const* data, size_t length) {
+						while (length) {
+							if (headerBytes < sizeof(header)) {
+								size_t n = size_t(std::min<uint64_t>(length, sizeof(header) - headerBytes));
+								memcpy((uint8_t*)header + headerBytes, data, n);
+								headerBytes += n;
+								data += n;
+								length -= n;
+								if (headerBytes == sizeof(header)) record.clear();
+							} else {
+								size_t n = size_t(std::min<uint64_t>(length, header[0] - record.size()));
+								record.insert(record.end(), data, data + n);
+								data += n;
+								length -= n;
+							}
+							if (headerBytes == sizeof(header) && record.size() == header[0]) {
+								if (header[0]) frameDone(record.data(), record.size());
+								headerBytes = 0;
+							}
+						}
+						return elapsed() < 2.0;
+					});
+					ring.close();
+					server.stop();
+					listener.join();
+				}
+				double seconds = elapsed();
+				stop = true;
+				producer.join();
+
+				std::cout << "stream " << size.x << "x" << size.y << ", " << (tcp ? "tcp" : "http") << ", " << (fps ? std::to_string(fps) + " fps" : "unthrottled")
+					<< ": " << received / seconds << " frames/s, " << bytes / seconds / (1024 * 1024) << " MB/s, latency mean "
+					<< (received ? latencySum / received : 0.0) << " ms, longest " << longestLatency << " ms\n";
+			}
+		}
+	}
+
+	// frames per second saving a stream of pts files through every file output backend, like -e does
+	void benchmarkFileOutput(glm::uvec2 size, int frames) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticFrame(size, xyz, bgra);
+		k4a_image_t xyzImg = wrapImage(K4A_IMAGE_FORMAT_CUSTOM, size, sizeof(int16_t) * 3, xyz.data());
+		k4a_image_t colorImg = wrapImage(K4A_IMAGE_FORMAT_COLOR_BGRA32, size, sizeof(uint8_t) * 4, bgra.data());
+
+		auto path = [](int frame) { return "kinectCloud_benchmark_" + std::to_string(frame) + ".pts"; };
+		savePointCloud(size, xyzImg, colorImg, path(0), 1);
+		std::string reference = readEntireFile(path(0));
+
+		frameArena arena;
+		int threads = std::max(1u, std::thread::hardware_concurrency());
+		for (auto backend : { outputBackend::stdio, outputBackend::pwrite, outputBackend::uring }) {
+			std::unique_ptr<fileOutput> output = createFileOutput(backend);
+			double ms = timeMillis(1, [&]() {
+				for (int frame = 0; frame < frames; frame++) {
+					savePointCloud(size, xyzImg, colorImg, path(frame), threads, &arena, output.get());
+				}
+				output->flush();
+			});
+			bool identical = readEntireFile(path(frames - 1)) == reference;
+			std::cout << "file output " << output->name() << " " << size.x << "x" << size.y << ", " << frames << " frames: "
+				<< frames / (ms / 1000.0) << " frames/s, output " << (identical ? "identical" : "DIFFERS") << "\n";
+		}
+
+		for (int frame = 0; frame < frames; frame++) {
+			remove(path(frame).c_str());
+		}
+		k4a_image_release(xyzImg);
+		k4a_image_release(colorImg);
+	}
+
+	// compression ratio and speed of the server codec, lossless and with 4 mm quantization
+	void benchmarkCodec(glm::uvec2 size) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticScene(size, xyz, bgra);
+		std::vector<uint8_t> raw(uint64_t(size.x) * size.y * 9);
+		uint64_t points = compactPoints(xyz.data(), bgra.data(), uint64_t(size.x) * size.y, raw.data());
+		double rawMB = points * 9 / (1024.0 * 1024.0);
+
+		cloudEncoder encoder;
+		std::vector<uint8_t> encoded, decoded;
+		for (int step : { 1, 4 }) {
+			double encodeMs = timeMillis(3, [&]() { encoder.encode(raw.data(), points, step, encoded); });
+			double decodeMs = timeMillis(3, [&]() { decodeCloud(encoded.data(), encoded.size(), decoded); });
+
+			int maxError = 0;
+			bool colorsIdentical = decoded.size() == points * 9;
+			for (uint64_t i = 0; colorsIdentical && i < points; i++) {
+				for (int c = 0; c < 3; c++) {
+					int16_t a, b;
+					memcpy(&a, raw.data() + i * 9 + c * 2, sizeof(a));
+					memcpy(&b, decoded.data() + i * 9 + c * 2, sizeof(b));
+					maxError = std::max(maxError, std::abs(int(a) - int(b)));
+				}
+				colorsIdentical = memcmp(raw.data() + i * 9 + 6, decoded.data() + i * 9 + 6, 3) == 0;
+			}
+
+			std::cout << "codec " << size.x << "x" << size.y << ", step " << step << " mm: "
+				<< (points * 9.0 / encoded.size()) << "x smaller"
+				<< ", encode " << rawMB / (encodeMs / 1000.0) << " MB/s, decode " << rawMB / (decodeMs / 1000.0) << " MB/s"
+				<< ", max error " << maxError << " mm, colors " << (colorsIdentical ? "identical" : "DIFFER") << "\n";
+		}
+	}
+
+	// octree archive format against the 9 byte points, points come back in octree order so they are compared as sorted sets
+	void benchmarkOctree(glm::uvec2 size) {
+		int threads = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticScene(size, xyz, bgra);
+		std::vector<uint8_t> raw(uint64_t(size.x) * size.y * 9);
+		uint64_t points = compactPoints(xyz.data(), bgra.data(), uint64_t(size.x) * size.y, raw.data());
+		raw.resize(points * 9);
+		double rawMB = points * 9 / (1024.0 * 1024.0);
+
+		auto sortedRecords = [](std::vector<uint8_t> const& data) {
+			std::vector<std::string> records(data.size() / 9);
+			for (size_t i = 0; i < records.size(); i++) records[i].assign((char const*)data.data() + i * 9, 9);
+			std::sort(records.begin(), records.end());
+			return records;
+		};
+		std::vector<std::string> expected = sortedRecords(raw);
+
+		octreeEncoder encoder;
+		std::vector<uint8_t> encoded, decoded;
+		for (int leaf : { 1, 4 }) {
+			double serialMs = timeMillis(3, [&]() { encoder.encode(raw.data(), points, leaf, 1, encoded); });
+			double encodeMs = timeMillis(3, [&]() { encoder.encode(raw.data(), points, leaf, threads, encoded); });
+			double decodeMs = timeMillis(3, [&]() { decodeOctree(encoded.data(), encoded.size(), decoded, threads); });
+
+			std::cout << "octree " << size.x << "x" << size.y << ", leaf " << leaf << " mm: "
+				<< (points * 9.0 / encoded.size()) << "x smaller"
+				<< ", encode " << rawMB / (serialMs / 1000.0) << " MB/s (1 thread) " << rawMB / (encodeMs / 1000.0) << " MB/s (" << threads << " threads)"
+				<< ", decode " << rawMB / (decodeMs / 1000.0) << " MB/s";
+			if (leaf == 1) std::cout << ", points " << (sortedRecords(decoded) == expected ? "identical" : "DIFFER");
+			std::cout << "\n";
+		}
+	}
+
+	// voxel grid downsampling of a full frame, the frame rate has to keep up with the camera
+	void benchmarkVoxelGrid(glm::uvec2 size) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticScene(size, xyz, bgra);
+		std::vector<uint8_t> out(uint64_t(size.x) * size.y * 9);
+		uint64_t points = compactPoints(xyz.data(), bgra.data(), uint64_t(size.x) * size.y, out.data());
+
+		int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		voxelGrid grid;
+		for (int voxel : { 2, 5, 10 }) {
+			for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+				rawSink raw(out.data());
+				voxelSink<rawSink> sink(grid, voxel, voxelMode::centroid, threads, raw);
+				double ms = timeMillis(5, [&]() { emitPoints(size, xyz.data(), bgra.data(), threads, sink); });
+				std::cout << "voxel grid " << size.x << "x" << size.y << ", " << voxel << " mm, " << threads << " threads: "
+					<< ms << " ms (" << 1000.0 / ms << " fps), " << points << " -> " << raw.points() << " points\n";
+				if (threads == maxThreads) break;
+			}
+		}
+	}
+
+	// statistical outlier removal on the synthetic scene with 1% of the points pushed off their surface
+	// reports throughput and how many of the displaced points were removed
+	void benchmarkOutliers(glm::uvec2 size) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticScene(size, xyz, bgra);
+
+		// displaced points are marked with a color the scene never uses
+		const uint8_t mark[3] = { 1, 2, 3 };
+		std::mt19937 rng(99);
+		std::uniform_int_distribution<int> pick(0, 99), offset(100, 400);
+		uint64_t points = 0, speckles = 0;
+		for (uint64_t i = 0; i < uint64_t(size.x) * size.y; i++) {
+			if (xyz[i * 3 + 2] == 0) continue;
+			points++;
+			if (pick(rng) != 0) continue;
+			xyz[i * 3 + 2] = int16_t(xyz[i * 3 + 2] + (pick(rng) < 50 ? -1 : 1) * offset(rng));
+			memcpy(bgra.data() + i * 4, mark, 3);
+			speckles++;
+		}
+
+		int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<uint8_t> out(uint64_t(size.x) * size.y * 9);
+		frameArena arena;
+		for (int radius : { 1, 2 }) {
+			for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+				rawSink raw(out.data());
+				outlierSink<rawSink> sink(radius, 1.f, threads, raw, &arena);
+				double ms = timeMillis(5, [&]() { emitPoints(size, xyz.data(), bgra.data(), threads, sink); });
+				uint64_t speckleKept = 0;
+				for (uint64_t i = 0; i < raw.points(); i++) {
+					if (memcmp(out.data() + i * 9 + 6, mark, 3) == 0) speckleKept++;
+				}
+				std::cout << "outliers " << size.x << "x" << size.y << ", radius " << radius << ", " << threads << " threads: "
+					<< ms << " ms (" << points / (ms * 1000.0) << " M points/s), removed " << sink.removed() << " of " << points
+					<< ", " << (speckles - speckleKept) << " of " << speckles << " displaced\n";
+				if (threads == maxThreads) break;
+			}
+		}
+	}
+
+	// grid normals of the synthetic scene, vectorized against the scalar reference, and the whole stage on rawSink
+	// reports the largest angle between an oct16 normal and its float3 normal
+	void benchmarkNormals(glm::uvec2 size) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticScene(size, xyz, bgra);
+		uint64_t pixels = uint64_t(size.x) * size.y;
+
+		std::vector<uint8_t> oct(pixels * 2), floats(pixels * 12);
+		for (normalFormat format : { normalFormat::oct16, normalFormat::float3 }) {
+			uint32_t stride = normalSize(format);
+			std::vector<uint8_t> scalar(pixels * stride), simd(pixels * stride);
+			auto rows = [&](bool vectorized, uint8_t* out) {
+				for (uint32_t y = 0; y < size.y; y++) {
+					int16_t const* below = y + 1 < size.y ? xyz.data() + uint64_t(y + 1) * size.x * 3 : nullptr;
+					if (vectorized) gridNormalRow(xyz.data() + uint64_t(y) * size.x * 3, below, size.x, format, out + uint64_t(y) * size.x * stride);
+					else gridNormalRowScalar(xyz.data() + uint64_t(y) * size.x * 3, below, size.x, format, out + uint64_t(y) * size.x * stride);
+				}
+			};
+			double scalarMs = timeMillis(5, [&]() { rows(false, scalar.data()); });
+			double simdMs = timeMillis(5, [&]() { rows(true, simd.data()); });
+			bool identical = scalar == simd;
+			std::cout << "normals " << size.x << "x" << size.y << " " << normalFormatToString(format) << ": scalar " << scalarMs << " ms, sse "
+				<< simdMs << " ms, " << (identical ? "identical" : "DIFFERS") << "\n";
+			memcpy(format == normalFormat::oct16 ? oct.data() : floats.data(), simd.data(), simd.size());
+		}
+
+		float worst = 0.f;
+		for (uint64_t i = 0; i < pixels; i++) {
+			float n[3], exact[3];
+			memcpy(exact, floats.data() + i * 12, sizeof(exact));
+			if (!decodeOct16(oct.data() + i * 2, n)) continue;
+			float cosine = std::min(1.f, n[0] * exact[0] + n[1] * exact[1] + n[2] * exact[2]);
+			worst = std::max(worst, std::acos(cosine) * 57.2958f);
+		}
+		std::cout << "normals oct16 error: at most " << worst << " degrees\n";
+
+		int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<uint8_t> out(pixels * 9), outNormals(pixels * 2);
+		frameArena arena;
+		for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+			rawSink raw(out.data(), outNormals.data(), normalFormat::oct16);
+			normalSink<rawSink> sink(normalFormat::oct16, raw, &arena);
+			double ms = timeMillis(5, [&]() { emitPoints(size, xyz.data(), bgra.data(), threads, sink); });
+			std::cout << "normal stage " << size.x << "x" << size.y << ", oct16, " << threads << " threads: " << ms << " ms ("
+				<< raw.points() / (ms * 1000.0) << " M points/s)\n";
+			if (threads == maxThreads) break;
+		}
+	}
+
+	// mesh of the synthetic scene, the file has to be the same for every thread count
+	void benchmarkMesh(glm::uvec2 size) {
+		std::vector<int16_t> xyz;
+		std::vector<uint8_t> bgra;
+		syntheticScene(size, xyz, bgra);
+
+		const std::string meshLoc = "kinectCloud_benchmark_mesh.ply";
+		int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		frameArena arena;
+		std::vector<uint8_t> reference;
+		for (int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+			meshSink sink(meshLoc, 0.05f, &arena);
+			double ms = timeMillis(3, [&]() { emitPoints(size, xyz.data(), bgra.data(), threads, sink); });
+			std::vector<uint8_t> file = readEntireFileBinary(meshLoc);
+			if (reference.empty()) reference = file;
+			std::cout << "mesh " << size.x << "x" << size.y << ", " << threads << " threads: " << ms << " ms, " << sink.vertices() << " vertices, "
+				<< sink.faces() << " faces, " << (file.size() / (1024.0 * 1024.0)) << " MB, " << (file == reference ? "identical" : "DIFFERS") << "\n";
+			if (threads == maxThreads) break;
+		}
+		remove(meshLoc.c_str());
+	}
+
+	// flying pixel removal on the native depth resolutions, vectorized against the scalar reference
+	void benchmarkFlyingPixels() {
+		int threads = std::max(1u, std::thread::hardware_concurrency());
+		for (glm::uvec2 size : { glm::uvec2(320, 288), glm::uvec2(640, 576), glm::uvec2(1024, 1024) }) {
+			std::vector<uint16_t> depth = syntheticDepth(size);
+			uint64_t count = uint64_t(size.x) * size.y;
+			std::vector<uint16_t> scalar(count), vectorized(count);
+			const float jump = 0.05f;
+			uint32_t ratio = uint32_t(jump * 65536.f);
+
+			double scalarMs = timeMillis(10, [&]() {
+				for (uint32_t y = 0; y < size.y; y++) {
+					for (uint32_t x = 0; x < size.x; x++) {
+						scalar[uint64_t(y) * size.x + x] = flyingPixelDepth(depth.data(), size, x, y, ratio);
+					}
+				}
+			});
+			double vectorMs = timeMillis(10, [&]() { removeFlyingPixels(depth.data(), vectorized.data(), size, jump, 1); });
+			double threadedMs = timeMillis(10, [&]() { removeFlyingPixels(depth.data(), vectorized.data(), size, jump, threads); });
+
+			uint64_t removed = 0;
+			for (uint64_t i = 0; i < count; i++) {
+				if (depth[i] != 0 && vectorized[i] == 0) removed++;
+			}
+			std::cout << "flying pixels " << size.x << "x" << size.y << ": scalar " << scalarMs << " ms, sse " << vectorMs << " ms, "
+				<< threads << " threads " << threadedMs << " ms, removed " << removed << ", "
+				<< (scalar == vectorized ? "identical" : "DIFFERENT") << "\n";
+		}
+	}
+
+	// smooth a static synthetic scene with about 0.3% depth noise per frame
+	// jitter is the mean absolute depth change of a pixel between consecutive output frames, after the history filled up
+	void benchmarkTemporal() {
+		glm::uvec2 size(640, 576);
+		uint64_t count = uint64_t(size.x) * size.y;
+		std::vector<uint16_t> scene = syntheticDepth(size);
+		const int frameCount = 30;
+		std::mt19937 rng(1234);
+		std::vector<std::vector<uint16_t>> frames(frameCount, std::vector<uint16_t>(count));
+		for (auto& frame : frames) {
+			for (uint64_t i = 0; i < count; i++) {
+				std::normal_distribution<float> noise(0.f, scene[i] * 0.003f);
+				frame[i] = scene[i] ? uint16_t(std::max(1.f, scene[i] + noise(rng))) : 0;
+			}
+		}
+
+		cloudOptions opts;
+		opts.threads = 1;
+		for (temporalMode mode : { temporalMode::off, temporalMode::ema, temporalMode::median }) {
+			opts.temporal = mode;
+			temporalFilter filter;
+			std::vector<uint16_t> out(count), previous(count);
+			double jitter = 0.0, ms = 0.0;
+			uint64_t samples = 0;
+			for (int f = 0; f < frameCount; f++) {
+				ms += timeMillis(1, [&]() { filter.apply(frames[f].data(), out.data(), size, opts); });
+				if (f >= 10) {
+					for (uint64_t i = 0; i < count; i++) {
+						if (out[i] && previous[i]) {
+							jitter += std::abs(int(out[i]) - int(previous[i]));
+							samples++;
+						}
+					}
+				}
+				std::swap(out, previous);
+			}
+			std::cout << "temporal " << temporalModeToString(mode) << " " << size.x << "x" << size.y << ": " << ms / frameCount
+				<< " ms per frame, jitter " << jitter / std::max<uint64_t>(1, samples) << " mm\n";
+		}
+	}
+
+	// compare the fused reprojection kernel against the sdk depth to color transform, point cloud transform and compaction
+	// coverage counts color pixels which received depth, agreement is the share of pixels covered by both within 1%
+	void benchmarkReprojection(std::string const& calibrationPath, k4a_depth_mode_t depthMode, k4a_color_resolution_t colorRes) {
+		k4a_calibration_t cali = loadCalibration(calibrationPath, depthMode, colorRes);
+		k4a_transformation_t transform = k4a_transformation_create(&cali);
+		cloudPipeline pipeline;
+		double buildMs = timeMillis(1, [&]() { pipeline = cloudPipeline(cali); });
+		depthReprojector& reprojector = pipeline.reprojector();
+		cloudOptions opts;
+
+		glm::uvec2 depthSize = reprojector.depthRays().size, colorSize = reprojector.colorRays().size;
+		uint64_t colorCount = uint64_t(colorSize.x) * colorSize.y;
+		std::vector<uint16_t> depth = syntheticDepth(depthSize);
+		std::vector<int16_t> unused;
+		std::vector<uint8_t> bgra;
+		syntheticFrame(colorSize, unused, bgra);
+		std::vector<uint16_t> sdkDepth(colorCount), fusedDepth(colorCount);
+		std::vector<uint8_t> sdkOut(colorCount * 9), fusedOut(colorCount * 9);
+		k4a_image_t depthImg = wrapImage(K4A_IMAGE_FORMAT_DEPTH16, depthSize, sizeof(uint16_t), depth.data());
+		k4a_image_t colorImg = wrapImage(K4A_IMAGE_FORMAT_COLOR_BGRA32, colorSize, sizeof(uint8_t) * 4, bgra.data());
+		k4a_image_t sdkDepthImg = wrapImage(K4A_IMAGE_FORMAT_DEPTH16, colorSize, sizeof(uint16_t), sdkDepth.data());
+
+		uint64_t sdkPoints = 0, fusedPoints = 0;
+		double sdkMs = timeMillis(5, [&]() {
+			k4a_image_t xyzImg = nullptr;
+			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_color_camera(transform, depthImg, sdkDepthImg) ||
+				K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM, colorSize.x, colorSize.y, colorSize.x * sizeof(int16_t) * 3, &xyzImg) ||
+				K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_point_cloud(transform, sdkDepthImg, K4A_CALIBRATION_TYPE_COLOR, xyzImg)) {
+				throw std::runtime_error("failed to transform depth to point cloud");
+			}
+			sdkPoints = compactPoints((int16_t*)k4a_image_get_buffer(xyzImg), bgra.data(), colorCount, sdkOut.data());
+			k4a_image_release(xyzImg);
+		});
+		double fusedMs = timeMillis(5, [&]() {
+			rawSink sink(fusedOut.data());
+			pipeline.run(depthImg, colorImg, opts, sink);
+			fusedPoints = sink.points();
+		});
+		reprojector.depthToColor(depth.data(), fusedDepth.data(), opts.threads);
+
+		uint64_t sdkCovered = 0, fusedCovered = 0, bothCovered = 0, agreeing = 0;
+		for (uint64_t i = 0; i < colorCount; i++) {
+			sdkCovered += sdkDepth[i] != 0;
+			fusedCovered += fusedDepth[i] != 0;
+			if (sdkDepth[i] && fusedDepth[i]) {
+				bothCovered++;
+				agreeing += std::abs(int(sdkDepth[i]) - int(fusedDepth[i])) * 100 <= int(sdkDepth[i]);
+			}
+		}
+
+		std::cout << "reprojection " << colorSize.x << "x" << colorSize.y << ": build " << buildMs << " ms"
+			<< (reprojector.usesSdkProjection() ? " (sdk projection)" : "")
+			<< ", sdk " << sdkMs << " ms / " << sdkPoints << " points"
+			<< ", fused " << fusedMs << " ms / " << fusedPoints << " points"
+			<< ", coverage " << sdkCovered << " / " << fusedCovered
+			<< ", agreement " << (bothCovered ? 100.0 * agreeing / bothCovered : 0.0) << "%\n";
+
+		k4a_image_release(depthImg);
+		k4a_image_release(colorImg);
+		k4a_image_release(sdkDepthImg);
+		k4a_transformation_destroy(transform);
+	}
+
+	// color space clouds of narrowing crop boxes between 1.5 and 2.5 m against the uncropped cloud, checks that the crop keeps exactly the points
+	// of the uncropped cloud inside the box
+	void benchmarkCrop(std::string const& calibrationPath, k4a_depth_mode_t depthMode, k4a_color_resolution_t colorRes) {
+		k4a_calibration_t cali = loadCalibration(calibrationPath, depthMode, colorRes);
+		cloudPipeline pipeline(cali);
+		glm::uvec2 depthSize = pipeline.gridSize(cloudSpace::depth), colorSize = pipeline.gridSize(cloudSpace::color);
+		std::vector<uint16_t> depth = syntheticDepth(depthSize);
+		std::vector<int16_t> unused;
+		std::vector<uint8_t> bgra;
+		syntheticFrame(colorSize, unused, bgra);
+		k4a_image_t depthImg = wrapImage(K4A_IMAGE_FORMAT_DEPTH16, depthSize, sizeof(uint16_t), depth.data());
+		k4a_image_t colorImg = wrapImage(K4A_IMAGE_FORMAT_COLOR_BGRA32, colorSize, sizeof(uint8_t) * 4, bgra.data());
+		std::vector<uint8_t> full(uint64_t(colorSize.x) * colorSize.y * 9), cropped(full.size());
+
+		cloudOptions opts;
+		uint64_t fullPoints = 0;
+		double fullMs = timeMillis(5, [&]() {
+			rawSink sink(full.data());
+			pipeline.run(depthImg, colorImg, opts, sink);
+			fullPoints = sink.points();
+		});
+		std::cout << "crop " << colorSize.x << "x" << colorSize.y << ": uncropped " << fullMs << " ms / " << fullPoints << " points\n";
+
+		for (int half : { 2000, 1000, 500, 250 }) {
+			opts.crop.min = glm::ivec3(-half, -half, 1500);
+			opts.crop.max = glm::ivec3(half, half, 2500);
+			uint64_t croppedPoints = 0;
+			double ms = timeMillis(5, [&]() {
+				rawSink sink(cropped.data());
+				pipeline.run(depthImg, colorImg, opts, sink);
+				croppedPoints = sink.points();
+			});
+
+			std::vector<uint8_t> expected;
+			for (uint64_t i = 0; i < fullPoints; i++) {
+				int16_t p[3];
+				memcpy(p, full.data() + i * 9, sizeof(p));
+				cropPoints(p, 1, opts.crop);
+				if (p[0] || p[1] || p[2]) expected.insert(expected.end(), full.data() + i * 9, full.data() + i * 9 + 9);
+			}
+			bool identical = expected.size() == croppedPoints * 9 && memcmp(expected.data(), cropped.data(), expected.size()) == 0;
+			depthRoi const& roi = pipeline.cropRoi(opts);
+			std::cout << "crop box " << half * 2 << " mm wide: roi " << roi.rect.width() << "x" << roi.rect.height()
+				<< ", depth " << roi.minDepth << "-" << roi.maxDepth << " mm, " << ms << " ms / " << croppedPoints << " points, "
+				<< (identical ? "identical" : "DIFFERS") << "\n";
+		}
+
+		k4a_image_release(depthImg);
+		k4a_image_release(colorImg);
+	}
+
+	// run all synthetic benchmarks, no device required
+	// benchmarks which need a calibration are skipped if calibrationPath is empty
+	void runBenchmarks(std::string const& calibrationPath, k4a_depth_mode_t depthMode, k4a_color_resolution_t colorRes) {
+		if (!calibrationPath.empty()) {
+			benchmarkRayTable(calibrationPath, depthMode, colorRes);
+			benchmarkReprojection(calibrationPath, depthMode, colorRes);
+			benchmarkCrop(calibrationPath, depthMode, colorRes);
+		}
+		benchmarkFormatting();
+		benchmarkFlyingPixels();
+		benchmarkTemporal();
+		for (auto const& size : benchmarkSizes) {
+			benchmarkCompaction(size);
+		}
+		for (auto const& size : benchmarkSizes) {
+			benchmarkPtsWriter(size);
+		}
+		for (auto const& size : benchmarkSizes) {
+			benchmarkPlyWriter(size);
+		}
+		benchmarkFileOutput(benchmarkSizes[0], 32);
+		benchmarkFramePublication(benchmarkSizes[0]);
+		benchmarkLatestFrame(benchmarkSizes[0]);
+		benchmarkStreamTransports(benchmarkSizes[0]);
+		for (auto const& size : benchmarkSizes) {
+			benchmarkVoxelGrid(size);
+		}
+		for (auto const& size : benchmarkSizes) {
+			benchmarkOutliers(size);
+		}
+		for (auto const& size : benchmarkSizes) {
+			benchmarkNormals(size);
+		}
+		for (auto const& size : benchmarkSizes) {
+			benchmarkMesh(size);
+		}
+		for (auto const& size : benchmarkSizes) {
+			benchmarkCodec(size);
+			benchmarkOctree(size);
+		}
+	}
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <limits>
+
+#include "util.h"
+
+namespace kinectCloud {
+	// compressed form of the 9 byte point blob (see rawSink), served by azureKinectServer and reversed by decodeCloud
+	// points keep their scanline order, so consecutive points are image neighbours and their deltas are small
+	//[char[4] "KCZ1"][uint64 numPoints][uint16 quantization step in mm]
+	//[6 rans streams, x y z residuals then b g r residuals, each [uint16 freq[256]][uint32 numBytes][bytes]]
+	//[uint32 numEscapes][int16 quantized coordinate] * numEscapes
+	// a coordinate is quantized to round(v / step) and coded as the zigzag difference to the previous point's,
+	// differences of 255 and above are sent as symbol 255 plus the quantized coordinate itself in the escape list
+	// a color channel is coded as the byte difference to the previous point's
+	// all values are little endian, samples/RealtimePointStream/Assets/PointCloudCodec.cs is a c# decoder
+
+	// rans coder parameters, frequencies of a stream sum up to 1 << ransProbBits
+	constexpr uint32_t ransProbBits = 12;
+	constexpr uint32_t ransLowerBound = 1u << 23;
+
+	// scale symbol counts to frequencies summing to 1 << ransProbBits, every symbol that occurs keeps at least 1
+	void normalizeFrequencies(uint64_t const* counts, uint16_t* freq) {
+		uint64_t total = 0;
+		for (int s = 0; s < 256; s++) total += counts[s];
+		if (total == 0) {
+			std::fill(freq, freq + 256, uint16_t(0));
+			return;
+		}
+
+		const int32_t scale = 1 << ransProbBits;
+		int32_t sum = 0;
+		for (int s = 0; s < 256; s++) {
+			freq[s] = counts[s] ? uint16_t(std::max<uint64_t>(1, counts[s] * scale / total)) : 0;
+			sum += freq[s];
+		}
+		// rounding leaves the sum off by a little, the most frequent symbols absorb it
+		while (sum != scale) {
+			int largest = int(std::max_element(freq, freq + 256) - freq);
+			if (sum > scale) {
+				if (freq[largest] <= 1) break;
+				freq[largest]--;
+				sum--;
+			} else {
+				freq[largest]++;
+				sum++;
+			}
+		}
+	}
+
+	// append a rans coded stream of symbols to out
+	// scratch is reused between calls to avoid reallocating the backwards written bytes
+	void ransEncode(uint8_t const* symbols, uint64_t count, std::vector<uint8_t>& scratch, std::vector<uint8_t>& out) {
+		uint64_t counts[256] = {};
+		for (uint64_t i = 0; i < count; i++) counts[symbols[i]]++;
+		uint16_t freq[256], start[256];
+		normalizeFrequencies(counts, freq);
+		for (int s = 0, cumulative = 0; s < 256; s++) {
+			start[s] = uint16_t(cumulative);
+			cumulative += freq[s];
+		}
+
+		// a symbol renormalizes out at most 2 bytes, plus the final state
+		scratch.resize(count * 2 + 8);
+		uint8_t* end = scratch.data() + scratch.size();
+		uint8_t* ptr = end;
+
+		// rans is last in first out, encode backwards so the decoder reads forwards
+		uint32_t x = ransLowerBound;
+		for (uint64_t i = count; i > 0; i--) {
+			uint8_t s = symbols[i - 1];
+			uint32_t f = freq[s];
+			uint32_t xMax = ((ransLowerBound >> ransProbBits) << 8) * f;
+			while (x >= xMax) {
+				*--ptr = uint8_t(x);
+				x >>= 8;
+			}
+			x = ((x / f) << ransProbBits) + (x % f) + start[s];
+		}
+		ptr -= 4;
+		memcpy(ptr, &x, 4);
+
+		uint32_t bytes = uint32_t(end - ptr);
+		size_t offset = out.size();
+		out.resize(offset + sizeof(freq) + sizeof(bytes) + bytes);
+		memcpy(out.data() + offset, freq, sizeof(freq));
+		memcpy(out.data() + offset + sizeof(freq), &bytes, sizeof(bytes));
+		memcpy(out.data() + offset + sizeof(freq) + sizeof(bytes), ptr, bytes);
+	}
+
+	// read a stream written by ransEncode at in, decoding count symbols into symbols
+	// advances in past the stream, throws if the stream is malformed or runs past end
+	void ransDecode(uint8_t const*& in, uint8_t const* end, uint64_t count, uint8_t* symbols) {
+		uint16_t freq[256];
+		uint32_t bytes = 0;
+		if (size_t(end - in) < sizeof(freq) + sizeof(bytes)) throw std::runtime_error("truncated point cloud stream");
+		memcpy(freq, in, sizeof(freq));
+		memcpy(&bytes, in + sizeof(freq), sizeof(bytes));
+		in += sizeof(freq) + sizeof(bytes);
+		if (size_t(end - in) < bytes || bytes < 4) throw std::runtime_error("truncated point cloud stream");
+		uint8_t const* ptr = in;
+		uint8_t const* streamEnd = in + bytes;
+		in = streamEnd;
+
+		// symbol and start of every slot of the probability range
+		uint8_t slotSymbol[1 << ransProbBits];
+		uint16_t start[256];
+		uint32_t cumulative = 0;
+		for (int s = 0; s < 256; s++) {
+			start[s] = uint16_t(cumulative);
+			if (cumulative + freq[s] > (1u << ransProbBits)) throw std::runtime_error("bad point cloud frequencies");
+			memset(slotSymbol + cumulative, s, freq[s]);
+			cumulative += freq[s];
+		}
+		if (count && cumulative != (1u << ransProbBits)) throw std::runtime_error("bad point cloud frequencies");
+
+		const uint32_t mask = (1u << ransProbBits) - 1;
+		uint32_t x;
+		memcpy(&x, ptr, 4);
+		ptr += 4;
+		for (uint64_t i = 0; i < count; i++) {
+			uint8_t s = slotSymbol[x & mask];
+			symbols[i] = s;
+			x = freq[s] * (x >> ransProbBits) + (x & mask) - start[s];
+			while (x < ransLowerBound) {
+				if (ptr == streamEnd) throw std::runtime_error("truncated point cloud stream");
+				x = (x << 8) | *ptr++;
+			}
+		}
+	}
+
+	// round v to the nearest multiple of step, in units of step
+	inline int32_t quantizeCoordinate(int16_t v, int32_t step) {
+		return v >= 0 ? (v + step / 2) / step : -((-v + step / 2) / step);
+	}
+
+	// encodes point blobs, keeps its buffers between frames. not thread safe
+	class cloudEncoder {
+		std::vector<uint8_t> _symbols[6];
+		std::vector<int16_t> _escapes;
+		std::vector<uint8_t> _scratch;
+	public:
+		// encode count points in rawSink layout into out (replacing its contents)
+		// step = quantization in mm, 1 is lossless
+		inline void encode(uint8_t const* points, uint64_t count, int step, std::vector<uint8_t>& out) {
+			step = std::max(1, std::min(step, int(std::numeric_limits<uint16_t>::max())));
+			for (auto& symbols : _symbols) symbols.resize(count);
+			_escapes.clear();
+
+			int32_t previous[3] = { 0, 0, 0 };
+			uint8_t previousColor[3] = { 0, 0, 0 };
+			for (uint64_t i = 0; i < count; i++) {
+				uint8_t const* point = points + i * 9;
+				for (int c = 0; c < 3; c++) {
+					int16_t v;
+					memcpy(&v, point + c * 2, sizeof(v));
+					int32_t q = quantizeCoordinate(v, step);
+					int32_t residual = q - previous[c];
+					uint32_t zigzag = (uint32_t(residual) << 1) ^ uint32_t(residual >> 31);
+					if (zigzag < 255) {
+						_symbols[c][i] = uint8_t(zigzag);
+					} else {
+						_symbols[c][i] = 255;
+						_escapes.push_back(int16_t(q));
+					}
+					previous[c] = q;
+				}
+				for (int c = 0; c < 3; c++) {
+					_symbols[3 + c][i] = uint8_t(point[6 + c] - previousColor[c]);
+					previousColor[c] = point[6 + c];
+				}
+			}
+
+			uint16_t step16 = uint16_t(step);
+			out.resize(4 + sizeof(count) + sizeof(step16));
+			memcpy(out.data(), "KCZ1", 4);
+			memcpy(out.data() + 4, &count, sizeof(count));
+			memcpy(out.data() + 4 + sizeof(count), &step16, sizeof(step16));
+			for (auto const& symbols : _symbols) {
+				ransEncode(symbols.data(), count, _scratch, out);
+			}
+			uint32_t escapes = uint32_t(_escapes.size());
+			size_t offset = out.size();
+			out.resize(offset + sizeof(escapes) + escapes * sizeof(int16_t));
+			memcpy(out.data() + offset, &escapes, sizeof(escapes));
+			memcpy(out.data() + offset + sizeof(escapes), _escapes.data(), escapes * sizeof(int16_t));
+		}
+	};
+
+	// decode a blob written by cloudEncoder into points (rawSink layout), returns the number of points
+	// throws if data is not a valid blob
+	uint64_t decodeCloud(uint8_t const* data, size_t size, std::vector<uint8_t>& points) {
+		uint64_t count = 0;
+		uint16_t step = 0;
+		const size_t headerSize = 4 + sizeof(count) + sizeof(step);
+		if (size < headerSize || memcmp(data, "KCZ1", 4) != 0) throw std::runtime_error("not a compressed point cloud");
+		memcpy(&count, data + 4, sizeof(count));
+		memcpy(&step, data + 4 + sizeof(count), sizeof(step));
+		// far more points than any camera produces means the header is corrupt
+		if (step == 0 || count > (uint64_t(1) << 28)) throw std::runtime_error("bad compressed point cloud header");
+
+		uint8_t const* in = data + headerSize;
+		uint8_t const* end = data + size;
+		std::vector<uint8_t> symbols[6];
+		for (auto& stream : symbols) {
+			stream.resize(count);
+			ransDecode(in, end, count, stream.data());
+		}
+
+		uint32_t escapeCount = 0;
+		if (size_t(end - in) < sizeof(escapeCount)) throw std::runtime_error("truncated point cloud escapes");
+		memcpy(&escapeCount, in, sizeof(escapeCount));
+		in += sizeof(escapeCount);
+		if (size_t(end - in) / sizeof(int16_t) < escapeCount) throw std::runtime_error("truncated point cloud escapes");
+		int16_t const* escapes = (int16_t const*)in;
+		uint32_t nextEscape = 0;
+
+		points.resize(count * 9);
+		int32_t previous[3] = { 0, 0, 0 };
+		uint8_t previousColor[3] = { 0, 0, 0 };
+		for (uint64_t i = 0; i < count; i++) {
+			uint8_t* point = points.data() + i * 9;
+			for (int c = 0; c < 3; c++) {
+				uint8_t s = symbols[c][i];
+				if (s == 255) {
+					if (nextEscape == escapeCount) throw std::runtime_error("missing point cloud escape");
+					int16_t q;
+					memcpy(&q, escapes + nextEscape++, sizeof(q));
+					previous[c] = q;
+				} else {
+					previous[c] += int32_t(s >> 1) ^ -int32_t(s & 1);
+				}
+				int16_t v = int16_t(previous[c] * step);
+				memcpy(point + c * 2, &v, sizeof(v));
+			}
+			for (int c = 0; c < 3; c++) {
+				previousColor[c] = uint8_t(previousColor[c] + symbols[3 + c][i]);
+				point[6 + c] = previousColor[c];
+			}
+		}
+		return count;
+	}
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "pipeline.h"
+
+namespace kinectCloud {
+	// what push does when the writer queue is full
+	enum class queuePolicy {
+		block,	// wait for a writer to take a frame, nothing is lost but capture may stall
+		drop,	// discard the new frame, capture never waits
+	};
+
+	// parse queue policy from string (not case sensitive), returns false if unknown
+	bool queuePolicyFromString(std::string str, queuePolicy& policy) {
+		str = stringToUppercase(str);
+		if (str == "BLOCK") {
+			policy = queuePolicy::block;
+		} else if (str == "DROP") {
+			policy = queuePolicy::drop;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	// saves captures as point cloud files on a pool of writer threads, so capturing never waits on formatting or disk
+	// captures wait in a bounded queue. pipelines are not thread safe, so every writer has its own pipeline per source;
+	// they share the source's ray tables, and the pipelines of one writer share its frame buffers since a writer saves
+	// one frame at a time. a source is one calibration, usually one device
+	class cloudWriter {
+		struct job {
+			size_t source;
+			k4a_capture_t capture;
+			std::string path;
+		};
+
+		std::vector<depthReprojector> _tables; // one per source, only read by the writers
+		cloudOptions _opts;
+		size_t _depth;
+		queuePolicy _policy;
+		bool _largePages;
+
+		std::deque<job> _queue;
+		std::mutex _queueLock;
+		std::condition_variable _queued;	// a job was queued or the writers are stopping
+		std::condition_variable _taken;		// a writer took a job off the queue
+		bool _stopping = false;
+		std::vector<std::thread> _writers;
+
+		std::atomic<uint64_t> _written{ 0 }, _dropped{ 0 }, _failed{ 0 };
+	public:
+		// calibrations = one per source, push refers to them by index
+		// writers      = number of writer threads, each saves one frame at a time with opts
+		//                the temporal filter needs every frame of a source in order, so it runs with one writer
+		// depth        = frames which can wait in the queue
+		inline cloudWriter(std::vector<k4a_calibration_t> const& calibrations, cloudOptions const& opts, int writers, size_t depth, queuePolicy policy, bool largePages = false) :
+			_opts(opts), _depth(std::max<size_t>(1, depth)), _policy(policy), _largePages(largePages) {
+			for (auto const& cali : calibrations) {
+				_tables.emplace_back(cali);
+			}
+			if (opts.temporal != temporalMode::off) writers = 1;
+			for (int i = 0; i < std::max(1, writers); i++) {
+				_writers.emplace_back([this]() { write(); });
+			}
+		}
+
+		// queue capture to be saved at path, the queue holds its own reference to capture
+		// returns false if the frame was dropped because the queue is full
+		inline bool push(size_t source, k4a_capture_t capture, std::string const& path) {
+			if (source >= _tables.size()) throw std::runtime_error("unknown writer source");
+			std::unique_lock<std::mutex> lock(_queueLock);
+			if (_queue.size() >= _depth) {
+				if (_policy == queuePolicy::drop) {
+					_dropped++;
+					return false;
+				}
+				_taken.wait(lock, [this]() { return _queue.size() < _depth; });
+			}
+			k4a_capture_reference(capture);
+			_queue.push_back({ source, capture, path });
+			_queued.notify_one();
+			return true;
+		}
+
+		// save every queued frame, then stop the writers
+		inline void finish() {
+			{
+				std::lock_guard<std::mutex> lock(_queueLock);
+				_stopping = true;
+			}
+			_queued.notify_all();
+			for (auto& writer : _writers) {
+				writer.join();
+			}
+			_writers.clear();
+		}
+
+		// frames saved so far
+		inline uint64_t written() const {
+			return _written;
+		}
+
+		// frames discarded because the queue was full
+		inline uint64_t dropped() const {
+			return _dropped;
+		}
+
+		// frames which were missing an image or failed to save
+		inline uint64_t failed() const {
+			return _failed;
+		}
+
+		// one line summary for verbose output
+		inline std::string summary() const {
+			return std::to_string(written()) + " frames written, " + std::to_string(dropped()) + " dropped, " + std::to_string(failed()) + " failed";
+		}
+
+		// copy constructor removed
+		inline cloudWriter(cloudWriter const& other) = delete;
+
+		// copy assignment removed
+		inline cloudWriter& operator=(cloudWriter const& other) = delete;
+
+		// destructor, saves whatever is still queued
+		inline ~cloudWriter() {
+			finish();
+		}
+
+	private:
+
+		// writer thread, runs until finish was called and the queue is empty
+		inline void write() {
+			frameArena arena;
+			arena.useLargePages(_largePages);
+			std::vector<cloudPipeline> pipelines(_tables.size());
+			std::vector<bool> created(_tables.size(), false);
+
+			while (true) {
+				job next;
+				{
+					std::unique_lock<std::mutex> lock(_queueLock);
+					_queued.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+					if (_queue.empty()) return;
+					next = std::move(_queue.front());
+					_queue.pop_front();
+				}
+				_taken.notify_one();
+
+				try {
+					// the transformation is created on first use, not for every writer up front
+					if (!created[next.source]) {
+						pipelines[next.source] = cloudPipeline(_tables[next.source], &arena);
+						created[next.source] = true;
+					}
+					if (pipelines[next.source].save(next.capture, next.path, _opts)) {
+						_written++;
+					} else {
+						_failed++;
+					}
+				} catch (std::exception const& er) {
+					// bad_alloc or system_error as well, one escaping the thread would terminate with frames still queued
+					_failed++;
+					std::cout << "failed to save " << next.path << ": " << er.what() << "\n";
+				}
+				k4a_capture_release(next.capture);
+			}
+		}
+	};
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "kinectUtil.h"
+#include "reprojection.h"
+
+namespace kinectCloud {
+	// conservative depth roi of a crop, every depth pixel outside it is known to produce no point inside the crop
+	// space is the cloud space the crop is given in, depthRays the ray table of the depth camera
+	// a depth pixel at depth d lies at d * (rayX, rayY, 1), so its rays are clipped against the box and the range
+	// in depth camera coordinates. in color space the box is moved into depth camera coordinates as the bounds of
+	// its corners, and grown by the depth step of a reprojected quad, as a color point interpolates 4 depth pixels
+	// only needs to be done once per crop and calibration
+	depthRoi cropToDepthRoi(cloudCrop const& crop, cloudSpace space, k4a_calibration_t const& cali, rayTable const& depthRays) {
+		// 1 mm of slack for the rounding of the points to int16
+		glm::vec3 low(crop.min.x - 1.f, crop.min.y - 1.f, crop.min.z - 1.f);
+		glm::vec3 high(crop.max.x + 1.f, crop.max.y + 1.f, crop.max.z + 1.f);
+		float minRange = std::max(0.f, crop.minRange - 1.f);
+		float maxRange = crop.maxRange > 0.f ? crop.maxRange + 1.f : std::numeric_limits<float>::infinity();
+		bool colorSpace = space == cloudSpace::color;
+
+		if (colorSpace) {
+			k4a_calibration_extrinsics_t const& toDepth = cali.extrinsics[K4A_CALIBRATION_TYPE_COLOR][K4A_CALIBRATION_TYPE_DEPTH];
+			float const* r = toDepth.rotation;
+			float const* t = toDepth.translation;
+			glm::vec3 cornerLow(std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity());
+			glm::vec3 cornerHigh(-cornerLow.x, -cornerLow.y, -cornerLow.z);
+			for (int corner = 0; corner < 8; corner++) {
+				float x = (corner & 1) ? high.x : low.x, y = (corner & 2) ? high.y : low.y, z = (corner & 4) ? high.z : low.z;
+				glm::vec3 p(r[0] * x + r[1] * y + r[2] * z + t[0], r[3] * x + r[4] * y + r[5] * z + t[1], r[6] * x + r[7] * y + r[8] * z + t[2]);
+				cornerLow = glm::vec3(std::min(cornerLow.x, p.x), std::min(cornerLow.y, p.y), std::min(cornerLow.z, p.z));
+				cornerHigh = glm::vec3(std::max(cornerHigh.x, p.x), std::max(cornerHigh.y, p.y), std::max(cornerHigh.z, p.z));
+			}
+
+			// the cameras are a translation apart, which changes the range by at most its length
+			float offset = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+			minRange = std::max(0.f, minRange - offset);
+			maxRange += offset;
+
+			// a quad spans less than maxDepthStep of its depth plus a pixel, 2% covers a pixel of every depth mode
+			float grow = depthReprojector::maxDepthStep + 0.02f;
+			float reach = std::min(std::max(std::abs(cornerLow.z), std::abs(cornerHigh.z)), maxRange) * grow;
+			low = glm::vec3(cornerLow.x - reach, cornerLow.y - reach, cornerLow.z - reach);
+			high = glm::vec3(cornerHigh.x + reach, cornerHigh.y + reach, cornerHigh.z + reach);
+			minRange *= 1.f - grow;
+			maxRange *= 1.f + grow;
+		}
+
+		// depth interval of a ray along one axis, value = d * ray has to stay in [low, high]
+		auto clip = [](float ray, float low, float high, float& near, float& far) {
+			if (ray > 0.f) {
+				near = std::max(near, low / ray);
+				far = std::min(far, high / ray);
+			} else if (ray < 0.f) {
+				near = std::max(near, high / ray);
+				far = std::min(far, low / ray);
+			} else if (low > 0.f || high < 0.f) {
+				far = -1.f;
+			}
+		};
+
+		glm::uvec2 size = depthRays.size;
+		depthRoi roi;
+		roi.rect.min = size;
+		float nearest = std::numeric_limits<float>::infinity(), farthest = 0.f;
+		for (uint32_t y = 0; y < size.y; y++) {
+			for (uint32_t x = 0; x < size.x; x++) {
+				uint64_t i = uint64_t(y) * size.x + x;
+				float rayX = depthRays.x[i], rayY = depthRays.y[i];
+				if (std::isnan(rayX)) continue;
+
+				float length = std::sqrt(rayX * rayX + rayY * rayY + 1.f);
+				float near = std::max({ 1.f, low.z, minRange / length });
+				float far = std::min({ 65535.f, high.z, maxRange / length });
+				clip(rayX, low.x, high.x, near, far);
+				clip(rayY, low.y, high.y, near, far);
+				if (near > far) continue;
+
+				roi.rect.min = glm::uvec2(std::min(roi.rect.min.x, x), std::min(roi.rect.min.y, y));
+				roi.rect.max = glm::uvec2(std::max(roi.rect.max.x, x + 1), std::max(roi.rect.max.y, y + 1));
+				nearest = std::min(nearest, near);
+				farthest = std::max(farthest, far);
+			}
+		}
+
+		if (roi.rect.width() == 0 || roi.rect.height() == 0) {
+			roi.rect = pixelRect();
+			return roi;
+		}
+		// in color space a quad reaches one pixel past its corners
+		if (colorSpace) {
+			roi.rect.min = glm::uvec2(roi.rect.min.x ? roi.rect.min.x - 1 : 0, roi.rect.min.y ? roi.rect.min.y - 1 : 0);
+			roi.rect.max = glm::uvec2(std::min(size.x, roi.rect.max.x + 1), std::min(size.y, roi.rect.max.y + 1));
+		}
+		roi.minDepth = uint16_t(std::max(1.f, std::floor(nearest)));
+		roi.maxDepth = uint16_t(std::min(65535.f, std::ceil(farthest)));
+		return roi;
+	}
+
+	// zero the xyz of the count points which lie outside crop, this is the exact test the roi is conservative for
+	void cropPoints(int16_t* xyz, uint32_t count, cloudCrop const& crop) {
+		int64_t minRange = int64_t(std::ceil(crop.minRange * crop.minRange));
+		int64_t maxRange = crop.maxRange > 0.f ? int64_t(std::floor(double(crop.maxRange) * crop.maxRange)) : std::numeric_limits<int64_t>::max();
+		for (uint32_t i = 0; i < count; i++) {
+			int16_t* p = xyz + i * 3;
+			int32_t x = p[0], y = p[1], z = p[2];
+			int64_t range = int64_t(x) * x + int64_t(y) * y + int64_t(z) * z;
+			bool inside = x >= crop.min.x && x <= crop.max.x && y >= crop.min.y && y <= crop.max.y && z >= crop.min.z && z <= crop.max.z &&
+				range >= minRange && range <= maxRange;
+			if (!inside) {
+				p[0] = 0;
+				p[1] = 0;
+				p[2] = 0;
+			}
+		}
+	}
+}
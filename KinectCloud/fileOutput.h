@@ -0,0 +1,561 @@
+#pragma once
+
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "frameArena.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// io_uring is used through the raw system calls, only the kernel headers are needed
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define KINECTCLOUD_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace kinectCloud {
+	// open path for writing, truncates existing files, returns -1 on failure
+	int openForWrite(std::string const& path) {
+#ifdef _WIN32
+		return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+	}
+
+	// write all of data at offset without moving the file position, safe to call from several threads
+	bool writeAt(int fd, void const* data, size_t size, uint64_t offset) {
+		uint8_t const* bytes = (uint8_t const*)data;
+		while (size) {
+#ifdef _WIN32
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = DWORD(offset);
+			overlapped.OffsetHigh = DWORD(offset >> 32);
+			DWORD written = 0;
+			if (!WriteFile((HANDLE)_get_osfhandle(fd), bytes, DWORD(std::min<size_t>(size, 1 << 30)), &written, &overlapped)) return false;
+#else
+			ssize_t written = pwrite(fd, bytes, size, off_t(offset));
+			if (written < 0 && errno == EINTR) continue;
+			if (written <= 0) return false;
+#endif
+			bytes += written;
+			size -= written;
+			offset += written;
+		}
+		return true;
+	}
+
+	// returns false if closing reported an error
+	bool closeFile(int fd) {
+#ifdef _WIN32
+		return _close(fd) == 0;
+#else
+		return ::close(fd) == 0;
+#endif
+	}
+
+	// where finished point cloud files go
+	// sinks open a file, write byte ranges of it at any offset and close it, writes may complete later
+	// every method is thread safe
+	class fileOutput {
+	public:
+		virtual ~fileOutput() = default;
+
+		// open path for writing, returns a handle for write and close
+		virtual int open(std::string const& path) = 0;
+
+		// write size bytes at offset of file, data can be reused as soon as this returns
+		virtual void write(int file, uint64_t offset, void const* data, size_t size) = 0;
+
+		// close file once every write to it has completed
+		virtual void close(int file) = 0;
+
+		// wait until every file is written and closed, throws if any write since the last flush failed
+		virtual void flush() = 0;
+
+		// backend name for verbose and benchmark output
+		virtual std::string name() const = 0;
+	};
+
+	// synchronous stdio, every call completes before it returns
+	class stdioOutput : public fileOutput {
+		std::mutex _lock;
+		std::vector<FILE*> _files;
+		std::vector<std::string> _failed;
+	public:
+		inline int open(std::string const& path) override {
+			FILE* file = fopen(path.c_str(), "wb");
+			if (!file) throw std::runtime_error("failed to open " + path);
+			std::lock_guard<std::mutex> lock(_lock);
+			for (size_t i = 0; i < _files.size(); i++) {
+				if (!_files[i]) {
+					_files[i] = file;
+					return int(i);
+				}
+			}
+			_files.push_back(file);
+			return int(_files.size() - 1);
+		}
+
+		inline void write(int file, uint64_t offset, void const* data, size_t size) override {
+			std::lock_guard<std::mutex> lock(_lock);
+			FILE* f = _files[file];
+			// sequential writes, the common case, need no seek
+			if (position(f) != offset && !seek(f, offset)) {
+				_failed.push_back("seek");
+				return;
+			}
+			if (fwrite(data, 1, size, f) != size) _failed.push_back("write");
+		}
+
+		inline void close(int file) override {
+			std::lock_guard<std::mutex> lock(_lock);
+			if (fclose(_files[file]) != 0) _failed.push_back("close");
+			_files[file] = nullptr;
+		}
+
+		inline void flush() override {
+			std::lock_guard<std::mutex> lock(_lock);
+			if (!_failed.empty()) {
+				_failed.clear();
+				throw std::runtime_error("failed to write point cloud file");
+			}
+		}
+
+		inline std::string name() const override {
+			return "stdio";
+		}
+
+	private:
+
+		// 64 bit positions, long is 32 bits on windows
+		static inline uint64_t position(FILE* f) {
+#ifdef _WIN32
+			return uint64_t(_ftelli64(f));
+#else
+			return uint64_t(ftello(f));
+#endif
+		}
+
+		static inline bool seek(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+			return _fseeki64(f, int64_t(offset), SEEK_SET) == 0;
+#else
+			return fseeko(f, off_t(offset), SEEK_SET) == 0;
+#endif
+		}
+	};
+
+	// bytes per chunk of the asynchronous backends
+	constexpr size_t outputChunkSize = 1 << 20;
+
+	// base of the asynchronous backends
+	// write copies data into fixed size chunks and dispatches each chunk as one positioned write,
+	// files are closed by whoever completes their last chunk. waits only when every chunk is in flight
+	class chunkedOutput : public fileOutput {
+	protected:
+		struct fileState {
+			int fd = -1;
+			uint32_t pending = 0;	// chunks dispatched but not yet written
+			bool closing = false;
+			std::string path;
+		};
+
+		struct chunkWrite {
+			int file;
+			uint32_t chunk;
+			uint64_t offset;
+			uint32_t size;
+			uint32_t done;			// bytes written so far, short writes continue from here
+		};
+
+		pageBuffer _memory;
+		uint32_t _chunkCount;
+		std::vector<uint32_t> _freeChunks;
+		std::vector<fileState> _files;
+		std::vector<std::string> _failed;
+
+		std::mutex _lock;
+		std::condition_variable _chunkFreed;
+	public:
+		inline chunkedOutput(uint32_t chunks) : _memory(size_t(chunks) * outputChunkSize, false), _chunkCount(chunks) {
+			for (uint32_t i = chunks; i > 0; i--) _freeChunks.push_back(i - 1);
+		}
+
+		inline int open(std::string const& path) override {
+			int fd = openForWrite(path);
+			if (fd < 0) throw std::runtime_error("failed to open " + path);
+			std::lock_guard<std::mutex> lock(_lock);
+			fileState state;
+			state.fd = fd;
+			state.path = path;
+			for (size_t i = 0; i < _files.size(); i++) {
+				if (_files[i].fd < 0) {
+					_files[i] = state;
+					return int(i);
+				}
+			}
+			_files.push_back(state);
+			return int(_files.size() - 1);
+		}
+
+		inline void write(int file, uint64_t offset, void const* data, size_t size) override {
+			uint8_t const* bytes = (uint8_t const*)data;
+			std::unique_lock<std::mutex> lock(_lock);
+			while (size) {
+				while (_freeChunks.empty()) waitForChunk(lock);
+				uint32_t chunk = _freeChunks.back();
+				_freeChunks.pop_back();
+
+				uint32_t part = uint32_t(std::min(size, outputChunkSize));
+				memcpy(chunkData(chunk), bytes, part);
+				_files[file].pending++;
+				dispatch(lock, { file, chunk, offset, part, 0 });
+
+				bytes += part;
+				offset += part;
+				size -= part;
+			}
+			submit(lock);
+		}
+
+		inline void close(int file) override {
+			std::lock_guard<std::mutex> lock(_lock);
+			_files[file].closing = true;
+			if (_files[file].pending == 0) closeNow(file);
+		}
+
+		inline void flush() override {
+			std::unique_lock<std::mutex> lock(_lock);
+			while (_freeChunks.size() != _chunkCount) waitForChunk(lock);
+			if (!_failed.empty()) {
+				std::string path = _failed.front();
+				_failed.clear();
+				throw std::runtime_error("failed to write " + path);
+			}
+		}
+
+	protected:
+
+		inline uint8_t* chunkData(uint32_t chunk) {
+			return _memory.data() + size_t(chunk) * outputChunkSize;
+		}
+
+		// start writing a filled chunk, called with the lock held
+		virtual void dispatch(std::unique_lock<std::mutex>& lock, chunkWrite const& op) = 0;
+
+		// every chunk of a write has been dispatched, called with the lock held
+		virtual void submit(std::unique_lock<std::mutex>& lock) { }
+
+		// block until at least one chunk was freed, called with the lock held
+		virtual void waitForChunk(std::unique_lock<std::mutex>& lock) = 0;
+
+		// a chunk finished writing, called with the lock held
+		inline void complete(chunkWrite const& op, bool ok) {
+			fileState& state = _files[op.file];
+			if (!ok) _failed.push_back(state.path);
+			_freeChunks.push_back(op.chunk);
+			state.pending--;
+			if (state.closing && state.pending == 0) closeNow(op.file);
+			_chunkFreed.notify_all();
+		}
+
+	private:
+
+		inline void closeNow(int file) {
+			if (!closeFile(_files[file].fd)) _failed.push_back(_files[file].path);
+			_files[file] = fileState();
+		}
+	};
+
+	// a pool of threads doing positioned writes, the portable asynchronous backend
+	class pwriteOutput : public chunkedOutput {
+		std::deque<chunkWrite> _queue;
+		std::condition_variable _queued;
+		bool _stopping = false;
+		std::vector<std::thread> _workers;
+	public:
+		inline pwriteOutput(int threads = 4, uint32_t chunks = 32) : chunkedOutput(chunks) {
+			for (int i = 0; i < std::max(1, threads); i++) {
+				_workers.emplace_back([this]() { work(); });
+			}
+		}
+
+		// copy constructor removed
+		inline pwriteOutput(pwriteOutput const& other) = delete;
+
+		// copy assignment removed
+		inline pwriteOutput& operator=(pwriteOutput const& other) = delete;
+
+		// destructor, finishes outstanding writes
+		inline ~pwriteOutput() {
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				_stopping = true;
+			}
+			_queued.notify_all();
+			for (auto& worker : _workers) {
+				worker.join();
+			}
+		}
+
+		inline std::string name() const override {
+			return "pwrite";
+		}
+
+	protected:
+
+		inline void dispatch(std::unique_lock<std::mutex>& lock, chunkWrite const& op) override {
+			_queue.push_back(op);
+			_queued.notify_one();
+		}
+
+		inline void waitForChunk(std::unique_lock<std::mutex>& lock) override {
+			_chunkFreed.wait(lock);
+		}
+
+	private:
+
+		inline void work() {
+			std::unique_lock<std::mutex> lock(_lock);
+			while (true) {
+				_queued.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+				if (_queue.empty()) return;
+				chunkWrite op = _queue.front();
+				_queue.pop_front();
+				int fd = _files[op.file].fd;
+
+				lock.unlock();
+				bool ok = writeAt(fd, chunkData(op.chunk), op.size, op.offset);
+				lock.lock();
+
+				complete(op, ok);
+			}
+		}
+	};
+
+#ifdef KINECTCLOUD_IO_URING
+	// linux io_uring, one entry per chunk with the chunks registered as fixed buffers
+	// the chunks of a write go in with one system call, completions are reaped by one waiting caller at a time
+	class uringOutput : public chunkedOutput {
+		int _ring = -1;
+		uint8_t* _sqRing = nullptr;
+		uint8_t* _cqRing = nullptr;
+		size_t _sqRingSize = 0, _cqRingSize = 0;
+		io_uring_sqe* _sqes = nullptr;
+		size_t _sqesSize = 0;
+		io_uring_params _params = {};
+		bool _fixedBuffers = false;
+
+		std::vector<chunkWrite> _ops;	// by chunk, the user data of a submission is its chunk
+		std::vector<iovec> _vectors;	// by chunk, for vectored writes when the buffers are not registered
+		uint32_t _unsubmitted = 0;
+		bool _reaping = false;			// a caller is waiting in the kernel for completions
+	public:
+		// throws if the kernel does not support io_uring, see createFileOutput for the fallback
+		inline uringOutput(uint32_t chunks = 32) : chunkedOutput(chunks), _ops(chunks), _vectors(chunks) {
+			_ring = int(syscall(__NR_io_uring_setup, chunks, &_params));
+			if (_ring < 0) throw std::runtime_error("io_uring is not available");
+
+			_sqRingSize = _params.sq_off.array + _params.sq_entries * sizeof(uint32_t);
+			_cqRingSize = _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe);
+			bool singleMap = _params.features & IORING_FEAT_SINGLE_MMAP;
+			if (singleMap) _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+			_sqesSize = _params.sq_entries * sizeof(io_uring_sqe);
+
+			void* sq = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+			void* cq = singleMap ? sq : mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+			void* sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+			_sqRing = sq == MAP_FAILED ? nullptr : (uint8_t*)sq;
+			_cqRing = cq == MAP_FAILED ? nullptr : (uint8_t*)cq;
+			_sqes = sqes == MAP_FAILED ? nullptr : (io_uring_sqe*)sqes;
+			if (!_sqRing || !_cqRing || !_sqes) {
+				release();
+				throw std::runtime_error("failed to map io_uring");
+			}
+
+			// fixed buffers save the kernel from pinning pages on every write, if registering is refused the writes are
+			// vectored, which unlike plain IORING_OP_WRITE (5.6) every io_uring kernel has
+			std::vector<iovec> buffers(chunks);
+			for (uint32_t i = 0; i < chunks; i++) {
+				buffers[i].iov_base = chunkData(i);
+				buffers[i].iov_len = outputChunkSize;
+			}
+			_fixedBuffers = syscall(__NR_io_uring_register, _ring, IORING_REGISTER_BUFFERS, buffers.data(), chunks) == 0;
+		}
+
+		// copy constructor removed
+		inline uringOutput(uringOutput const& other) = delete;
+
+		// copy assignment removed
+		inline uringOutput& operator=(uringOutput const& other) = delete;
+
+		// destructor, finishes outstanding writes
+		inline ~uringOutput() {
+			{
+				std::unique_lock<std::mutex> lock(_lock);
+				while (_freeChunks.size() != _chunkCount) waitForChunk(lock);
+			}
+			release();
+		}
+
+		inline std::string name() const override {
+			return _fixedBuffers ? "io_uring" : "io_uring (unregistered buffers)";
+		}
+
+	protected:
+
+		inline void dispatch(std::unique_lock<std::mutex>& lock, chunkWrite const& op) override {
+			_ops[op.chunk] = op;
+			prepare(op);
+		}
+
+		inline void submit(std::unique_lock<std::mutex>& lock) override {
+			if (_unsubmitted) enter();
+		}
+
+		// every chunk in flight has been submitted before the lock is released, so the wait always ends
+		// callers which are not reaping wait for the reaper to free a chunk or give up the role
+		inline void waitForChunk(std::unique_lock<std::mutex>& lock) override {
+			if (_unsubmitted) enter();
+			if (_reaping) {
+				_chunkFreed.wait(lock);
+				return;
+			}
+			_reaping = true;
+			lock.unlock();
+			long res = syscall(__NR_io_uring_enter, _ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			int error = errno;
+			lock.lock();
+			_reaping = false;
+			_chunkFreed.notify_all();
+			if (res < 0 && error != EINTR && error != EAGAIN) throw std::runtime_error("io_uring wait failed");
+			reap();
+			if (_unsubmitted) enter();
+		}
+
+	private:
+
+		inline uint32_t& ringValue(uint8_t* ring, uint32_t offset) {
+			return *(uint32_t*)(ring + offset);
+		}
+
+		// fill the next submission entry, every chunk in flight owns one so the ring never overflows
+		inline void prepare(chunkWrite const& op) {
+			uint32_t tail = ringValue(_sqRing, _params.sq_off.tail);
+			uint32_t index = tail & ringValue(_sqRing, _params.sq_off.ring_mask);
+			io_uring_sqe& sqe = _sqes[index];
+			memset(&sqe, 0, sizeof(sqe));
+			sqe.fd = _files[op.file].fd;
+			sqe.off = op.offset + op.done;
+			if (_fixedBuffers) {
+				sqe.opcode = IORING_OP_WRITE_FIXED;
+				sqe.addr = uint64_t(chunkData(op.chunk) + op.done);
+				sqe.len = op.size - op.done;
+				sqe.buf_index = uint16_t(op.chunk);
+			} else {
+				iovec& vector = _vectors[op.chunk];
+				vector.iov_base = chunkData(op.chunk) + op.done;
+				vector.iov_len = op.size - op.done;
+				sqe.opcode = IORING_OP_WRITEV;
+				sqe.addr = uint64_t(&vector);
+				sqe.len = 1;
+			}
+			sqe.user_data = op.chunk;
+			((uint32_t*)(_sqRing + _params.sq_off.array))[index] = index;
+			__atomic_store_n(&ringValue(_sqRing, _params.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+			_unsubmitted++;
+		}
+
+		// submit everything prepared without waiting, the completion queue is twice the chunk count so it never fills
+		inline void enter() {
+			while (_unsubmitted) {
+				long res = syscall(__NR_io_uring_enter, _ring, _unsubmitted, 0, 0, nullptr, 0);
+				if (res >= 0) {
+					_unsubmitted -= uint32_t(res);
+				} else if (errno != EINTR && errno != EAGAIN) {
+					throw std::runtime_error("io_uring submission failed");
+				}
+			}
+		}
+
+		// handle every completion, short writes are resubmitted for the rest of their chunk
+		inline void reap() {
+			uint32_t head = ringValue(_cqRing, _params.cq_off.head);
+			uint32_t tail = __atomic_load_n(&ringValue(_cqRing, _params.cq_off.tail), __ATOMIC_ACQUIRE);
+			uint32_t mask = ringValue(_cqRing, _params.cq_off.ring_mask);
+			io_uring_cqe* cqes = (io_uring_cqe*)(_cqRing + _params.cq_off.cqes);
+			for (; head != tail; head++) {
+				io_uring_cqe const& cqe = cqes[head & mask];
+				chunkWrite& op = _ops[cqe.user_data];
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN || (cqe.res > 0 && op.done + uint32_t(cqe.res) < op.size)) {
+					if (cqe.res > 0) op.done += cqe.res;
+					prepare(op);
+				} else {
+					complete(op, cqe.res > 0);
+				}
+			}
+			__atomic_store_n(&ringValue(_cqRing, _params.cq_off.head), head, __ATOMIC_RELEASE);
+		}
+
+		inline void release() {
+			if (_sqes) munmap(_sqes, _sqesSize);
+			if (_cqRing && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+			if (_sqRing) munmap(_sqRing, _sqRingSize);
+			if (_ring >= 0) ::close(_ring);
+			_sqes = nullptr;
+			_cqRing = _sqRing = nullptr;
+			_ring = -1;
+		}
+	};
+#endif
+
+	// how point cloud files are written
+	enum class outputBackend {
+		stdio,	// fopen and fwrite, one file at a time
+		pwrite,	// positioned writes on a thread pool
+		uring,	// io_uring on linux, pwrite elsewhere
+	};
+
+	// parse output backend from string (not case sensitive), returns false if unknown
+	bool outputBackendFromString(std::string str, outputBackend& backend) {
+		str = stringToUppercase(str);
+		if (str == "STDIO") {
+			backend = outputBackend::stdio;
+		} else if (str == "PWRITE") {
+			backend = outputBackend::pwrite;
+		} else if (str == "URING" || str == "IO_URING") {
+			backend = outputBackend::uring;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	// create the backend, io_uring falls back to pwrite when the platform or kernel lacks it
+	std::unique_ptr<fileOutput> createFileOutput(outputBackend backend) {
+		if (backend == outputBackend::uring) {
+#ifdef KINECTCLOUD_IO_URING
+			try {
+				return std::make_unique<uringOutput>();
+			} catch (std::runtime_error const&) {
+			}
+#endif
+			backend = outputBackend::pwrite;
+		}
+		if (backend == outputBackend::pwrite) return std::make_unique<pwriteOutput>();
+		return std::make_unique<stdioOutput>();
+	}
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <k4a/k4a.h>
+
+#include "util.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+// winsock2 before windows.h, otherwise a later httplib include clashes with the winsock 1 headers
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace kinectCloud {
+	// page aligned block of memory, optionally backed by large pages
+	class pageBuffer {
+		uint8_t* _data = nullptr;
+		size_t _size = 0;
+		bool _largePages = false;
+	public:
+		inline pageBuffer() = default;
+
+		// allocate at least size bytes, large pages are used if requested and the os grants them
+		inline pageBuffer(size_t size, bool largePages) {
+#ifdef _WIN32
+			if (largePages && enableLockMemoryPrivilege()) {
+				size_t large = GetLargePageMinimum();
+				if (large) {
+					size_t rounded = (size + large - 1) / large * large;
+					_data = (uint8_t*)VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+					if (_data) {
+						_size = rounded;
+						_largePages = true;
+						return;
+					}
+				}
+			}
+			_data = (uint8_t*)VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			if (!_data) throw std::runtime_error("failed to allocate frame buffer");
+			_size = size;
+#else
+			void* res = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (res == MAP_FAILED) throw std::runtime_error("failed to allocate frame buffer");
+			_data = (uint8_t*)res;
+			_size = size;
+#ifdef MADV_HUGEPAGE
+			// transparent huge pages, a hint only
+			_largePages = largePages && madvise(res, size, MADV_HUGEPAGE) == 0;
+#endif
+#endif
+		}
+
+		inline uint8_t* data() const {
+			return _data;
+		}
+
+		inline size_t size() const {
+			return _size;
+		}
+
+		inline bool largePages() const {
+			return _largePages;
+		}
+
+		// copy constructor removed
+		inline pageBuffer(pageBuffer const& other) = delete;
+
+		// copy assignment removed
+		inline pageBuffer& operator=(pageBuffer const& other) = delete;
+
+		// move constructor (needed for use in std::vector)
+		inline pageBuffer(pageBuffer&& other) noexcept {
+			move(other);
+		}
+
+		// move assignment (needed for use in std::vector)
+		inline pageBuffer& operator=(pageBuffer&& other) noexcept {
+			release();
+			move(other);
+			return *this;
+		}
+
+		// destructor
+		inline ~pageBuffer() {
+			release();
+		}
+
+	private:
+
+		inline void release() {
+			if (_data) {
+#ifdef _WIN32
+				VirtualFree(_data, 0, MEM_RELEASE);
+#else
+				munmap(_data, _size);
+#endif
+				_data = nullptr;
+			}
+		}
+
+		// copy values from other to this, then clear values from other
+		inline void move(pageBuffer& other) {
+			_data = other._data;
+			_size = other._size;
+			_largePages = other._largePages;
+
+			other._data = nullptr;
+			other._size = 0;
+		}
+
+#ifdef _WIN32
+		// large pages need SeLockMemoryPrivilege, which must be granted to the user and then enabled for the process
+		static bool enableLockMemoryPrivilege() {
+			static const bool enabled = []() {
+				HANDLE token = nullptr;
+				if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+				TOKEN_PRIVILEGES privileges = {};
+				privileges.PrivilegeCount = 1;
+				privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+				bool res = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+					AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+					GetLastError() == ERROR_SUCCESS;
+				CloseHandle(token);
+				return res;
+			}();
+			return enabled;
+		}
+#endif
+	};
+
+	// scratch buffers reused across frames by one device or playback
+	// every slot grows to the largest size requested and is never shrunk, so steady state frames allocate nothing
+	class frameArena {
+	public:
+		enum slot {
+			colorDepthSlot,		// depth transformed into the color camera
+			xyzSlot,			// organized xyz image
+			mappedColorSlot,	// color transformed into the depth camera
+			textSlot,			// formatted pts text
+			filterSlot,			// per point values of the filter stages
+			filteredDepthSlot,	// depth image after the depth filters
+			temporalDepthSlot,	// depth image between the temporal and the flying pixel filter
+			normalSlot,			// per point normals
+			meshIndexSlot,		// vertex index of every pixel of a mesh
+			meshFaceSlot,		// triangles of a mesh
+			slotCount
+		};
+
+	private:
+		pageBuffer _slots[slotCount];
+		bool _largePages = false;
+
+		uint64_t _requests = 0;
+		uint64_t _allocations = 0;
+		uint64_t _largePageAllocations = 0;
+
+	public:
+		// back buffers allocated from now on with large pages, if the os allows it
+		inline void useLargePages(bool largePages) {
+			_largePages = largePages;
+		}
+
+		// buffer of at least size bytes for slot, contents are undefined
+		// the pointer is valid until the next request for the same slot
+		inline uint8_t* buffer(slot s, size_t size) {
+			_requests++;
+			if (_slots[s].size() < size) {
+				_slots[s] = pageBuffer();
+				_slots[s] = pageBuffer(size, _largePages);
+				_allocations++;
+				if (_slots[s].largePages()) _largePageAllocations++;
+			}
+			return _slots[s].data();
+		}
+
+		// same as k4a_image_create, but the image wraps the buffer of slot
+		// the caller releases the image as usual, the memory stays with the arena
+		inline k4a_result_t createImage(slot s, k4a_image_format_t format, int width, int height, int stride, k4a_image_t* img) {
+			size_t bytes = size_t(height) * stride;
+			uint8_t* data = nullptr;
+			try {
+				data = buffer(s, bytes);
+			} catch (std::runtime_error const&) {
+				return K4A_RESULT_FAILED;
+			}
+			return k4a_image_create_from_buffer(format, width, height, stride, data, bytes, nullptr, nullptr, img);
+		}
+
+		// number of buffers handed out
+		inline uint64_t requests() const {
+			return _requests;
+		}
+
+		// number of requests which had to allocate
+		inline uint64_t allocations() const {
+			return _allocations;
+		}
+
+		// bytes currently held
+		inline uint64_t reservedBytes() const {
+			uint64_t res = 0;
+			for (auto const& s : _slots) res += s.size();
+			return res;
+		}
+
+		// one line summary for verbose output
+		inline std::string summary() const {
+			return std::to_string(_allocations) + " allocations (" + std::to_string(_largePageAllocations) + " large page) for " +
+				std::to_string(_requests) + " buffer requests, " + std::to_string(reservedBytes() / (1024 * 1024)) + " MB reserved";
+		}
+	};
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "frameArena.h"
+
+namespace kinectCloud {
+	// frames of the point cloud server, handed from one producer to any number of readers without locks
+	// the raw blob of a frame is a slab of one block allocated up front. the producer fills a free slab and publishes
+	// it as an immutable, reference counted frame with an atomic pointer swap; readers take a reference with an
+	// atomic load and copy the frame out at their own pace. a slab is only refilled once its last reference is gone,
+	// and if readers hold every spare slab the producer drops the frame instead of waiting.
+	// frame n stays in cache slot n % capacity until frame n + capacity replaces it
+	// readers which wait for a new frame sleep on a condition variable, the producer only takes its mutex to notify
+	// the compressed blob of a frame is encoded by the first reader which asks for it, never by the producer
+	class frameRing {
+	public:
+		struct frame {
+			uint8_t* data = nullptr; // slab of slabSize bytes
+			uint64_t dataSize = 0;
+			int frameNum = -1;
+		private:
+			friend class frameRing;
+			mutable std::atomic_bool _inUse{ false }; // referenced by the cache or a reader
+			mutable std::mutex _encodeLock;
+			mutable bool _encoded = false;				// guarded by _encodeLock
+			mutable std::vector<uint8_t> _compressed;	// see cloudCodec.h, keeps its capacity from frame to frame
+		};
+
+		// fills out with the compressed form of a published frame
+		typedef std::function<void(frame const& f, std::vector<uint8_t>& out)> encoder;
+
+		// slabs beyond the cache, frames readers may still hold after they left the cache
+		static constexpr int readerSlabs = 4;
+
+	private:
+		pageBuffer _block;
+		uint64_t _slabSize = 0;
+		int _capacity = 0;
+		int _slabCount = 0;
+		std::unique_ptr<frame[]> _slabs;
+		std::vector<std::shared_ptr<frame const>> _slots; // accessed with the atomic shared_ptr functions only
+		std::shared_ptr<frame const> _latest;
+		int _nextSlab = 0;
+		encoder _encoder;
+		std::mutex _encoderLock; // one frame is encoded at a time, so the encoder can keep its buffers
+		std::atomic<uint64_t> _compressedBytes{ 0 };
+		std::atomic<uint64_t> _published{ 0 };
+		std::atomic<uint64_t> _dropped{ 0 };
+		std::mutex _waitLock;
+		std::condition_variable _newFrame;
+		bool _closed = false; // guarded by _waitLock
+
+	public:
+		// empty ring, nothing can be published
+		inline frameRing() = default;
+
+		// capacity = frames kept in the cache, slabSize = bytes of the largest raw blob
+		inline frameRing(int capacity, uint64_t slabSize, bool largePages = false) :
+			_slabSize(slabSize), _capacity(std::max(1, capacity)) {
+			_slabCount = _capacity + readerSlabs;
+			_block = pageBuffer(_slabSize * _slabCount, largePages);
+			_slabs.reset(new frame[_slabCount]);
+			for (int i = 0; i < _slabCount; i++) {
+				_slabs[i].data = _block.data() + _slabSize * i;
+			}
+			_slots.resize(_capacity);
+		}
+
+		// free slab for the next frame, null if readers hold every spare one. producer only
+		// the slab can be filled at leisure, nobody else sees it until publish
+		inline frame* acquire() {
+			for (int i = 0; i < _slabCount; i++) {
+				frame* f = &_slabs[(_nextSlab + i) % _slabCount];
+				if (!f->_inUse.load(std::memory_order_acquire)) {
+					_nextSlab = (_nextSlab + i + 1) % _slabCount;
+					f->_encoded = false;
+					return f;
+				}
+			}
+			_dropped++;
+			return nullptr;
+		}
+
+		// make f, filled after acquire, frame frameNum and the latest frame. producer only, never blocks
+		inline void publish(frame* f, int frameNum) {
+			f->frameNum = frameNum;
+			f->_inUse.store(true, std::memory_order_relaxed);
+			std::shared_ptr<frame const> published(f, [](frame const* done) {
+				done->_inUse.store(false, std::memory_order_release);
+			});
+
+			std::atomic_store(&_slots[frameNum % _capacity], published);
+			std::atomic_store(&_latest, published);
+			_published++;
+
+			// waiters check for the frame under the lock, so taking it here means none of them can miss the notify
+			{
+				std::lock_guard<std::mutex> lock(_waitLock);
+			}
+			_newFrame.notify_all();
+		}
+
+		// first frame after frame after, waits up to timeout for it to be published
+		// returns frame after + 1 if it is still cached, otherwise the latest, so a reader which keeps up gets every
+		// frame exactly once and one which falls behind skips ahead. null on timeout or once the ring is closed
+		// with latestOnly it always returns the latest, for streams which drop the frames they could not keep up with
+		inline std::shared_ptr<frame const> next(int after, std::chrono::milliseconds timeout, bool latestOnly = false) {
+			std::shared_ptr<frame const> f;
+			{
+				std::unique_lock<std::mutex> lock(_waitLock);
+				_newFrame.wait_for(lock, timeout, [&]() {
+					f = latest();
+					return _closed || (f && f->frameNum > after);
+				});
+				if (_closed || !f || f->frameNum <= after) return nullptr;
+			}
+			if (latestOnly) return f;
+			std::shared_ptr<frame const> following = find(after + 1);
+			return following ? following : f;
+		}
+
+		// set how compressed encodes frames, before the first is published
+		inline void encodeWith(encoder encode) {
+			_encoder = std::move(encode);
+		}
+
+		// compressed blob of f, encoded on the first call for this frame while later readers wait for it
+		// stays valid while the reader holds f, empty if no encoder was set
+		inline std::vector<uint8_t> const& compressed(frame const& f) {
+			std::lock_guard<std::mutex> lock(f._encodeLock);
+			if (!f._encoded && _encoder) {
+				std::lock_guard<std::mutex> encoding(_encoderLock);
+				_encoder(f, f._compressed);
+
+				// the blobs only change under _encoderLock, so their capacity can be read here
+				uint64_t bytes = 0;
+				for (int i = 0; i < _slabCount; i++) bytes += _slabs[i]._compressed.capacity();
+				_compressedBytes.store(bytes, std::memory_order_relaxed);
+			}
+			f._encoded = true;
+			return f._compressed;
+		}
+
+		// wake every waiting reader and make next return null from now on
+		inline void close() {
+			{
+				std::lock_guard<std::mutex> lock(_waitLock);
+				_closed = true;
+			}
+			_newFrame.notify_all();
+		}
+
+		// true once close was called
+		inline bool closed() {
+			std::lock_guard<std::mutex> lock(_waitLock);
+			return _closed;
+		}
+
+		// cached frame frameNum, null if it was never published or has been replaced
+		inline std::shared_ptr<frame const> find(int frameNum) const {
+			if (frameNum < 0 || _slots.empty()) return nullptr;
+			std::shared_ptr<frame const> f = std::atomic_load(&_slots[frameNum % _capacity]);
+			return f && f->frameNum == frameNum ? f : nullptr;
+		}
+
+		// most recently published frame, null before the first
+		inline std::shared_ptr<frame const> latest() const {
+			return std::atomic_load(&_latest);
+		}
+
+		// frames kept in the cache
+		inline int capacity() const {
+			return _capacity;
+		}
+
+		inline uint64_t slabSize() const {
+			return _slabSize;
+		}
+
+		// memory held, the slabs and the compressed blobs
+		inline uint64_t bytes() const {
+			return _block.size() + _compressedBytes.load(std::memory_order_relaxed);
+		}
+
+		// frames published so far
+		inline uint64_t published() const {
+			return _published.load();
+		}
+
+		// frames the producer dropped because readers held every spare slab
+		inline uint64_t dropped() const {
+			return _dropped.load();
+		}
+
+		// copy constructor removed
+		inline frameRing(frameRing const& other) = delete;
+
+		// copy assignment removed
+		inline frameRing& operator=(frameRing const& other) = delete;
+	};
+}
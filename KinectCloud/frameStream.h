@@ -0,0 +1,464 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frameRing.h"
+#include "httplib.h" // the socket headers, and on windows winsock is started by httplib
+
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/uio.h>
+#endif
+
+namespace kinectCloud {
+	// both transports stream frames as records of a [uint64 bytes][int64 frame number] header followed by the blob
+	// /frame/N (or /frame/N/compressed) returns. each record is the latest frame when the viewer is ready for it, the
+	// frames it was too slow for are dropped. a record of 0 bytes with the last frame number is sent when no frame came
+	// for streamKeepAlive ms, so dead viewers are noticed
+
+	// milliseconds without a frame before a stream sends an empty record
+	constexpr int streamKeepAlive = 1000;
+
+	// header of the record of f, or of an empty record after frame after if f is null
+	void streamRecordHeader(frameRing& frames, frameRing::frame const* f, int after, bool compressed, uint64_t header[2]) {
+		header[0] = f ? (compressed ? frames.compressed(*f).size() : f->dataSize) : 0;
+		header[1] = uint64_t(int64_t(f ? f->frameNum : after));
+	}
+
+	char const* streamRecordData(frameRing& frames, frameRing::frame const& f, bool compressed) {
+		return compressed ? (char const*)frames.compressed(f).data() : (char const*)f.data;
+	}
+
+	// caps the viewers which hold a server thread while they wait for or stream frames, so the threads left over
+	// keep answering everyone else
+	class viewerLimit {
+		std::atomic<int> _viewers{ 0 };
+		int _max;
+	public:
+		// one viewer's slot, given back when it is destroyed
+		class slot {
+			viewerLimit& _limit;
+		public:
+			inline slot(viewerLimit& limit) : _limit(limit) { }
+
+			inline ~slot() {
+				_limit._viewers--;
+			}
+
+			// copy constructor removed
+			inline slot(slot const& other) = delete;
+
+			// copy assignment removed
+			inline slot& operator=(slot const& other) = delete;
+		};
+
+		// max = viewers which may hold a slot at once
+		inline viewerLimit(int max) : _max(max) { }
+
+		// slot for one more viewer, null if max viewers hold one already
+		inline std::unique_ptr<slot> acquire() {
+			if (_viewers.fetch_add(1) >= _max) {
+				_viewers--;
+				return nullptr;
+			}
+			return std::unique_ptr<slot>(new slot(*this));
+		}
+
+		// viewers holding a slot
+		inline int viewers() const {
+			return _viewers.load();
+		}
+
+		inline int max() const {
+			return _max;
+		}
+
+		// copy constructor removed
+		inline viewerLimit(viewerLimit const& other) = delete;
+
+		// copy assignment removed
+		inline viewerLimit& operator=(viewerLimit const& other) = delete;
+	};
+
+	// push frames to res as they are published, until the viewer disconnects or frames is closed
+	// the viewer's slot is given back once httplib is done with the response
+	void httpFrameStream(frameRing& frames, httplib::Response& res, bool compressed, std::unique_ptr<viewerLimit::slot> viewer = nullptr) {
+		auto after = std::make_shared<int>(-1);
+		auto record = std::make_shared<std::vector<char>>();
+		std::shared_ptr<viewerLimit::slot> held(std::move(viewer));
+		res.set_header("Content-Type", "application/octet-stream");
+		res.set_chunked_content_provider([&frames, after, record, compressed](size_t offset, httplib::DataSink& sink) {
+			auto f = frames.next(*after, std::chrono::milliseconds(streamKeepAlive), true);
+			if (!f && frames.closed()) {
+				sink.done();
+				return;
+			}
+
+			// every write is a chunk of its own, so the header and the blob are copied into one
+			uint64_t header[2];
+			streamRecordHeader(frames, f.get(), *after, compressed, header);
+			record->resize(sizeof(header) + header[0]);
+			memcpy(record->data(), header, sizeof(header));
+			if (header[0]) memcpy(record->data() + sizeof(header), streamRecordData(frames, *f, compressed), header[0]);
+			sink.write(record->data(), record->size());
+			if (f) *after = f->frameNum;
+		}, [held]() mutable {
+			held.reset();
+		});
+	}
+
+	// the tcp transport: the viewer connects and subscribes with [uint32 tcpStreamMagic][uint32 flags], the server
+	// answers with the same magic and the flags it accepted, then pushes records until either side closes
+
+	// "KCS1" in little endian
+	constexpr uint32_t tcpStreamMagic = 0x3153434B;
+
+	// subscribe flag, compressed frames instead of raw blobs
+	constexpr uint32_t tcpStreamCompressed = 1;
+
+	struct tcpStreamOptions {
+		int port = 5688; // 0 = no tcp listener
+		bool noDelay = true; // TCP_NODELAY
+		int sendBuffer = 0; // SO_SNDBUF in bytes, 0 = os default
+		int maxSubscribers = 16; // connections beyond this are closed before the handshake
+	};
+
+	// one buffer of a gathered send
+	struct sendPart {
+		char const* data;
+		uint64_t size;
+	};
+
+	// send count parts in order straight from their memory, with as few system calls as the os allows
+	// returns false if the connection failed
+	bool sendParts(socket_t s, sendPart* parts, int count) {
+		constexpr int maxParts = 4;
+		// a single call takes at most 1 GB of a part
+		constexpr uint64_t maxCall = 1ull << 30;
+		while (count > 0) {
+			int n = std::min(count, maxParts);
+			uint64_t sent = 0;
+#ifdef _WIN32
+			WSABUF buffers[maxParts];
+			for (int i = 0; i < n; i++) {
+				buffers[i].buf = (char*)parts[i].data;
+				buffers[i].len = ULONG(std::min(parts[i].size, maxCall));
+			}
+			DWORD done = 0;
+			if (WSASend(s, buffers, DWORD(n), &done, 0, nullptr, nullptr) != 0) return false;
+			sent = done;
+#else
+			iovec buffers[maxParts];
+			for (int i = 0; i < n; i++) {
+				buffers[i].iov_base = (void*)parts[i].data;
+				buffers[i].iov_len = size_t(std::min(parts[i].size, maxCall));
+			}
+			msghdr msg = {};
+			msg.msg_iov = buffers;
+			msg.msg_iovlen = n;
+#ifdef MSG_NOSIGNAL
+			ssize_t done = sendmsg(s, &msg, MSG_NOSIGNAL);
+#else
+			ssize_t done = sendmsg(s, &msg, 0);
+#endif
+			if (done < 0) {
+				if (errno == EINTR) continue;
+				return false;
+			}
+			sent = uint64_t(done);
+#endif
+			while (count > 0 && sent >= parts->size) {
+				sent -= parts->size;
+				parts++;
+				count--;
+			}
+			if (count > 0) {
+				parts->data += sent;
+				parts->size -= sent;
+			}
+		}
+		return true;
+	}
+
+	// receive exactly size bytes, returns false if the connection closed first
+	bool receiveAll(socket_t s, char* data, uint64_t size) {
+		while (size > 0) {
+			auto got = recv(s, data, int(std::min<uint64_t>(size, 1ull << 30)), 0);
+			if (got == 0) return false;
+			if (got < 0) {
+#ifndef _WIN32
+				if (errno == EINTR) continue;
+#endif
+				return false;
+			}
+			data += got;
+			size -= uint64_t(got);
+		}
+		return true;
+	}
+
+	// second listener of the point cloud server, streams frames over plain tcp without http's parsing and copies
+	// every subscriber gets a thread which sends each record with one gathered send from the frame's slab, holding a
+	// reference to the frame until it is sent. listens on localhost like the http server
+	// at most maxSubscribers connections are served at once, the ones beyond are closed right away
+	class tcpFrameServer {
+		struct subscriber {
+			socket_t socket = INVALID_SOCKET;
+			std::thread thread;
+			std::atomic_bool done{ false };
+		};
+
+		frameRing* _frames = nullptr;
+		tcpStreamOptions _opts;
+		socket_t _listener = INVALID_SOCKET;
+		std::thread _acceptThread;
+		std::mutex _subscribersLock;
+		std::vector<std::unique_ptr<subscriber>> _subscribers; // sockets are closed only once their thread is joined
+		std::atomic_bool _stopping{ false };
+		std::atomic<uint64_t> _framesSent{ 0 };
+		std::atomic<uint64_t> _bytesSent{ 0 };
+		std::atomic<uint64_t> _refused{ 0 };
+
+#ifdef _WIN32
+		static constexpr int shutdownBoth = SD_BOTH;
+#else
+		static constexpr int shutdownBoth = SHUT_RDWR;
+#endif
+
+	public:
+		// no listener
+		inline tcpFrameServer() = default;
+
+		// listen on opts.port and stream frames, throws if the port can't be opened
+		inline tcpFrameServer(frameRing& frames, tcpStreamOptions const& opts) : _frames(&frames), _opts(opts) {
+			if (opts.port <= 0) return;
+
+			_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			if (_listener == INVALID_SOCKET) throw std::runtime_error("failed to create tcp listener");
+			int yes = 1;
+			setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, (char const*)&yes, sizeof(yes));
+
+			sockaddr_in addr = {};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(uint16_t(opts.port));
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			if (bind(_listener, (sockaddr const*)&addr, sizeof(addr)) != 0 || listen(_listener, SOMAXCONN) != 0) {
+				httplib::detail::close_socket(_listener);
+				_listener = INVALID_SOCKET;
+				throw std::runtime_error("failed to listen on tcp port " + std::to_string(opts.port));
+			}
+
+			_acceptThread = std::thread([this]() {
+				acceptLoop();
+			});
+		}
+
+		// port listened on, 0 if none
+		inline int port() const {
+			return _listener == INVALID_SOCKET ? 0 : _opts.port;
+		}
+
+		// viewers currently subscribed
+		inline int subscribers() {
+			std::lock_guard<std::mutex> lock(_subscribersLock);
+			int res = 0;
+			for (auto const& sub : _subscribers) res += !sub->done;
+			return res;
+		}
+
+		// frames sent to all subscribers so far
+		inline uint64_t framesSent() const {
+			return _framesSent.load();
+		}
+
+		// bytes of frames sent to all subscribers so far, without the record headers
+		inline uint64_t bytesSent() const {
+			return _bytesSent.load();
+		}
+
+		// connections closed because maxSubscribers were served already
+		inline uint64_t refused() const {
+			return _refused.load();
+		}
+
+		// stop listening and disconnect every subscriber
+		inline void stop() {
+			_stopping = true;
+			if (_acceptThread.joinable()) _acceptThread.join();
+
+			std::lock_guard<std::mutex> lock(_subscribersLock);
+			// wakes subscribers blocked in send or in the handshake
+			for (auto& sub : _subscribers) shutdown(sub->socket, shutdownBoth);
+			for (auto& sub : _subscribers) {
+				sub->thread.join();
+				httplib::detail::close_socket(sub->socket);
+			}
+			_subscribers.clear();
+
+			if (_listener != INVALID_SOCKET) {
+				httplib::detail::close_socket(_listener);
+				_listener = INVALID_SOCKET;
+			}
+		}
+
+		// destructor
+		inline ~tcpFrameServer() {
+			stop();
+		}
+
+		// copy constructor removed
+		inline tcpFrameServer(tcpFrameServer const& other) = delete;
+
+		// copy assignment removed
+		inline tcpFrameServer& operator=(tcpFrameServer const& other) = delete;
+
+	private:
+
+		// accept viewers until stop, the listener is polled so stop never waits on accept
+		inline void acceptLoop() {
+			while (!_stopping) {
+#ifdef _WIN32
+				WSAPOLLFD ready = {};
+				ready.fd = _listener;
+				ready.events = POLLRDNORM;
+				if (WSAPoll(&ready, 1, 100) <= 0) continue;
+#else
+				pollfd ready = {};
+				ready.fd = _listener;
+				ready.events = POLLIN;
+				if (poll(&ready, 1, 100) <= 0) continue;
+#endif
+
+				socket_t s = accept(_listener, nullptr, nullptr);
+				if (s == INVALID_SOCKET) continue;
+				int noDelay = _opts.noDelay ? 1 : 0;
+				setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char const*)&noDelay, sizeof(noDelay));
+				if (_opts.sendBuffer > 0) {
+					setsockopt(s, SOL_SOCKET, SO_SNDBUF, (char const*)&_opts.sendBuffer, sizeof(_opts.sendBuffer));
+				}
+
+				std::lock_guard<std::mutex> lock(_subscribersLock);
+				// viewers which left
+				for (size_t i = 0; i < _subscribers.size();) {
+					if (_subscribers[i]->done) {
+						_subscribers[i]->thread.join();
+						httplib::detail::close_socket(_subscribers[i]->socket);
+						_subscribers.erase(_subscribers.begin() + i);
+					} else {
+						i++;
+					}
+				}
+
+				// a connection still in its handshake counts too, it holds a thread as well
+				if (int(_subscribers.size()) >= std::max(1, _opts.maxSubscribers)) {
+					_refused++;
+					httplib::detail::close_socket(s);
+					continue;
+				}
+
+				std::unique_ptr<subscriber> sub(new subscriber());
+				subscriber* added = sub.get();
+				added->socket = s;
+				added->thread = std::thread([this, added]() {
+					serve(added->socket);
+					added->done = true;
+				});
+				_subscribers.push_back(std::move(sub));
+			}
+		}
+
+		// handshake, then push records until the viewer leaves or the server stops
+		inline void serve(socket_t s) {
+			uint32_t subscribe[2];
+			if (!receiveAll(s, (char*)subscribe, sizeof(subscribe)) || subscribe[0] != tcpStreamMagic) return;
+			bool compressed = (subscribe[1] & tcpStreamCompressed) != 0;
+			uint32_t accepted[2] = { tcpStreamMagic, compressed ? tcpStreamCompressed : 0 };
+			sendPart reply = { (char const*)accepted, sizeof(accepted) };
+			if (!sendParts(s, &reply, 1)) return;
+
+			int after = -1;
+			while (!_stopping) {
+				auto f = _frames->next(after, std::chrono::milliseconds(streamKeepAlive), true);
+				if (!f && _frames->closed()) return;
+
+				uint64_t header[2];
+				streamRecordHeader(*_frames, f.get(), after, compressed, header);
+				sendPart parts[2] = {
+					{ (char const*)header, sizeof(header) },
+					{ f ? streamRecordData(*_frames, *f, compressed) : nullptr, header[0] },
+				};
+				if (!sendParts(s, parts, f ? 2 : 1)) return;
+				if (f) {
+					after = f->frameNum;
+					_framesSent++;
+					_bytesSent += header[0];
+				}
+			}
+		}
+	};
+
+	// viewer side of the tcp stream, a reference for clients in other languages
+	class tcpFrameClient {
+		socket_t _socket = INVALID_SOCKET;
+	public:
+		// connect to host:port and subscribe, throws if the server can't be reached or refuses
+		inline tcpFrameClient(std::string const& host, int port, bool compressed = false) {
+			addrinfo hints = {};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			addrinfo* found = nullptr;
+			if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) {
+				throw std::runtime_error("failed to resolve " + host);
+			}
+			for (addrinfo* a = found; a && _socket == INVALID_SOCKET; a = a->ai_next) {
+				_socket = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+				if (_socket == INVALID_SOCKET) continue;
+				if (connect(_socket, a->ai_addr, int(a->ai_addrlen)) != 0) {
+					httplib::detail::close_socket(_socket);
+					_socket = INVALID_SOCKET;
+				}
+			}
+			freeaddrinfo(found);
+			if (_socket == INVALID_SOCKET) throw std::runtime_error("failed to connect to " + host + ":" + std::to_string(port));
+
+			int noDelay = 1;
+			setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (char const*)&noDelay, sizeof(noDelay));
+			uint32_t subscribe[2] = { tcpStreamMagic, compressed ? tcpStreamCompressed : 0 };
+			sendPart request = { (char const*)subscribe, sizeof(subscribe) };
+			uint32_t accepted[2];
+			if (!sendParts(_socket, &request, 1) || !receiveAll(_socket, (char*)accepted, sizeof(accepted)) ||
+				accepted[0] != tcpStreamMagic || accepted[1] != subscribe[1]) {
+				httplib::detail::close_socket(_socket);
+				throw std::runtime_error("tcp frame stream refused by " + host + ":" + std::to_string(port));
+			}
+		}
+
+		// wait for the next frame and copy its blob into blob, returns its number. throws once the stream ends
+		inline int next(std::vector<uint8_t>& blob) {
+			while (true) {
+				uint64_t header[2];
+				if (!receiveAll(_socket, (char*)header, sizeof(header))) throw std::runtime_error("tcp frame stream closed");
+				if (!header[0]) continue;
+				blob.resize(header[0]);
+				if (!receiveAll(_socket, (char*)blob.data(), header[0])) throw std::runtime_error("tcp frame stream closed");
+				return int(int64_t(header[1]));
+			}
+		}
+
+		// destructor
+		inline ~tcpFrameClient() {
+			httplib::detail::close_socket(_socket);
+		}
+
+		// copy constructor removed
+		inline tcpFrameClient(tcpFrameClient const& other) = delete;
+
+		// copy assignment removed
+		inline tcpFrameClient& operator=(tcpFrameClient const& other) = delete;
+	};
+}
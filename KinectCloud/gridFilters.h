@@ -0,0 +1,347 @@
+#pragma once
+
+#include "kinectUtil.h"
+#include "reprojection.h"
+
+namespace kinectCloud {
+	// depth of pixel (x, y) after flying pixel removal, see removeFlyingPixels. ratio = maxJump in 1/65536
+	inline uint16_t flyingPixelDepth(uint16_t const* depth, glm::uvec2 size, uint32_t x, uint32_t y, uint32_t ratio) {
+		uint16_t d = depth[uint64_t(y) * size.x + x];
+		if (d == 0) return 0;
+		uint32_t limit = (uint32_t(d) * ratio) >> 16;
+		uint32_t jump = 0;
+		for (uint32_t ny = y > 0 ? y - 1 : 0; ny <= std::min(size.y - 1, y + 1); ny++) {
+			for (uint32_t nx = x > 0 ? x - 1 : 0; nx <= std::min(size.x - 1, x + 1); nx++) {
+				uint16_t n = depth[uint64_t(ny) * size.x + nx];
+				if (n != 0) jump = std::max(jump, uint32_t(std::abs(int(n) - int(d))));
+			}
+		}
+		return jump > limit ? 0 : d;
+	}
+
+	// zero the pixels of a depth16 image whose largest jump to a valid 8-neighbour is above maxJump times their depth
+	// these are the pixels along depth discontinuities which mix foreground and background and turn into streaks of
+	// flying points once the depth is upsampled to the color camera. runs on the native depth grid, before any
+	// transformation, 8 pixels at a time with sse4.1 where available. out must not overlap depth
+	void removeFlyingPixels(uint16_t const* depth, uint16_t* out, glm::uvec2 size, float maxJump, int threads) {
+		uint32_t ratio = uint32_t(std::min(65535.f, std::max(0.f, maxJump * 65536.f)));
+		forEachRowBand(size.y, threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+#ifdef KINECTCLOUD_SSE
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i ratio16 = _mm_set1_epi16(int16_t(uint16_t(ratio)));
+#endif
+			for (uint32_t y = firstRow; y < lastRow; y++) {
+				uint16_t* row = out + uint64_t(y) * size.x;
+				uint32_t x = 0;
+
+#ifdef KINECTCLOUD_SSE
+				// the vector loop needs both neighbour rows and columns
+				if (y > 0 && y + 1 < size.y && size.x > 9) {
+					row[0] = flyingPixelDepth(depth, size, 0, y, ratio);
+					for (x = 1; x + 8 < size.x; x += 8) {
+						uint16_t const* center = depth + uint64_t(y) * size.x + x;
+						__m128i d = _mm_loadu_si128((__m128i const*)center);
+						__m128i jump = zero;
+						for (int dy = -1; dy <= 1; dy++) {
+							for (int dx = -1; dx <= 1; dx++) {
+								if (dy == 0 && dx == 0) continue;
+								__m128i n = _mm_loadu_si128((__m128i const*)(center + int64_t(dy) * size.x + dx));
+								__m128i diff = _mm_sub_epi16(_mm_max_epu16(d, n), _mm_min_epu16(d, n));
+								jump = _mm_max_epu16(jump, _mm_andnot_si128(_mm_cmpeq_epi16(n, zero), diff));
+							}
+						}
+						__m128i limit = _mm_mulhi_epu16(d, ratio16);
+						__m128i keep = _mm_cmpeq_epi16(_mm_max_epu16(jump, limit), limit);
+						_mm_storeu_si128((__m128i*)(row + x), _mm_and_si128(d, keep));
+					}
+				}
+#endif
+				for (; x < size.x; x++) {
+					row[x] = flyingPixelDepth(depth, size, x, y, ratio);
+				}
+			}
+		});
+	}
+
+	// per pixel smoothing of the depth of consecutive frames from one camera, the history persists between frames
+	// a pixel whose depth moved by more than the reset fraction of its depth starts over from the new depth, so motion
+	// is not smeared. invalid pixels stay invalid and leave their history alone
+	// vectorized with sse4.1 where available, 8 pixels at a time in row bands. not thread safe
+	class temporalFilter {
+		glm::uvec2 _size = glm::uvec2(0, 0);
+		temporalMode _mode = temporalMode::off;
+		int _frames = 0;
+		std::vector<float> _average;		// ema state, 0 => no history
+		std::vector<uint16_t> _history;		// median history, _frames images, 0 => no sample
+		int _next = 0;						// image of _history the next frame goes to
+	public:
+		static constexpr int maxFrames = 9;
+
+		// smooth depth into out with the mode, weight, frames and reset of opts. out must not overlap depth
+		// the history starts over when the size or the mode changes
+		inline void apply(uint16_t const* depth, uint16_t* out, glm::uvec2 size, cloudOptions const& opts) {
+			int frames = std::max(1, std::min(maxFrames, opts.temporalFrames));
+			uint64_t count = uint64_t(size.x) * size.y;
+			if (size.x != _size.x || size.y != _size.y || opts.temporal != _mode || (opts.temporal == temporalMode::median && frames != _frames)) {
+				_size = size;
+				_mode = opts.temporal;
+				_frames = frames;
+				_next = 0;
+				_average.assign(_mode == temporalMode::ema ? count : 0, 0.f);
+				_history.assign(_mode == temporalMode::median ? count * frames : 0, 0);
+			}
+
+			if (_mode == temporalMode::off) {
+				memcpy(out, depth, count * sizeof(uint16_t));
+				return;
+			}
+			uint32_t reset = uint32_t(std::min(65535.f, std::max(0.f, opts.temporalReset * 65536.f)));
+			float weight = std::max(0.f, std::min(1.f, opts.temporalWeight));
+			forEachRowBand(size.y, opts.threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+				uint64_t first = uint64_t(firstRow) * size.x, last = uint64_t(lastRow) * size.x;
+				if (_mode == temporalMode::ema) {
+					ema(depth, out, first, last, weight, opts.temporalReset);
+				} else {
+					median(depth, out, first, last, reset);
+				}
+			});
+			if (_mode == temporalMode::median) _next = (_next + 1) % _frames;
+		}
+
+		// forget every pixel's history
+		inline void reset() {
+			_size = glm::uvec2(0, 0);
+		}
+
+	private:
+
+		inline void ema(uint16_t const* depth, uint16_t* out, uint64_t first, uint64_t last, float weight, float reset) {
+			float* average = _average.data();
+			uint64_t i = first;
+#ifdef KINECTCLOUD_SSE
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 weight4 = _mm_set1_ps(weight);
+			const __m128 reset4 = _mm_set1_ps(reset);
+			const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+			for (; i + 8 <= last; i += 8) {
+				__m128i d = _mm_loadu_si128((__m128i const*)(depth + i));
+				__m128 value[2] = { _mm_cvtepi32_ps(_mm_cvtepu16_epi32(d)), _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(d, 8))) };
+				__m128i rounded[2];
+				for (int h = 0; h < 2; h++) {
+					__m128 state = _mm_loadu_ps(average + i + h * 4);
+					__m128 diff = _mm_sub_ps(value[h], state);
+					__m128 restart = _mm_or_ps(_mm_cmpeq_ps(state, zero), _mm_cmpgt_ps(_mm_and_ps(diff, absMask), _mm_mul_ps(value[h], reset4)));
+					__m128 next = _mm_blendv_ps(_mm_add_ps(state, _mm_mul_ps(weight4, diff)), value[h], restart);
+					__m128 valid = _mm_cmpneq_ps(value[h], zero);
+					next = _mm_blendv_ps(state, next, valid);
+					_mm_storeu_ps(average + i + h * 4, next);
+					rounded[h] = _mm_and_si128(_mm_cvtps_epi32(next), _mm_castps_si128(valid));
+				}
+				_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi32(rounded[0], rounded[1]));
+			}
+#endif
+			for (; i < last; i++) {
+				float value = depth[i];
+				if (value == 0.f) {
+					out[i] = 0;
+					continue;
+				}
+				float diff = value - average[i];
+				average[i] = (average[i] == 0.f || std::fabs(diff) > value * reset) ? value : average[i] + weight * diff;
+				out[i] = uint16_t(std::nearbyint(average[i]));
+			}
+		}
+
+		inline void median(uint16_t const* depth, uint16_t* out, uint64_t first, uint64_t last, uint32_t reset) {
+			uint64_t count = uint64_t(_size.x) * _size.y;
+			uint16_t* history = _history.data();
+			uint16_t* current = history + _next * count;
+			int frames = std::min(_frames, maxFrames);
+			uint64_t i = first;
+#ifdef KINECTCLOUD_SSE
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i reset8 = _mm_set1_epi16(int16_t(uint16_t(reset)));
+			for (; i + 8 <= last; i += 8) {
+				__m128i d = _mm_loadu_si128((__m128i const*)(depth + i));
+				__m128i valid = _mm_xor_si128(_mm_cmpeq_epi16(d, zero), _mm_set1_epi16(-1));
+				_mm_storeu_si128((__m128i*)(current + i), _mm_blendv_epi8(_mm_loadu_si128((__m128i const*)(current + i)), d, valid));
+
+				// missing samples count as the new depth, then an odd even transposition sort
+				__m128i v[maxFrames];
+				for (int f = 0; f < frames; f++) {
+					__m128i h = _mm_loadu_si128((__m128i const*)(history + f * count + i));
+					v[f] = _mm_blendv_epi8(h, d, _mm_cmpeq_epi16(h, zero));
+				}
+				for (int round = 0; round < frames; round++) {
+					for (int f = round & 1; f + 1 < frames; f += 2) {
+						__m128i low = _mm_min_epu16(v[f], v[f + 1]);
+						v[f + 1] = _mm_max_epu16(v[f], v[f + 1]);
+						v[f] = low;
+					}
+				}
+				__m128i med = v[frames / 2];
+
+				__m128i jump = _mm_sub_epi16(_mm_max_epu16(d, med), _mm_min_epu16(d, med));
+				__m128i limit = _mm_mulhi_epu16(d, reset8);
+				__m128i moved = _mm_xor_si128(_mm_cmpeq_epi16(_mm_max_epu16(jump, limit), limit), _mm_set1_epi16(-1));
+				moved = _mm_and_si128(moved, valid);
+				if (!_mm_testz_si128(moved, moved)) {
+					for (int f = 0; f < frames; f++) {
+						__m128i* h = (__m128i*)(history + f * count + i);
+						_mm_storeu_si128(h, _mm_blendv_epi8(_mm_loadu_si128(h), d, moved));
+					}
+				}
+				_mm_storeu_si128((__m128i*)(out + i), _mm_and_si128(_mm_blendv_epi8(med, d, moved), valid));
+			}
+#endif
+			for (; i < last; i++) {
+				uint16_t d = depth[i];
+				if (d) current[i] = d;
+				uint16_t v[maxFrames];
+				for (int f = 0; f < frames; f++) {
+					uint16_t h = history[f * count + i];
+					v[f] = h ? h : d;
+				}
+				for (int round = 0; round < frames; round++) {
+					for (int f = round & 1; f + 1 < frames; f += 2) {
+						if (v[f] > v[f + 1]) std::swap(v[f], v[f + 1]);
+					}
+				}
+				uint16_t med = v[frames / 2];
+				bool moved = d != 0 && uint32_t(std::abs(int(d) - int(med))) > ((uint32_t(d) * reset) >> 16);
+				if (moved) {
+					for (int f = 0; f < frames; f++) history[f * count + i] = d;
+				}
+				out[i] = d == 0 ? 0 : (moved ? d : med);
+			}
+		}
+	};
+
+	// statistical outlier removal on the organized point grid
+	// the neighbours of a point are the valid points in the (2 * radius + 1)^2 pixel window around it, so no
+	// k-d tree is needed. the spacing of grid neighbours grows with range, so the mean distance to them is divided
+	// by the point's range. a point is removed if that is above the frame's mean plus deviations standard deviations,
+	// or if it has no neighbours at all
+	// the stage keeps the row pointers it receives and filters the whole grid in finish, in row bands
+	// the filtered grid is a copy, the rows this stage receives are never changed
+	template<class Sink>
+	class outlierSink {
+		frameArena* _arena;
+		frameArena _temporary;
+		int _radius;
+		float _deviations;
+		int _threads;
+		Sink& _sink;
+		glm::uvec2 _size = glm::uvec2(0, 0);
+		float* _distance = nullptr;
+		int16_t* _filtered = nullptr;
+		std::vector<int16_t const*> _xyzRows;
+		std::vector<uint8_t const*> _bgraRows;
+		uint64_t _removed = 0;
+	public:
+		// radius = window radius in pixels, deviations = standard deviations above the mean which are kept
+		// per point distances and the filtered grid live in the arena if one is given, otherwise in a temporary buffer
+		inline outlierSink(int radius, float deviations, int threads, Sink& sink, frameArena* arena = nullptr) :
+			_arena(arena), _radius(std::max(1, radius)), _deviations(deviations), _threads(threads), _sink(sink) { }
+
+		// points removed from the last frame, valid after finish
+		inline uint64_t removed() const {
+			return _removed;
+		}
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			_size = size;
+			_xyzRows.assign(size.y, nullptr);
+			_bgraRows.assign(size.y, nullptr);
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			_xyzRows[y] = xyz;
+			_bgraRows[y] = bgra;
+		}
+
+		inline void finish() {
+			uint64_t count = uint64_t(_size.x) * _size.y;
+			uint8_t* buffer = (_arena ? _arena : &_temporary)->buffer(frameArena::filterSlot, count * (sizeof(float) + sizeof(int16_t) * 3));
+			_distance = (float*)buffer;
+			_filtered = (int16_t*)(buffer + count * sizeof(float));
+
+			// mean neighbour distance of every point, -1 for invalid points and 0 neighbours, with per band sums
+			uint32_t bands = rowBandCount(_size.y, _threads);
+			std::vector<double> sum(bands, 0.0), sumSquares(bands, 0.0);
+			std::vector<uint64_t> counted(bands, 0);
+			forEachRowBand(_size.y, _threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+				for (uint32_t y = firstRow; y < lastRow; y++) {
+					float* distance = _distance + uint64_t(y) * _size.x;
+					for (uint32_t x = 0; x < _size.x; x++) {
+						distance[x] = meanDistance(x, y);
+						if (distance[x] >= 0.f) {
+							sum[band] += distance[x];
+							sumSquares[band] += double(distance[x]) * distance[x];
+							counted[band]++;
+						}
+					}
+				}
+			});
+
+			double total = 0.0, totalSquares = 0.0;
+			uint64_t valid = 0;
+			for (uint32_t b = 0; b < bands; b++) {
+				total += sum[b];
+				totalSquares += sumSquares[b];
+				valid += counted[b];
+			}
+			double mean = valid ? total / valid : 0.0;
+			double deviation = valid ? std::sqrt(std::max(0.0, totalSquares / valid - mean * mean)) : 0.0;
+			float threshold = float(mean + _deviations * deviation);
+
+			// every band copies its rows with the outliers cleared, then hands them on
+			std::vector<uint64_t> removed(bands, 0);
+			_sink.begin(_size, bands);
+			forEachRowBand(_size.y, _threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+				for (uint32_t y = firstRow; y < lastRow; y++) {
+					float const* distance = _distance + uint64_t(y) * _size.x;
+					int16_t const* xyz = _xyzRows[y];
+					int16_t* filtered = _filtered + uint64_t(y) * _size.x * 3;
+					for (uint32_t x = 0; x < _size.x; x++) {
+						bool valid = xyz[x * 3 + 0] != 0 || xyz[x * 3 + 1] != 0 || xyz[x * 3 + 2] != 0;
+						bool keep = distance[x] >= 0.f && distance[x] <= threshold;
+						if (valid && !keep) removed[band]++;
+						for (int c = 0; c < 3; c++) filtered[x * 3 + c] = keep ? xyz[x * 3 + c] : 0;
+					}
+					_sink.row(band, y, filtered, _bgraRows[y], _size.x);
+				}
+			});
+			_sink.finish();
+
+			_removed = 0;
+			for (auto r : removed) _removed += r;
+		}
+
+	private:
+
+		// mean distance from point (x, y) to the valid points of its window over its range, -1 if it is invalid or has none
+		inline float meanDistance(uint32_t x, uint32_t y) const {
+			int16_t const* p = _xyzRows[y] + x * 3;
+			if (p[0] == 0 && p[1] == 0 && p[2] == 0) return -1.f;
+			float px = p[0], py = p[1], pz = p[2];
+
+			uint32_t firstY = y >= uint32_t(_radius) ? y - _radius : 0, lastY = std::min(_size.y - 1, y + _radius);
+			uint32_t firstX = x >= uint32_t(_radius) ? x - _radius : 0, lastX = std::min(_size.x - 1, x + _radius);
+			float sum = 0.f;
+			uint32_t neighbours = 0;
+			for (uint32_t ny = firstY; ny <= lastY; ny++) {
+				int16_t const* row = _xyzRows[ny];
+				for (uint32_t nx = firstX; nx <= lastX; nx++) {
+					int16_t const* q = row + nx * 3;
+					if (q[0] == 0 && q[1] == 0 && q[2] == 0) continue;
+					if (nx == x && ny == y) continue;
+					float dx = q[0] - px, dy = q[1] - py, dz = q[2] - pz;
+					sum += std::sqrt(dx * dx + dy * dy + dz * dz);
+					neighbours++;
+				}
+			}
+			return neighbours ? sum / (neighbours * std::sqrt(px * px + py * py + pz * pz)) : -1.f;
+		}
+	};
+}
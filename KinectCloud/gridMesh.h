@@ -0,0 +1,240 @@
+#pragma once
+
+#include "kinectUtil.h"
+#include "reprojection.h"
+#include "fileOutput.h"
+#include "gridNormals.h"
+
+namespace kinectCloud {
+	// no vertex at this pixel
+	constexpr uint32_t noVertex = 0xFFFFFFFF;
+
+	// bytes of a face in the ply file, [uint8 3][int32 a][int32 b][int32 c]
+	constexpr uint32_t meshFaceSize = 13;
+
+	// true if the depths of a triangle's corners are within maxJump of the nearest one
+	inline bool meshTriangleFits(int16_t const* a, int16_t const* b, int16_t const* c, float maxJump) {
+		int32_t low = std::min({ a[2], b[2], c[2] }), high = std::max({ a[2], b[2], c[2] });
+		return float(high - low) <= float(low) * maxJump;
+	}
+
+	// triangulate the 2x2 blocks of pixels between row top and the row below it into faces
+	// topIndex and bottomIndex are the vertex indices of the rows' pixels (noVertex for invalid points), the offsets
+	// are added to them. a block of 4 valid points is split along its shorter depth diagonal, a block of 3 gives one
+	// triangle, and triangles spanning more than maxJump of depth are dropped. triangles are wound counter clockwise
+	// as seen from the camera. returns the number of faces written to faces
+	uint64_t triangulateRows(int16_t const* top, int16_t const* bottom, uint32_t const* topIndex, uint32_t const* bottomIndex,
+		uint32_t topOffset, uint32_t bottomOffset, uint32_t width, float maxJump, uint8_t* faces) {
+		uint64_t count = 0;
+		auto emit = [&](int16_t const* a, int16_t const* b, int16_t const* c, uint32_t ia, uint32_t ib, uint32_t ic) {
+			if (!meshTriangleFits(a, b, c, maxJump)) return;
+			uint8_t* face = faces + count * meshFaceSize;
+			int32_t indices[3] = { int32_t(ia), int32_t(ib), int32_t(ic) };
+			face[0] = 3;
+			memcpy(face + 1, indices, sizeof(indices));
+			count++;
+		};
+
+		for (uint32_t x = 0; x + 1 < width; x++) {
+			uint32_t tl = topIndex[x], tr = topIndex[x + 1], bl = bottomIndex[x], br = bottomIndex[x + 1];
+			int valid = (tl != noVertex) + (tr != noVertex) + (bl != noVertex) + (br != noVertex);
+			if (valid < 3) continue;
+
+			int16_t const* ptl = top + x * 3, *ptr = top + (x + 1) * 3, *pbl = bottom + x * 3, *pbr = bottom + (x + 1) * 3;
+			tl += topOffset;
+			tr += topOffset;
+			bl += bottomOffset;
+			br += bottomOffset;
+			if (valid == 4) {
+				if (std::abs(ptl[2] - pbr[2]) <= std::abs(ptr[2] - pbl[2])) {
+					emit(ptl, pbl, pbr, tl, bl, br);
+					emit(ptl, pbr, ptr, tl, br, tr);
+				} else {
+					emit(ptl, pbl, ptr, tl, bl, tr);
+					emit(ptr, pbl, pbr, tr, bl, br);
+				}
+			} else if (topIndex[x] == noVertex) {
+				emit(ptr, pbl, pbr, tr, bl, br);
+			} else if (topIndex[x + 1] == noVertex) {
+				emit(ptl, pbl, pbr, tl, bl, br);
+			} else if (bottomIndex[x] == noVertex) {
+				emit(ptl, pbr, ptr, tl, br, tr);
+			} else {
+				emit(ptl, pbl, ptr, tl, bl, tr);
+			}
+		}
+		return count;
+	}
+
+	// triangle mesh of the organized grid as an indexed binary ply file
+	// every valid point is a vertex, stored like plySink stores points, and neighbouring pixels are triangulated by
+	// triangulateRows. vertices are numbered in row order, so the file is the same for any number of bands:
+	// a band packs its vertices and the faces between its own rows into its slices with band local indices while the
+	// rows are in cache, finish adds the vertex offsets of the bands, triangulates the rows where bands meet and
+	// writes the slices in order
+	class meshSink {
+		std::string _path;
+		float _maxJump;
+		frameArena* _arena;
+		frameArena _temporary;
+		fileOutput* _output;
+		stdioOutput _stdio;
+		normalFormat _normals;
+		uint32_t _vertexSize;
+		glm::uvec2 _size = glm::uvec2(0, 0);
+		uint32_t _bands = 0;
+		uint8_t* _vertices = nullptr;
+		uint8_t* _faces = nullptr;
+		uint32_t* _indices = nullptr;
+		std::vector<int16_t const*> _xyzRows;
+		std::vector<uint64_t> _bandVertices, _bandFaces;
+		uint64_t _vertexCount = 0, _faceCount = 0;
+	public:
+		// maxJump = largest depth difference within a triangle, relative to its nearest corner
+		// buffers live in the arena if one is given, otherwise in a temporary buffer
+		// the file is written through output if one is given, otherwise synchronously with stdio
+		// with normals every vertex carries its normal, the rows then have to come with normals
+		inline meshSink(std::string const& path, float maxJump, frameArena* arena = nullptr, fileOutput* output = nullptr, normalFormat normals = normalFormat::off) :
+			_path(path), _maxJump(maxJump), _arena(arena), _output(output ? output : &_stdio), _normals(normals), _vertexSize(9 + normalSize(normals)) { }
+
+		// number of vertices written, valid after finish
+		inline uint64_t vertices() const {
+			return _vertexCount;
+		}
+
+		// number of triangles written, valid after finish
+		inline uint64_t faces() const {
+			return _faceCount;
+		}
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			_size = size;
+			_bands = bands;
+			uint64_t pixels = uint64_t(size.x) * size.y;
+			frameArena& arena = _arena ? *_arena : _temporary;
+			_vertices = arena.buffer(frameArena::textSlot, pixels * _vertexSize);
+			_faces = arena.buffer(frameArena::meshFaceSlot, pixels * 2 * meshFaceSize);
+			_indices = (uint32_t*)arena.buffer(frameArena::meshIndexSlot, pixels * sizeof(uint32_t));
+			_xyzRows.assign(size.y, nullptr);
+			_bandVertices.assign(bands, 0);
+			_bandFaces.assign(bands, 0);
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			add(band, y, xyz, bgra, nullptr, width);
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint8_t const* normals, uint32_t width) {
+			add(band, y, xyz, bgra, normals, width);
+		}
+
+		inline void finish() {
+			std::vector<uint64_t> vertexStart(_bands + 1, 0);
+			for (uint32_t b = 0; b < _bands; b++) {
+				vertexStart[b + 1] = vertexStart[b] + _bandVertices[b];
+			}
+			if (vertexStart[_bands] > uint64_t(std::numeric_limits<int32_t>::max())) throw std::runtime_error("too many vertices for " + _path);
+
+			// band local indices become file indices, then the rows where bands meet are joined
+			forEachRowBand(_size.y, _bands, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+				uint8_t* faces = bandFaces(band);
+				int32_t offset = int32_t(vertexStart[band]);
+				for (uint64_t f = 0; f < _bandFaces[band]; f++) {
+					int32_t indices[3];
+					memcpy(indices, faces + f * meshFaceSize + 1, sizeof(indices));
+					for (int32_t& index : indices) index += offset;
+					memcpy(faces + f * meshFaceSize + 1, indices, sizeof(indices));
+				}
+				if (band + 1 < _bands && lastRow < _size.y) {
+					_bandFaces[band] += triangulateRows(_xyzRows[lastRow - 1], _xyzRows[lastRow], indexRow(lastRow - 1), indexRow(lastRow),
+						uint32_t(vertexStart[band]), uint32_t(vertexStart[band + 1]), _size.x, _maxJump, faces + _bandFaces[band] * meshFaceSize);
+				}
+			});
+
+			_vertexCount = vertexStart[_bands];
+			_faceCount = 0;
+			for (uint32_t b = 0; b < _bands; b++) {
+				_faceCount += _bandFaces[b];
+			}
+
+			std::string head = header(_vertexCount, _faceCount, _normals);
+			int file = _output->open(_path);
+			try {
+				uint64_t offset = 0;
+				_output->write(file, offset, head.data(), head.size());
+				offset += head.size();
+				for (uint32_t b = 0; b < _bands; b++) {
+					_output->write(file, offset, bandVertices(b), _bandVertices[b] * _vertexSize);
+					offset += _bandVertices[b] * _vertexSize;
+				}
+				for (uint32_t b = 0; b < _bands; b++) {
+					_output->write(file, offset, bandFaces(b), _bandFaces[b] * meshFaceSize);
+					offset += _bandFaces[b] * meshFaceSize;
+				}
+			} catch (...) {
+				_output->close(file);
+				throw;
+			}
+			_output->close(file);
+			if (_output == &_stdio) _stdio.flush();
+		}
+
+		// copy constructor removed
+		inline meshSink(meshSink const& other) = delete;
+
+		// copy assignment removed
+		inline meshSink& operator=(meshSink const& other) = delete;
+
+	private:
+
+		inline uint8_t* bandVertices(uint32_t band) {
+			return _vertices + uint64_t(rowBandStart(_size.y, _bands, band)) * _size.x * _vertexSize;
+		}
+
+		// a band has room for 2 faces per pixel of its rows, more than the blocks of its rows and the rows below
+		inline uint8_t* bandFaces(uint32_t band) {
+			return _faces + uint64_t(rowBandStart(_size.y, _bands, band)) * _size.x * 2 * meshFaceSize;
+		}
+
+		inline uint32_t* indexRow(uint32_t y) {
+			return _indices + uint64_t(y) * _size.x;
+		}
+
+		// pack the vertices of row y, number them and triangulate the blocks between it and the row before
+		inline void add(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint8_t const* normals, uint32_t width) {
+			uint32_t* indices = indexRow(y);
+			uint32_t next = uint32_t(_bandVertices[band]);
+			for (uint32_t x = 0; x < width; x++) {
+				bool valid = xyz[x * 3 + 0] != 0 || xyz[x * 3 + 1] != 0 || xyz[x * 3 + 2] != 0;
+				indices[x] = valid ? next++ : noVertex;
+			}
+
+			uint8_t* vertices = bandVertices(band) + _bandVertices[band] * _vertexSize;
+			if (normals) compactPointNormals(xyz, bgra, normals, _vertexSize - 9, width, vertices);
+			else compactPoints(xyz, bgra, width, vertices);
+			_bandVertices[band] = next;
+			_xyzRows[y] = xyz;
+
+			if (y > rowBandStart(_size.y, _bands, band)) {
+				_bandFaces[band] += triangulateRows(_xyzRows[y - 1], xyz, indexRow(y - 1), indices, 0, 0, width, _maxJump,
+					bandFaces(band) + _bandFaces[band] * meshFaceSize);
+			}
+		}
+
+		static inline std::string header(uint64_t vertices, uint64_t faces, normalFormat normals) {
+			std::string normalComment, normalProperties;
+			plyNormalHeader(normals, normalComment, normalProperties);
+			return std::string("ply\nformat binary_little_endian 1.0\ncomment KinectCloud, xyz in millimeters\n") + normalComment +
+				"element vertex " + std::to_string(vertices) + "\n"
+				"property short x\nproperty short y\nproperty short z\n"
+				"property uchar blue\nproperty uchar green\nproperty uchar red\n" +
+				normalProperties +
+				"element face " + std::to_string(faces) + "\n"
+				"property list uchar int vertex_indices\n"
+				"end_header\n";
+		}
+	};
+
+	template<>
+	struct sinkTakesNormals<meshSink> : std::true_type { };
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "kinectUtil.h"
+#include "reprojection.h"
+
+#include <type_traits>
+
+namespace kinectCloud {
+	// normals on the organized point grid
+	// the normal of a point is the cross product of the vectors to its right and lower neighbour, so it faces the camera.
+	// a neighbour counts if it is valid and its depth is within maxNormalStep of the point's, the left neighbour stands
+	// in for a missing right one. a point without a horizontal or a lower neighbour gets no normal, so the normals of a
+	// row only depend on that row and the next one
+	constexpr float maxNormalStep = depthReprojector::maxDepthStep;
+
+	// true for sinks which have the row with normals, see pipeline.h
+	template<class Sink>
+	struct sinkTakesNormals : std::false_type { };
+
+	// normal of point x of row xyz, below is the next row or null. returns false if the point has no normal
+	inline bool gridNormal(int16_t const* xyz, int16_t const* below, uint32_t width, uint32_t x, float* n) {
+		int16_t const* p = xyz + x * 3;
+		if ((p[0] == 0 && p[1] == 0 && p[2] == 0) || below == nullptr) return false;
+		float px = p[0], py = p[1], pz = p[2];
+		auto usable = [&](int16_t const* q) {
+			return (q[0] != 0 || q[1] != 0 || q[2] != 0) && std::abs(float(q[2]) - pz) <= pz * maxNormalStep;
+		};
+
+		float ax, ay, az;
+		if (x + 1 < width && usable(p + 3)) {
+			ax = float(p[3]) - px;
+			ay = float(p[4]) - py;
+			az = float(p[5]) - pz;
+		} else if (x > 0 && usable(p - 3)) {
+			ax = px - float(p[-3]);
+			ay = py - float(p[-2]);
+			az = pz - float(p[-1]);
+		} else {
+			return false;
+		}
+		int16_t const* d = below + x * 3;
+		if (!usable(d)) return false;
+		float bx = float(d[0]) - px, by = float(d[1]) - py, bz = float(d[2]) - pz;
+
+		float nx = by * az - bz * ay;
+		float ny = bz * ax - bx * az;
+		float nz = bx * ay - by * ax;
+		float length = nx * nx + ny * ny + nz * nz;
+		if (!(length > 0.f)) return false;
+		length = std::sqrt(length);
+		n[0] = nx / length;
+		n[1] = ny / length;
+		n[2] = nz / length;
+		return true;
+	}
+
+	// store a unit normal n in format at out, valid = false stores the no normal value
+	// oct16 folds the lower hemisphere of the octahedron over the upper one and rounds to 1/127
+	inline void storeNormal(bool valid, float const* n, normalFormat format, uint8_t* out) {
+		if (format == normalFormat::float3) {
+			float v[3] = { valid ? n[0] : 0.f, valid ? n[1] : 0.f, valid ? n[2] : 0.f };
+			memcpy(out, v, sizeof(v));
+			return;
+		}
+		if (!valid) {
+			out[0] = uint8_t(int8_t(-128));
+			out[1] = uint8_t(int8_t(-128));
+			return;
+		}
+		float l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+		float u = n[0] / l1, v = n[1] / l1;
+		if (n[2] < 0.f) {
+			float foldedU = (1.f - std::abs(v)) * std::copysign(1.f, u);
+			float foldedV = (1.f - std::abs(u)) * std::copysign(1.f, v);
+			u = foldedU;
+			v = foldedV;
+		}
+		out[0] = uint8_t(int8_t(std::nearbyint(u * 127.f)));
+		out[1] = uint8_t(int8_t(std::nearbyint(v * 127.f)));
+	}
+
+	// unit normal of an oct16 normal, returns false for the no normal value
+	inline bool decodeOct16(uint8_t const* in, float* n) {
+		int8_t qu = int8_t(in[0]), qv = int8_t(in[1]);
+		if (qu == -128 && qv == -128) return false;
+		float u = qu / 127.f, v = qv / 127.f;
+		float z = 1.f - std::abs(u) - std::abs(v);
+		if (z < 0.f) {
+			float foldedU = (1.f - std::abs(v)) * std::copysign(1.f, u);
+			float foldedV = (1.f - std::abs(u)) * std::copysign(1.f, v);
+			u = foldedU;
+			v = foldedV;
+		}
+		float length = std::sqrt(u * u + v * v + z * z);
+		n[0] = u / length;
+		n[1] = v / length;
+		n[2] = z / length;
+		return true;
+	}
+
+	// normals of one row of the grid into out, normalSize(format) bytes per point. below is the next row or null
+	void gridNormalRowScalar(int16_t const* xyz, int16_t const* below, uint32_t width, normalFormat format, uint8_t* out) {
+		uint32_t size = normalSize(format);
+		for (uint32_t x = 0; x < width; x++) {
+			float n[3];
+			bool valid = gridNormal(xyz, below, width, x, n);
+			storeNormal(valid, n, format, out + uint64_t(x) * size);
+		}
+	}
+
+#ifdef KINECTCLOUD_SSE
+	// pshufb masks which gather the x, y or z of 8 xyz triples spread over 3 registers into one register
+	// indexed by [component][source register]
+	struct deinterleaveTable {
+		__m128i masks[3][3];
+
+		deinterleaveTable() {
+			uint8_t bytes[3][3][16];
+			memset(bytes, 0x80, sizeof(bytes));
+			for (int word = 0; word < 24; word++) {
+				int pixel = word / 3, component = word % 3;
+				bytes[component][word / 8][pixel * 2 + 0] = uint8_t((word % 8) * 2 + 0);
+				bytes[component][word / 8][pixel * 2 + 1] = uint8_t((word % 8) * 2 + 1);
+			}
+			for (int component = 0; component < 3; component++) {
+				for (int src = 0; src < 3; src++) {
+					masks[component][src] = _mm_loadu_si128((__m128i const*)bytes[component][src]);
+				}
+			}
+		}
+	};
+
+	// x, y and z of 8 consecutive xyz triples as floats, [component][half]
+	inline void loadPoints8(int16_t const* xyz, deinterleaveTable const& table, __m128 (&out)[3][2]) {
+		__m128i src[3] = {
+			_mm_loadu_si128((__m128i const*)xyz),
+			_mm_loadu_si128((__m128i const*)(xyz + 8)),
+			_mm_loadu_si128((__m128i const*)(xyz + 16))
+		};
+		for (int c = 0; c < 3; c++) {
+			__m128i words = _mm_or_si128(
+				_mm_or_si128(_mm_shuffle_epi8(src[0], table.masks[c][0]), _mm_shuffle_epi8(src[1], table.masks[c][1])),
+				_mm_shuffle_epi8(src[2], table.masks[c][2])
+			);
+			out[c][0] = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(words));
+			out[c][1] = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(words, 8)));
+		}
+	}
+
+	// same output as gridNormalRowScalar, 8 points at a time with sse4.1
+	void gridNormalRow(int16_t const* xyz, int16_t const* below, uint32_t width, normalFormat format, uint8_t* out) {
+		uint32_t size = normalSize(format);
+		uint32_t x = 0;
+		// the vector loop needs the left and the right neighbour of its 8 points
+		if (below != nullptr && width > 9) {
+			static const deinterleaveTable table;
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.f);
+			const __m128 step = _mm_set1_ps(maxNormalStep);
+			const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+			const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(int32_t(0x80000000)));
+			const __m128 scale = _mm_set1_ps(127.f);
+
+			float first[3];
+			storeNormal(gridNormal(xyz, below, width, 0, first), first, format, out);
+
+			for (x = 1; x + 8 < width; x += 8) {
+				__m128 p[3][2], r[3][2], l[3][2], d[3][2];
+				loadPoints8(xyz + x * 3, table, p);
+				loadPoints8(xyz + (x + 1) * 3, table, r);
+				loadPoints8(xyz + (x - 1) * 3, table, l);
+				loadPoints8(below + x * 3, table, d);
+
+				__m128 n[3][2], valid[2];
+				for (int h = 0; h < 2; h++) {
+					auto present = [&](__m128 const (&q)[3][2]) {
+						return _mm_or_ps(_mm_or_ps(_mm_cmpneq_ps(q[0][h], zero), _mm_cmpneq_ps(q[1][h], zero)), _mm_cmpneq_ps(q[2][h], zero));
+					};
+					__m128 limit = _mm_mul_ps(p[2][h], step);
+					auto usable = [&](__m128 const (&q)[3][2]) {
+						return _mm_and_ps(present(q), _mm_cmple_ps(_mm_and_ps(_mm_sub_ps(q[2][h], p[2][h]), absMask), limit));
+					};
+					__m128 right = usable(r), left = usable(l), down = usable(d);
+
+					__m128 a[3], b[3];
+					for (int c = 0; c < 3; c++) {
+						a[c] = _mm_blendv_ps(_mm_sub_ps(p[c][h], l[c][h]), _mm_sub_ps(r[c][h], p[c][h]), right);
+						b[c] = _mm_sub_ps(d[c][h], p[c][h]);
+					}
+					__m128 nx = _mm_sub_ps(_mm_mul_ps(b[1], a[2]), _mm_mul_ps(b[2], a[1]));
+					__m128 ny = _mm_sub_ps(_mm_mul_ps(b[2], a[0]), _mm_mul_ps(b[0], a[2]));
+					__m128 nz = _mm_sub_ps(_mm_mul_ps(b[0], a[1]), _mm_mul_ps(b[1], a[0]));
+					__m128 length = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+
+					valid[h] = _mm_and_ps(_mm_and_ps(present(p), _mm_or_ps(right, left)), _mm_and_ps(down, _mm_cmpgt_ps(length, zero)));
+					length = _mm_blendv_ps(one, _mm_sqrt_ps(length), valid[h]);
+					n[0][h] = _mm_and_ps(_mm_div_ps(nx, length), valid[h]);
+					n[1][h] = _mm_and_ps(_mm_div_ps(ny, length), valid[h]);
+					n[2][h] = _mm_and_ps(_mm_div_ps(nz, length), valid[h]);
+				}
+
+				if (format == normalFormat::float3) {
+					alignas(16) float lanes[3][8];
+					for (int c = 0; c < 3; c++) {
+						_mm_store_ps(lanes[c], n[c][0]);
+						_mm_store_ps(lanes[c] + 4, n[c][1]);
+					}
+					float* dst = (float*)(out + uint64_t(x) * size);
+					for (int i = 0; i < 8; i++) {
+						float v[3] = { lanes[0][i], lanes[1][i], lanes[2][i] };
+						memcpy(dst + i * 3, v, sizeof(v));
+					}
+					continue;
+				}
+
+				__m128i q[2][2];
+				for (int h = 0; h < 2; h++) {
+					__m128 l1 = _mm_add_ps(_mm_add_ps(_mm_and_ps(n[0][h], absMask), _mm_and_ps(n[1][h], absMask)), _mm_and_ps(n[2][h], absMask));
+					l1 = _mm_blendv_ps(one, l1, valid[h]);
+					__m128 u = _mm_div_ps(n[0][h], l1), v = _mm_div_ps(n[1][h], l1);
+					__m128 foldedU = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(v, absMask)), _mm_or_ps(_mm_and_ps(u, signMask), one));
+					__m128 foldedV = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(u, absMask)), _mm_or_ps(_mm_and_ps(v, signMask), one));
+					__m128 lower = _mm_cmplt_ps(n[2][h], zero);
+					u = _mm_blendv_ps(u, foldedU, lower);
+					v = _mm_blendv_ps(v, foldedV, lower);
+					__m128i none = _mm_set1_epi32(-128);
+					q[0][h] = _mm_blendv_epi8(none, _mm_cvtps_epi32(_mm_mul_ps(u, scale)), _mm_castps_si128(valid[h]));
+					q[1][h] = _mm_blendv_epi8(none, _mm_cvtps_epi32(_mm_mul_ps(v, scale)), _mm_castps_si128(valid[h]));
+				}
+				__m128i u16 = _mm_packs_epi32(q[0][0], q[0][1]), v16 = _mm_packs_epi32(q[1][0], q[1][1]);
+				__m128i uv = _mm_unpacklo_epi8(_mm_packs_epi16(u16, u16), _mm_packs_epi16(v16, v16));
+				_mm_storeu_si128((__m128i*)(out + uint64_t(x) * size), uv);
+			}
+		}
+		for (; x < width; x++) {
+			float n[3];
+			bool valid = gridNormal(xyz, below, width, x, n);
+			storeNormal(valid, n, format, out + uint64_t(x) * size);
+		}
+	}
+#else
+	// normals of one row, without sse4.1 this is gridNormalRowScalar
+	void gridNormalRow(int16_t const* xyz, int16_t const* below, uint32_t width, normalFormat format, uint8_t* out) {
+		gridNormalRowScalar(xyz, below, width, format, out);
+	}
+#endif
+
+	// copy the normals of the points with a non zero xyz to out, in the order compactPoints packs the points
+	// size = bytes of one normal, returns the number of normals
+	uint64_t compactNormals(int16_t const* xyz, uint8_t const* normals, uint32_t size, uint64_t count, uint8_t* out) {
+		uint64_t index = 0;
+		for (uint64_t i = 0; i < count; i++) {
+			if (xyz[i * 3 + 0] != 0 || xyz[i * 3 + 1] != 0 || xyz[i * 3 + 2] != 0) {
+				memcpy(out + index * size, normals + i * size, size);
+				index++;
+			}
+		}
+		return index;
+	}
+
+	// pack every point with a non zero xyz into data as 9 byte points followed by their normal of size bytes
+	// returns the number of points
+	uint64_t compactPointNormals(int16_t const* xyz, uint8_t const* bgra, uint8_t const* normals, uint32_t size, uint64_t count, uint8_t* data) {
+		uint64_t index = 0;
+		const uint64_t recordSize = 9 + size;
+		for (uint64_t i = 0; i < count; i++) {
+			if (xyz[i * 3 + 0] != 0 || xyz[i * 3 + 1] != 0 || xyz[i * 3 + 2] != 0) {
+				uint8_t* record = data + index * recordSize;
+				memcpy(record, xyz + i * 3, sizeof(int16_t) * 3);
+				memcpy(record + 6, bgra + i * 4, sizeof(uint8_t) * 3);
+				memcpy(record + 9, normals + i * size, size);
+				index++;
+			}
+		}
+		return index;
+	}
+
+	// ply header lines of normals in format, comment goes before the vertex element and properties after the point's
+	// oct16 normals are the two octahedral coordinates as signed bytes
+	inline void plyNormalHeader(normalFormat format, std::string& comment, std::string& properties) {
+		comment.clear();
+		properties.clear();
+		if (format == normalFormat::float3) {
+			properties = "property float nx\nproperty float ny\nproperty float nz\n";
+		} else if (format == normalFormat::oct16) {
+			comment = "comment normals octahedral encoded as snorm8, -128 -128 for none\n";
+			properties = "property char nu\nproperty char nv\n";
+		}
+	}
+
+	// pipeline stage which computes the normals of the grid while it is generated and hands them on with the points
+	// the normals of a row are computed as soon as the next row of its band arrives, while both are still in cache.
+	// the last row of a band needs the first row of the next band, so it is computed and handed on in finish
+	// sink must take normals, see sinkTakesNormals
+	template<class Sink>
+	class normalSink {
+		normalFormat _format;
+		Sink& _sink;
+		frameArena* _arena;
+		frameArena _temporary;
+		glm::uvec2 _size = glm::uvec2(0, 0);
+		uint32_t _bands = 0;
+		uint8_t* _normals = nullptr;
+		std::vector<int16_t const*> _xyzRows;
+		std::vector<uint8_t const*> _bgraRows;
+	public:
+		// normals live in the arena if one is given, otherwise in a temporary buffer
+		inline normalSink(normalFormat format, Sink& sink, frameArena* arena = nullptr) :
+			_format(format), _sink(sink), _arena(arena) { }
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			_size = size;
+			_bands = bands;
+			_normals = (_arena ? _arena : &_temporary)->buffer(frameArena::normalSlot, uint64_t(size.x) * size.y * normalSize(_format));
+			_xyzRows.assign(size.y, nullptr);
+			_bgraRows.assign(size.y, nullptr);
+			_sink.begin(size, bands);
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			_xyzRows[y] = xyz;
+			_bgraRows[y] = bgra;
+			if (y > rowBandStart(_size.y, _bands, band)) handOn(band, y - 1, xyz);
+		}
+
+		inline void finish() {
+			for (uint32_t b = 0; b < _bands; b++) {
+				uint32_t next = rowBandStart(_size.y, _bands, b + 1);
+				if (next == rowBandStart(_size.y, _bands, b)) continue;
+				handOn(b, next - 1, next < _size.y ? _xyzRows[next] : nullptr);
+			}
+			_sink.finish();
+		}
+
+	private:
+
+		inline void handOn(uint32_t band, uint32_t y, int16_t const* below) {
+			uint8_t* normals = _normals + uint64_t(y) * _size.x * normalSize(_format);
+			gridNormalRow(_xyzRows[y], below, _size.x, _format, normals);
+			_sink.row(band, y, _xyzRows[y], _bgraRows[y], normals, _size.x);
+		}
+	};
+}
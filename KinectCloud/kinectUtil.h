@@ -1,10 +1,13 @@
 #pragma once
 
 #include <map>
+#include <cmath>
+#include <limits>
 #include <k4a/k4a.h>
 #include <nlohmann/json.hpp>
 
 #include "util.h"
+#include "frameArena.h"
 
 namespace kinectCloud {
 	using json = nlohmann::json;
@@ -84,96 +87,510 @@ namespace kinectCloud {
 		return glm::uvec2(0, 0);
 	}
 
-	// save existing xyz image as pts file
-	void savePointCloud(glm::uvec2 size, k4a_image_t xyzImg, k4a_image_t colorImg, std::string const& loc) {
-		uint32_t resWidth = size.x, resHeight = size.y;
-		uint32_t colorStride = resWidth * sizeof(uint8_t) * 4;
-		uint32_t xyzStride = resWidth * sizeof(int16_t) * 3;
-
-		std::vector<char> bytes;
-		bytes.resize(resWidth * resHeight * (7 * 3 + 4 * 3));
-		char* current = bytes.data();
-
-		uint8_t* rawData = k4a_image_get_buffer(xyzImg);
-		auto a = k4a_image_get_stride_bytes(colorImg);
-		auto b = k4a_image_get_size(colorImg);
-		uint8_t* colorData = k4a_image_get_buffer(colorImg);
-
-		for (int y = 0; y < resHeight; y++) {
-			for (int x = 0; x < resWidth; x++) {
-				int16_t px = *(int16_t*)(rawData + y * xyzStride + x * 6 + 0);
-				int16_t py = *(int16_t*)(rawData + y * xyzStride + x * 6 + 2);
-				int16_t pz = *(int16_t*)(rawData + y * xyzStride + x * 6 + 4);
-				uint8_t pr = *(colorData + y * colorStride + x * 4 + 0);
-				uint8_t pg = *(colorData + y * colorStride + x * 4 + 1);
-				uint8_t pb = *(colorData + y * colorStride + x * 4 + 2);
-				uint8_t pa = *(colorData + y * colorStride + x * 4 + 3);
-				if (px != 0 || py != 0 || pz != 0) {
-					current = fastCopyInt16Str(current, px);
-					*current = ' '; current++;
-					current = fastCopyInt16Str(current, py);
-					*current = ' '; current++;
-					current = fastCopyInt16Str(current, pz);
-					*current = ' '; current++;
-					current = fastCopyInt16Str(current, pb);
-					*current = ' '; current++;
-					current = fastCopyInt16Str(current, pg);
-					*current = ' '; current++;
-					current = fastCopyInt16Str(current, pr);
-					//*current = ' '; current++;
-					//current = fastCopyInt16Str(current, pa);
-					*current = '\n'; current++;
+	// longest pts line, 3 int16 and 3 uint8 with separators
+	constexpr size_t maxPointText = 7 * 3 + 4 * 3;
+
+	// format one row of xyz and color as pts text starting at current, returns the end of the text
+	// current must hold maxPointText for every pixel of the row
+	inline char* formatPointRow(char* current, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+		for (uint32_t x = 0; x < width; x++) {
+			int16_t px = xyz[x * 3 + 0];
+			int16_t py = xyz[x * 3 + 1];
+			int16_t pz = xyz[x * 3 + 2];
+			uint8_t pr = bgra[x * 4 + 0];
+			uint8_t pg = bgra[x * 4 + 1];
+			uint8_t pb = bgra[x * 4 + 2];
+			uint8_t pa = bgra[x * 4 + 3];
+			if (px != 0 || py != 0 || pz != 0) {
+				current = fastCopyInt16Str(current, px);
+				*current = ' '; current++;
+				current = fastCopyInt16Str(current, py);
+				*current = ' '; current++;
+				current = fastCopyInt16Str(current, pz);
+				*current = ' '; current++;
+				current = fastCopyInt16Str(current, pb);
+				*current = ' '; current++;
+				current = fastCopyInt16Str(current, pg);
+				*current = ' '; current++;
+				current = fastCopyInt16Str(current, pr);
+				//*current = ' '; current++;
+				//current = fastCopyInt16Str(current, pa);
+				*current = '\n'; current++;
+			}
+		}
+		return current;
+	}
+
+	// pack every pixel with a non zero xyz into data as 9 byte points, returns number of points
+	// xyz holds 3 int16 per pixel, bgra holds 4 uint8 per pixel
+	uint64_t compactPointsScalar(int16_t const* xyz, uint8_t const* bgra, uint64_t count, uint8_t* data) {
+		uint64_t index = 0;
+		const uint64_t pointSize = sizeof(int16_t) * 3 + sizeof(uint8_t) * 3; // xyz + rgb
+		for (uint64_t i = 0; i < count; i++) {
+			int16_t px = xyz[i * 3 + 0];
+			int16_t py = xyz[i * 3 + 1];
+			int16_t pz = xyz[i * 3 + 2];
+
+			if (px != 0 || py != 0 || pz != 0) {
+				uint8_t* dataStart = (data + (index * pointSize));
+				memcpy(dataStart, xyz + i * 3, sizeof(int16_t) * 3);
+				memcpy(dataStart + 6, bgra + i * 4, sizeof(uint8_t) * 3);
+				index++;
+			}
+		}
+		return index;
+	}
+
+#ifdef KINECTCLOUD_SSE
+	// pshufb masks which pack the valid pixels of a 4 pixel block into consecutive 9 byte points
+	// indexed by [validity mask][output register][source register], sources are xyz bytes 0-15, xyz bytes 16-23, bgra
+	struct compactionTable {
+		__m128i masks[16][3][3];
+		uint8_t counts[16];
+
+		compactionTable() {
+			for (int valid = 0; valid < 16; valid++) {
+				uint8_t bytes[3][3][16];
+				memset(bytes, 0x80, sizeof(bytes));
+				int n = 0;
+				for (int p = 0; p < 4; p++) {
+					if (!(valid & (1 << p))) continue;
+					for (int o = 0; o < 9; o++) {
+						int dst = n * 9 + o;
+						int src = (o < 6) ? ((p * 6 + o) / 16) : 2;
+						int srcByte = (o < 6) ? ((p * 6 + o) % 16) : (p * 4 + o - 6);
+						bytes[dst / 16][src][dst % 16] = srcByte;
+					}
+					n++;
+				}
+				counts[valid] = n;
+				for (int out = 0; out < 3; out++) {
+					for (int src = 0; src < 3; src++) {
+						masks[valid][out][src] = _mm_loadu_si128((__m128i const*)bytes[out][src]);
+					}
 				}
 			}
 		}
-		FILE* fout = fopen(loc.c_str(), "wb");
-		fwrite(bytes.data(), 1, (current - bytes.data()), fout);
-		fclose(fout);
+	};
+#endif
+
+	// same output as compactPointsScalar
+	// blocks of 4 pixels are tested and packed with shuffles, every block stores 48 bytes
+	// and advances by the number of valid points, the last pixels always take the scalar
+	// path so nothing past count * 9 bytes of data is ever written
+	uint64_t compactPoints(int16_t const* xyz, uint8_t const* bgra, uint64_t count, uint8_t* data) {
+		uint64_t index = 0;
+		uint64_t i = 0;
+#ifdef KINECTCLOUD_SSE
+		static const compactionTable table;
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 8 <= count; i += 4) {
+			__m128i xyzLow = _mm_loadu_si128((__m128i const*)(xyz + i * 3));
+			__m128i xyzHigh = _mm_loadl_epi64((__m128i const*)(xyz + i * 3 + 8));
+			__m128i color = _mm_loadu_si128((__m128i const*)(bgra + i * 4));
+
+			// 2 bits per int16, 6 bits per pixel, a pixel is invalid if all 6 are set
+			uint32_t zeros =
+				(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(xyzLow, zero)) |
+				(((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(xyzHigh, zero)) & 0xFF) << 16);
+			uint32_t valid =
+				(((zeros >> 0) & 0x3F) != 0x3F) << 0 |
+				(((zeros >> 6) & 0x3F) != 0x3F) << 1 |
+				(((zeros >> 12) & 0x3F) != 0x3F) << 2 |
+				(((zeros >> 18) & 0x3F) != 0x3F) << 3;
+			if (!valid) continue;
+
+			// the third register only ever holds the end of the fourth point, which never comes from the first xyz register
+			__m128i const (*masks)[3] = table.masks[valid];
+			uint8_t* dataStart = data + index * 9;
+			for (int out = 0; out < 2; out++) {
+				__m128i packed = _mm_or_si128(
+					_mm_or_si128(_mm_shuffle_epi8(xyzLow, masks[out][0]), _mm_shuffle_epi8(xyzHigh, masks[out][1])),
+					_mm_shuffle_epi8(color, masks[out][2])
+				);
+				_mm_storeu_si128((__m128i*)(dataStart + out * 16), packed);
+			}
+			_mm_storeu_si128((__m128i*)(dataStart + 32), _mm_or_si128(_mm_shuffle_epi8(xyzHigh, masks[2][1]), _mm_shuffle_epi8(color, masks[2][2])));
+			index += table.counts[valid];
+		}
+#endif
+		return index + compactPointsScalar(xyz + i * 3, bgra + i * 4, count - i, data + index * 9);
 	}
 
-	// save existing xyz and color image in data block
-	uint64_t savePointCloudRaw(glm::uvec2 size, k4a_image_t xyzImg, k4a_image_t colorImg, uint8_t* data) {
-		uint32_t resWidth = size.x, resHeight = size.y;
-		uint32_t colorStride = resWidth * sizeof(uint8_t) * 4;
-		uint32_t xyzStride = resWidth * sizeof(int16_t) * 3;
+	// rectangle of pixels, min inclusive, max exclusive
+	struct pixelRect {
+		glm::uvec2 min = glm::uvec2(0, 0);
+		glm::uvec2 max = glm::uvec2(0, 0);
 
-		std::vector<char> bytes;
-		bytes.resize(resWidth * resHeight * (7 * 3 + 4 * 3));
-		char* current = bytes.data();
+		inline uint32_t width() const {
+			return max.x > min.x ? max.x - min.x : 0;
+		}
 
-		uint8_t* rawData = k4a_image_get_buffer(xyzImg);
-		auto a = k4a_image_get_stride_bytes(colorImg);
-		auto b = k4a_image_get_size(colorImg);
-		uint8_t* colorData = k4a_image_get_buffer(colorImg);
+		inline uint32_t height() const {
+			return max.y > min.y ? max.y - min.y : 0;
+		}
+	};
 
-		uint64_t index = 0;
-		const uint64_t pointSize = sizeof(int16_t) * 3 + sizeof(uint8_t) * 3; // xyz + rgb
-		for (int y = 0; y < resHeight; y++) {
-			for (int x = 0; x < resWidth; x++) {
-				int16_t px = *(int16_t*)(rawData + y * xyzStride + x * 6 + 0);
-				int16_t py = *(int16_t*)(rawData + y * xyzStride + x * 6 + 2);
-				int16_t pz = *(int16_t*)(rawData + y * xyzStride + x * 6 + 4);
-				uint8_t pr = *(colorData + y * colorStride + x * 4 + 0);
-				uint8_t pg = *(colorData + y * colorStride + x * 4 + 1);
-				uint8_t pb = *(colorData + y * colorStride + x * 4 + 2);
-				uint8_t pa = *(colorData + y * colorStride + x * 4 + 3);
-
-				if (px != 0 || py != 0 || pz != 0) {
-					uint8_t* dataStart = (data + (index * pointSize));
-					*(((int16_t*)dataStart) + 0) = px;
-					*(((int16_t*)dataStart) + 1) = py;
-					*(((int16_t*)dataStart) + 2) = pz;
-
-					*(dataStart + 6) = pr;
-					*(dataStart + 7) = pg;
-					*(dataStart + 8) = pb;
-
-					index++;
+	// unit rays (x / z, y / z) for every pixel of one camera, row major
+	// pixels that can't be unprojected hold NaN
+	struct rayTable {
+		glm::uvec2 size;
+		std::vector<float> x, y;
+	};
+
+	// unproject every pixel of the given camera at a depth of 1mm, rows are split across threads
+	// only needs to be done once per calibration
+	rayTable createRayTable(k4a_calibration_t const& cali, k4a_calibration_type_t camera) {
+		k4a_calibration_camera_t const& cam = (camera == K4A_CALIBRATION_TYPE_COLOR) ? cali.color_camera_calibration : cali.depth_camera_calibration;
+		rayTable res;
+		res.size = glm::uvec2(cam.resolution_width, cam.resolution_height);
+		res.x.resize(uint64_t(res.size.x) * res.size.y);
+		res.y.resize(uint64_t(res.size.x) * res.size.y);
+
+		auto buildRows = [&](uint32_t firstRow, uint32_t lastRow) {
+			for (uint32_t y = firstRow; y < lastRow; y++) {
+				for (uint32_t x = 0; x < res.size.x; x++) {
+					uint64_t i = uint64_t(y) * res.size.x + x;
+					k4a_float2_t pixel;
+					pixel.xy.x = float(x);
+					pixel.xy.y = float(y);
+					k4a_float3_t ray;
+					int valid = 0;
+					if (K4A_RESULT_SUCCEEDED == k4a_calibration_2d_to_3d(&cali, &pixel, 1.f, camera, camera, &ray, &valid) && valid) {
+						res.x[i] = ray.xyz.x;
+						res.y[i] = ray.xyz.y;
+					} else {
+						res.x[i] = std::numeric_limits<float>::quiet_NaN();
+						res.y[i] = std::numeric_limits<float>::quiet_NaN();
+					}
 				}
 			}
+		};
+
+		uint32_t threads = std::max(1u, std::min(std::thread::hardware_concurrency(), res.size.y));
+		std::vector<std::thread> workers;
+		for (uint32_t t = 1; t < threads; t++) {
+			workers.emplace_back(buildRows, res.size.y * t / threads, res.size.y * (t + 1) / threads);
+		}
+		buildRows(0, res.size.y / threads);
+		for (auto& worker : workers) {
+			worker.join();
 		}
 
-		return index;
+		return res;
+	}
+
+#ifdef KINECTCLOUD_SSE
+	// pshufb masks which interleave 8 x, 8 y and 8 z int16 into 3 registers of xyz triples
+	// indexed by [output register][source register]
+	struct interleaveTable {
+		__m128i masks[3][3];
+
+		interleaveTable() {
+			uint8_t bytes[3][3][16];
+			memset(bytes, 0x80, sizeof(bytes));
+			for (int word = 0; word < 24; word++) {
+				int pixel = word / 3, component = word % 3;
+				bytes[word / 8][component][(word % 8) * 2 + 0] = pixel * 2 + 0;
+				bytes[word / 8][component][(word % 8) * 2 + 1] = pixel * 2 + 1;
+			}
+			for (int out = 0; out < 3; out++) {
+				for (int src = 0; src < 3; src++) {
+					masks[out][src] = _mm_loadu_si128((__m128i const*)bytes[out][src]);
+				}
+			}
+		}
+	};
+
+	// round to nearest (floor(v + 0.5)) and truncate to int16 like a c cast, 8 lanes from 2 registers
+	inline __m128i roundToInt16(__m128 low, __m128 high) {
+		const __m128 half = _mm_set1_ps(0.5f);
+		__m128i lowInt = _mm_cvttps_epi32(_mm_floor_ps(_mm_add_ps(low, half)));
+		__m128i highInt = _mm_cvttps_epi32(_mm_floor_ps(_mm_add_ps(high, half)));
+		return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lowInt, 16), 16), _mm_srai_epi32(_mm_slli_epi32(highInt, 16), 16));
+	}
+#endif
+
+	// xyz = depth * ray for count pixels starting at pixel first of the ray table, same rounding as the sdk point cloud transform
+	// depth and xyz point at the first pixel to convert, pixels with a NaN ray become (0, 0, 0)
+	void depthToXyz(rayTable const& rays, uint16_t const* depth, int16_t* xyz, uint64_t first, uint64_t count) {
+		float const* rayX = rays.x.data() + first;
+		float const* rayY = rays.y.data() + first;
+
+		uint64_t i = 0;
+#ifdef KINECTCLOUD_SSE
+		static const interleaveTable table;
+		for (; i + 8 <= count; i += 8) {
+			__m128i depth16 = _mm_loadu_si128((__m128i const*)(depth + i));
+			__m128 depthLow = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(depth16));
+			__m128 depthHigh = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(depth16, 8)));
+			__m128 xLow = _mm_loadu_ps(rayX + i), xHigh = _mm_loadu_ps(rayX + i + 4);
+			__m128 yLow = _mm_loadu_ps(rayY + i), yHigh = _mm_loadu_ps(rayY + i + 4);
+
+			__m128i valid = _mm_packs_epi32(_mm_castps_si128(_mm_cmpord_ps(xLow, xLow)), _mm_castps_si128(_mm_cmpord_ps(xHigh, xHigh)));
+			__m128i px = _mm_and_si128(valid, roundToInt16(_mm_mul_ps(xLow, depthLow), _mm_mul_ps(xHigh, depthHigh)));
+			__m128i py = _mm_and_si128(valid, roundToInt16(_mm_mul_ps(yLow, depthLow), _mm_mul_ps(yHigh, depthHigh)));
+			__m128i pz = _mm_and_si128(valid, depth16);
+
+			for (int out = 0; out < 3; out++) {
+				__m128i packed = _mm_or_si128(
+					_mm_or_si128(_mm_shuffle_epi8(px, table.masks[out][0]), _mm_shuffle_epi8(py, table.masks[out][1])),
+					_mm_shuffle_epi8(pz, table.masks[out][2])
+				);
+				_mm_storeu_si128((__m128i*)(xyz + i * 3 + out * 8), packed);
+			}
+		}
+#endif
+		for (; i < count; i++) {
+			if (!std::isnan(rayX[i])) {
+				float z = float(depth[i]);
+				xyz[i * 3 + 0] = int16_t(std::floor(rayX[i] * z + 0.5f));
+				xyz[i * 3 + 1] = int16_t(std::floor(rayY[i] * z + 0.5f));
+				xyz[i * 3 + 2] = int16_t(depth[i]);
+			} else {
+				xyz[i * 3 + 0] = 0;
+				xyz[i * 3 + 1] = 0;
+				xyz[i * 3 + 2] = 0;
+			}
+		}
+	}
+
+	// fill an xyz image (3 int16 per pixel) from a depth16 image in the geometry of the ray table
+	// replaces k4a_transformation_depth_image_to_point_cloud
+	void depthImageToXyz(rayTable const& rays, k4a_image_t depthImg, k4a_image_t xyzImg) {
+		if (uint32_t(k4a_image_get_width_pixels(depthImg)) != rays.size.x || uint32_t(k4a_image_get_height_pixels(depthImg)) != rays.size.y) {
+			throw std::runtime_error("depth image does not match ray table");
+		}
+		uint16_t* depthData = (uint16_t*)k4a_image_get_buffer(depthImg);
+		int16_t* xyzData = (int16_t*)k4a_image_get_buffer(xyzImg);
+		depthToXyz(rays, depthData, xyzData, 0, uint64_t(rays.size.x) * rays.size.y);
+	}
+
+	// which camera's pixel grid a point cloud is generated on
+	enum class cloudSpace {
+		color,	// depth mapped into the color camera, one point per color pixel
+		depth,	// color mapped into the depth camera, one point per depth pixel, xyz in depth camera coordinates
+	};
+
+	// parse cloud space from string (not case sensitive), returns false if unknown
+	bool cloudSpaceFromString(std::string str, cloudSpace& space) {
+		str = stringToUppercase(str);
+		if (str == "COLOR") {
+			space = cloudSpace::color;
+		} else if (str == "DEPTH") {
+			space = cloudSpace::depth;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	std::string cloudSpaceToString(cloudSpace space) {
+		return space == cloudSpace::depth ? "depth" : "color";
+	}
+
+	// file format point clouds are saved in
+	enum class cloudFormat {
+		pts,	// text, one "x y z r g b" line per point
+		ply,	// binary little endian ply, 9 bytes per point
+		octree,	// octree compressed, see octreeCodec.h
+		mesh,	// binary little endian ply with the triangles between neighbouring pixels, see gridMesh.h
+	};
+
+	// parse cloud format from string (not case sensitive), returns false if unknown
+	bool cloudFormatFromString(std::string str, cloudFormat& format) {
+		str = stringToUppercase(str);
+		if (str == "PTS") {
+			format = cloudFormat::pts;
+		} else if (str == "PLY") {
+			format = cloudFormat::ply;
+		} else if (str == "OCT") {
+			format = cloudFormat::octree;
+		} else if (str == "MESH") {
+			format = cloudFormat::mesh;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	std::string cloudFormatToString(cloudFormat format) {
+		if (format == cloudFormat::ply) return "ply";
+		if (format == cloudFormat::octree) return "oct";
+		if (format == cloudFormat::mesh) return "mesh";
+		return "pts";
+	}
+
+	// file extension of format, without the dot
+	std::string cloudFormatExtension(cloudFormat format) {
+		return format == cloudFormat::mesh ? "ply" : cloudFormatToString(format);
+	}
+
+	// where the point of a voxel sits when downsampling, its color is always the average of the voxel's points
+	enum class voxelMode {
+		centroid,	// average of the voxel's points
+		first,		// first point of the voxel in row order
+	};
+
+	// parse voxel mode from string (not case sensitive), returns false if unknown
+	bool voxelModeFromString(std::string str, voxelMode& mode) {
+		str = stringToUppercase(str);
+		if (str == "CENTROID") {
+			mode = voxelMode::centroid;
+		} else if (str == "FIRST") {
+			mode = voxelMode::first;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	// how depth is smoothed over consecutive frames, see temporalFilter
+	enum class temporalMode {
+		off,
+		ema,	// exponential moving average
+		median,	// median of the last frames
+	};
+
+	// parse temporal mode from string (not case sensitive), returns false if unknown
+	bool temporalModeFromString(std::string str, temporalMode& mode) {
+		str = stringToUppercase(str);
+		if (str == "OFF") {
+			mode = temporalMode::off;
+		} else if (str == "EMA") {
+			mode = temporalMode::ema;
+		} else if (str == "MEDIAN") {
+			mode = temporalMode::median;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	std::string temporalModeToString(temporalMode mode) {
+		return mode == temporalMode::ema ? "ema" : (mode == temporalMode::median ? "median" : "off");
+	}
+
+	// per point normals of a cloud, see gridNormals.h
+	enum class normalFormat {
+		off,
+		oct16,	// octahedral encoding, 2 snorm8 (u v), (-128, -128) => no normal
+		float3,	// 3 floats (x y z), (0, 0, 0) => no normal
+	};
+
+	// parse normal format from string (not case sensitive), returns false if unknown
+	bool normalFormatFromString(std::string str, normalFormat& format) {
+		str = stringToUppercase(str);
+		if (str == "OFF") {
+			format = normalFormat::off;
+		} else if (str == "OCT16") {
+			format = normalFormat::oct16;
+		} else if (str == "FLOAT3") {
+			format = normalFormat::float3;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	// name of format as accepted by normalFormatFromString
+	std::string normalFormatToString(normalFormat format) {
+		return format == normalFormat::oct16 ? "oct16" : (format == normalFormat::float3 ? "float3" : "off");
+	}
+
+	// bytes of one normal in format
+	inline uint32_t normalSize(normalFormat format) {
+		return format == normalFormat::oct16 ? 2 : (format == normalFormat::float3 ? 12 : 0);
+	}
+
+	// region of space points are kept in, in mm in the camera coordinates of the cloud's space (see cloudSpace)
+	// the pipeline only looks at the depth pixels which can reach the region, then drops every point outside it
+	struct cloudCrop {
+		glm::ivec3 min = glm::ivec3(-32768, -32768, -32768);	// axis aligned box, inclusive
+		glm::ivec3 max = glm::ivec3(32767, 32767, 32767);
+		float minRange = 0.f;	// distance from the camera
+		float maxRange = 0.f;	// 0 => unlimited
+
+		// true if the crop can drop any point
+		inline bool enabled() const {
+			return min.x > -32768 || min.y > -32768 || min.z > -32768 || max.x < 32767 || max.y < 32767 || max.z < 32767 || minRange > 0.f || maxRange > 0.f;
+		}
+
+		inline bool operator==(cloudCrop const& other) const {
+			return min.x == other.min.x && min.y == other.min.y && min.z == other.min.z &&
+				max.x == other.max.x && max.y == other.max.y && max.z == other.max.z &&
+				minRange == other.minRange && maxRange == other.maxRange;
+		}
+	};
+
+	class fileOutput;
+
+	// options for turning a capture into a point cloud
+	struct cloudOptions {
+		cloudSpace space = cloudSpace::color;
+		cloudFormat format = cloudFormat::pts; // file format used when saving
+		fileOutput* output = nullptr; // backend files are written with, see fileOutput.h. null => synchronous stdio
+		int leafSize = 1; // edge of an octree leaf in mm for the octree format, 1 keeps every coordinate
+		int voxelSize = 0; // edge of a voxel in mm to downsample to, 0 => every point, see voxelGrid.h
+		voxelMode voxels = voxelMode::centroid; // position of the point of a voxel
+		int outlierRadius = 0; // window radius in pixels of statistical outlier removal, 0 => off, see gridFilters.h
+		float outlierDeviations = 1.f; // standard deviations above the mean neighbour distance which are kept
+		float flyingPixelJump = 0.f; // depth jump to a neighbour, relative to depth, above which a depth pixel is dropped. 0 => off
+		temporalMode temporal = temporalMode::off; // smoothing of depth over consecutive frames, see temporalFilter
+		float temporalWeight = 0.3f; // weight of the new frame in the moving average
+		int temporalFrames = 5; // frames the median is taken over
+		float temporalReset = 0.05f; // depth change relative to depth which counts as motion and restarts a pixel's history
+		cloudCrop crop; // region points are kept in, see cropRegion.h
+		normalFormat normals = normalFormat::off; // per point normals from the organized grid, for ply files, meshes and raw blobs
+		float meshJump = 0.05f; // largest depth difference within a mesh triangle, relative to its nearest corner
+		int threads = int(std::max(1u, std::thread::hardware_concurrency())); // threads used to generate and format point clouds
+	};
+
+	// zero the xyz of points which received no color
+	// k4a_transformation_color_image_to_depth_camera leaves pixels outside the color camera as bgra 0
+	void dropUncoloredPoints(int16_t* xyz, uint8_t const* bgra, uint64_t count) {
+		for (uint64_t i = 0; i < count; i++) {
+			if (bgra[i * 4 + 3] == 0) {
+				xyz[i * 3 + 0] = 0;
+				xyz[i * 3 + 1] = 0;
+				xyz[i * 3 + 2] = 0;
+			}
+		}
+	}
+
+	// point cloud on the native depth grid, color is sampled from the color camera for every depth pixel
+	// depthRays must be the ray table of the depth camera, colorImg must be bgra32
+	// on success xyzImg and mappedColorImg are depth sized images in the arena which the caller releases
+	// only the pixels of rect are unprojected, xyz outside it is left undefined
+	void createDepthSpaceCloud(k4a_transformation_t transform, rayTable const& depthRays, frameArena& arena, k4a_image_t depthImg, k4a_image_t colorImg, pixelRect const& rect, k4a_image_t& xyzImg, k4a_image_t& mappedColorImg) {
+		glm::uvec2 size = depthRays.size;
+		xyzImg = nullptr;
+		mappedColorImg = nullptr;
+
+		if (K4A_RESULT_SUCCEEDED != arena.createImage(frameArena::mappedColorSlot, K4A_IMAGE_FORMAT_COLOR_BGRA32, size.x, size.y, size.x * sizeof(uint8_t) * 4, &mappedColorImg)) {
+			throw std::runtime_error("failed to create mapped color image");
+		}
+
+		if (K4A_RESULT_SUCCEEDED != k4a_transformation_color_image_to_depth_camera(transform, depthImg, colorImg, mappedColorImg)) {
+			k4a_image_release(mappedColorImg);
+			mappedColorImg = nullptr;
+			throw std::runtime_error("failed to transform color image to depth image space");
+		}
+
+		if (K4A_RESULT_SUCCEEDED != arena.createImage(frameArena::xyzSlot, K4A_IMAGE_FORMAT_CUSTOM, size.x, size.y, size.x * sizeof(int16_t) * 3, &xyzImg)) {
+			k4a_image_release(mappedColorImg);
+			mappedColorImg = nullptr;
+			throw std::runtime_error("failed to create point cloud image");
+		}
+
+		uint16_t const* depth = (uint16_t const*)k4a_image_get_buffer(depthImg);
+		int16_t* xyz = (int16_t*)k4a_image_get_buffer(xyzImg);
+		uint8_t const* bgra = k4a_image_get_buffer(mappedColorImg);
+		for (uint32_t y = rect.min.y; y < rect.max.y; y++) {
+			uint64_t first = uint64_t(y) * size.x + rect.min.x;
+			depthToXyz(depthRays, depth + first, xyz + first * 3, first, rect.width());
+			dropUncoloredPoints(xyz + first * 3, bgra + first * 4, rect.width());
+		}
 	}
 
 #if KINECTCLOUD_EXPERIMENTAL
@@ -285,67 +702,5 @@ namespace kinectCloud {
 		}
 		return res;
 	}
-
-	// load color image, load depth image, then convert into point cloud and save as pts file
-	// colorLoc = input color path
-	// depthLoc = input depth path
-	// expLoc   = output pts path
-	// conf     = config from the device which produced the color and depth images
-	void transformImage(std::string colorLoc, std::string depthLoc, std::string expLoc, deviceConfig const& conf) {
-		k4a_image_t colorImg = loadPNGtoK4A(colorLoc);
-		k4a_image_t depthImg = loadPNGtoK4A(depthLoc);
-		k4a_image_t transformedDepthImg = nullptr;
-		k4a_image_t xyzImg = nullptr;
-
-		try {
-			if (colorImg == nullptr) throw std::runtime_error("failed to load color image");
-
-			if (depthImg == nullptr) throw std::runtime_error("failed to load depth image");
-
-			if (K4A_RESULT_SUCCEEDED != k4a_image_create(
-				K4A_IMAGE_FORMAT_DEPTH16,
-				conf.colorRes.x,
-				conf.colorRes.y,
-				conf.colorRes.x * sizeof(int16_t),
-				&transformedDepthImg)) {
-				throw std::runtime_error("failed to create transformed depth image");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_color_camera(
-				conf.trans,
-				depthImg,
-				transformedDepthImg
-			)) {
-				throw std::runtime_error("failed to transform depth image to color image space");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_image_create(
-				K4A_IMAGE_FORMAT_CUSTOM,
-				conf.colorRes.x,
-				conf.colorRes.y,
-				conf.colorRes.x * sizeof(int16_t) * 3,
-				&xyzImg)) {
-				throw std::runtime_error("failed to create xyz image");
-			}
-
-			if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_point_cloud(
-				conf.trans,
-				transformedDepthImg,
-				K4A_CALIBRATION_TYPE_COLOR,
-				xyzImg
-			)) {
-				throw std::runtime_error("failed to transform mapped depth to point cloud image");
-			}
-
-			savePointCloud(conf.colorRes, xyzImg, colorImg, expLoc);
-		} catch (std::runtime_error const& er) {
-			std::cout << er.what() << "\n";
-		}
-
-		if (colorImg) k4a_image_release(colorImg);
-		if (depthImg) k4a_image_release(depthImg);
-		if (transformedDepthImg) k4a_image_release(transformedDepthImg);
-		if (xyzImg) k4a_image_release(xyzImg);
-	}
 #endif
 }
\ No newline at end of file
@@ -0,0 +1,691 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+
+#include "cloudCodec.h"
+#include "util.h"
+
+namespace kinectCloud {
+	// octree compressed point cloud for archiving, in the spirit of mpeg g-pcc and draco
+	// positions are snapped to cubic leaves of leafSize mm and coded as the occupancy bytes of an octree, breadth first
+	// with the neighbours of a node as context. colors are coded in octree order as the difference to the mean color
+	// of the preceding points, which are their spatial neighbours. points come back in octree order
+	//[char[4] "KCO1"][uint64 numPoints][uint16 leafSize][int16 min x][int16 min y][int16 min z][uint8 depth][uint8 splitLevel]
+	//[uint32 numSubtrees][uint32 numTopBytes][top stream]([uint32 numBytes][uint32 numPoints]) * numSubtrees[subtree streams]
+	//[3 rans streams of b g r residuals, see ransEncode]
+	// the top stream codes the 3 levels above splitLevel = depth - 3, every node at splitLevel is the root of a subtree
+	// with its own stream and models, which codes its levels and then the points per leaf, so subtrees are encoded
+	// and decoded in parallel. all values are little endian
+
+	// adaptive binary range coder, the lzma design: 11 bit probabilities which adapt by 1/16 of the error
+	constexpr uint32_t rangeProbBits = 11;
+	constexpr uint16_t rangeProbInit = 1 << (rangeProbBits - 1);
+	constexpr uint32_t rangeTop = 1u << 24;
+
+	class rangeEncoder {
+		std::vector<uint8_t>& _out;
+		uint64_t _low = 0;
+		uint32_t _range = 0xFFFFFFFF;
+		uint8_t _cache = 0;
+		uint64_t _cacheSize = 1;
+	public:
+		// bytes are appended to out
+		inline rangeEncoder(std::vector<uint8_t>& out) : _out(out) { }
+
+		// code bit with probability prob (of a 0) and adapt prob
+		inline void bit(uint16_t& prob, uint32_t bit) {
+			uint32_t bound = (_range >> rangeProbBits) * prob;
+			if (bit == 0) {
+				_range = bound;
+				prob += ((1 << rangeProbBits) - prob) >> 4;
+			} else {
+				_low += bound;
+				_range -= bound;
+				prob -= prob >> 4;
+			}
+			while (_range < rangeTop) {
+				_range <<= 8;
+				shiftLow();
+			}
+		}
+
+		// code the low bits of value without a model
+		inline void direct(uint32_t value, int bits) {
+			for (int i = bits - 1; i >= 0; i--) {
+				_range >>= 1;
+				if ((value >> i) & 1) _low += _range;
+				while (_range < rangeTop) {
+					_range <<= 8;
+					shiftLow();
+				}
+			}
+		}
+
+		// code a byte as a binary tree of bits, probs holds 256 models
+		inline void byte(uint16_t* probs, uint32_t value) {
+			uint32_t node = 1;
+			for (int i = 7; i >= 0; i--) {
+				uint32_t b = (value >> i) & 1;
+				bit(probs[node], b);
+				node = (node << 1) | b;
+			}
+		}
+
+		// write out the remaining state
+		inline void finish() {
+			for (int i = 0; i < 5; i++) shiftLow();
+		}
+
+	private:
+
+		inline void shiftLow() {
+			if (uint32_t(_low) < 0xFF000000u || (_low >> 32) != 0) {
+				uint8_t carry = uint8_t(_low >> 32);
+				uint8_t temp = _cache;
+				do {
+					_out.push_back(uint8_t(temp + carry));
+					temp = 0xFF;
+				} while (--_cacheSize != 0);
+				_cache = uint8_t(_low >> 24);
+			}
+			_cacheSize++;
+			_low = (_low & 0x00FFFFFF) << 8;
+		}
+	};
+
+	class rangeDecoder {
+		uint8_t const* _in;
+		uint8_t const* _end;
+		uint32_t _code = 0;
+		uint32_t _range = 0xFFFFFFFF;
+	public:
+		// reading past the end yields zero bytes, so corrupt data decodes to garbage but never reads out of bounds
+		inline rangeDecoder(uint8_t const* in, size_t size) : _in(in), _end(in + size) {
+			for (int i = 0; i < 5; i++) _code = (_code << 8) | next();
+		}
+
+		inline uint32_t bit(uint16_t& prob) {
+			uint32_t bound = (_range >> rangeProbBits) * prob;
+			uint32_t res;
+			if (_code < bound) {
+				_range = bound;
+				prob += ((1 << rangeProbBits) - prob) >> 4;
+				res = 0;
+			} else {
+				_code -= bound;
+				_range -= bound;
+				prob -= prob >> 4;
+				res = 1;
+			}
+			while (_range < rangeTop) {
+				_range <<= 8;
+				_code = (_code << 8) | next();
+			}
+			return res;
+		}
+
+		inline uint32_t direct(int bits) {
+			uint32_t res = 0;
+			for (int i = 0; i < bits; i++) {
+				_range >>= 1;
+				uint32_t b = _code >= _range;
+				if (b) _code -= _range;
+				res = (res << 1) | b;
+				while (_range < rangeTop) {
+					_range <<= 8;
+					_code = (_code << 8) | next();
+				}
+			}
+			return res;
+		}
+
+		inline uint32_t byte(uint16_t* probs) {
+			uint32_t node = 1;
+			for (int i = 0; i < 8; i++) {
+				node = (node << 1) | bit(probs[node]);
+			}
+			return node & 0xFF;
+		}
+
+	private:
+
+		inline uint8_t next() {
+			return _in < _end ? *_in++ : 0;
+		}
+	};
+
+	// adaptive models of one octree stream
+	// occupancy bytes are coded a bit per child, child 0 first. the context of a child is the level (capped at 3 above
+	// the leaves), the child's index, how many earlier children are occupied, and along each axis whether the cells
+	// one and two children towards the origin are occupied. those are earlier siblings or children of the node's
+	// neighbour towards the origin, which precedes it in morton order. on a surface they tell where the next point is
+	struct octreeModels {
+		static constexpr uint32_t occupancyContexts = 4 * 8 * 64 * 4;
+		uint16_t occupancy[occupancyContexts];
+		uint16_t count[256];		// points in a leaf - 1
+
+		inline octreeModels() {
+			std::fill(occupancy, occupancy + occupancyContexts, rangeProbInit);
+			std::fill(count, count + 256, rangeProbInit);
+		}
+	};
+
+	// spread the low 16 bits of v to every third bit
+	inline uint64_t spreadBits3(uint64_t v) {
+		v &= 0xFFFF;
+		v = (v | (v << 16)) & 0x0000FF0000FFull;
+		v = (v | (v << 8)) & 0x00F00F00F00Full;
+		v = (v | (v << 4)) & 0x0C30C30C30C3ull;
+		v = (v | (v << 2)) & 0x249249249249ull;
+		return v;
+	}
+
+	// gather every third bit of v, the inverse of spreadBits3
+	inline uint32_t compactBits3(uint64_t v) {
+		v &= 0x249249249249ull;
+		v = (v | (v >> 2)) & 0x0C30C30C30C3ull;
+		v = (v | (v >> 4)) & 0x00F00F00F00Full;
+		v = (v | (v >> 8)) & 0x0000FF0000FFull;
+		v = (v | (v >> 16)) & 0xFFFF;
+		return uint32_t(v);
+	}
+
+	inline uint32_t occupiedChildren(uint32_t occupancy) {
+		occupancy = occupancy - ((occupancy >> 1) & 0x55);
+		occupancy = (occupancy & 0x33) + ((occupancy >> 2) & 0x33);
+		return (occupancy + (occupancy >> 4)) & 0x0F;
+	}
+
+	// leaves of a point cloud above this many points per leaf are coded with extra direct bits
+	constexpr uint32_t octreeCountEscape = 255;
+
+	// a color is predicted as the mean of this many preceding points in octree order, which are its spatial neighbours
+	constexpr uint32_t octreeColorWindow = 32;
+
+	// levels coded in the top stream, below them every node is the root of a subtree
+	constexpr uint32_t octreeTopLevels = 3;
+
+	// the nodes of one octree level in morton order, coded breadth first
+	// near = 3 per node, the neighbour towards the origin along x, y and z, -1 where the cell is empty
+	struct octreeLevel {
+		std::vector<uint64_t> keys;
+		std::vector<uint8_t> occupancy;
+		std::vector<int32_t> near;
+		std::vector<uint32_t> firstChild;
+
+		// the single root of a tree or subtree
+		inline void root(uint64_t key) {
+			keys.assign(1, key);
+			occupancy.assign(1, 0);
+			near.assign(3, -1);
+		}
+
+		inline size_t size() const {
+			return keys.size();
+		}
+
+		// index of child of node in the next level, -1 if node or its child is empty
+		inline int32_t child(int32_t node, uint32_t child) const {
+			if (node < 0 || !((occupancy[node] >> child) & 1)) return -1;
+			return int32_t(firstChild[node] + occupiedChildren(occupancy[node] & ((1u << child) - 1)));
+		}
+
+		// occupancy of the neighbours of node towards the origin, 0 where there is none
+		inline void nearOccupancy(size_t node, uint32_t* out) const {
+			for (int axis = 0; axis < 3; axis++) {
+				int32_t n = near[node * 3 + axis];
+				out[axis] = n >= 0 ? occupancy[n] : 0;
+			}
+		}
+
+		// context of child given the children of its node coded so far
+		static inline uint32_t context(uint32_t const* nearOccupancy, uint32_t child, uint32_t coded, uint32_t levelAboveLeaves) {
+			uint32_t cells = 0;
+			for (uint32_t axis = 0; axis < 3; axis++) {
+				uint32_t bit = 4u >> axis;
+				uint32_t oneAway = (child & bit) ? (coded >> (child ^ bit)) & 1 : (nearOccupancy[axis] >> (child | bit)) & 1;
+				uint32_t twoAway = (nearOccupancy[axis] >> child) & 1;
+				cells |= (oneAway | (twoAway << 1)) << (axis * 2);
+			}
+			uint32_t level = std::min(levelAboveLeaves, 3u);
+			return ((level * 8 + child) * 64 + cells) * 4 + std::min(occupiedChildren(coded), 3u);
+		}
+
+		// fill next with the children of every node, once the level is coded. the neighbour of a child towards the
+		// origin is a sibling or a child of its node's neighbour. leaves need no neighbours, withNear is false for them
+		inline void children(octreeLevel& next, bool withNear) {
+			firstChild.resize(size());
+			uint32_t total = 0;
+			for (size_t i = 0; i < size(); i++) {
+				firstChild[i] = total;
+				total += occupiedChildren(occupancy[i]);
+			}
+			next.keys.resize(total);
+			next.occupancy.assign(total, 0);
+			next.near.resize(withNear ? size_t(total) * 3 : 0);
+			for (size_t i = 0; i < size(); i++) {
+				uint32_t n = firstChild[i];
+				for (uint32_t c = 0; c < 8; c++) {
+					if (!((occupancy[i] >> c) & 1)) continue;
+					next.keys[n] = (keys[i] << 3) | c;
+					if (withNear) {
+						for (uint32_t axis = 0; axis < 3; axis++) {
+							uint32_t bit = 4u >> axis;
+							next.near[size_t(n) * 3 + axis] = (c & bit) ? child(int32_t(i), c ^ bit) : child(near[i * 3 + axis], c | bit);
+						}
+					}
+					n++;
+				}
+			}
+		}
+	};
+
+	// mean of the colors of the last octreeColorWindow points, the prediction of the next point's color
+	class octreeColorPredictor {
+		uint8_t _window[octreeColorWindow][3] = {};
+		uint32_t _sum[3] = { 0, 0, 0 };
+		uint32_t _points = 0;
+	public:
+		inline void predict(uint8_t* color) const {
+			uint32_t n = std::max(1u, std::min(_points, octreeColorWindow));
+			for (int c = 0; c < 3; c++) color[c] = uint8_t((_sum[c] + n / 2) / n);
+		}
+
+		inline void add(uint8_t const* color) {
+			uint8_t* slot = _window[_points % octreeColorWindow];
+			for (int c = 0; c < 3; c++) {
+				_sum[c] += color[c] - slot[c];
+				slot[c] = color[c];
+			}
+			_points++;
+		}
+	};
+
+	// encodes point blobs as octrees, keeps its buffers between frames. not thread safe
+	class octreeEncoder {
+		struct subtree {
+			uint64_t key;
+			uint64_t points;
+		};
+
+		// scratch of one thread, the level being coded and the next
+		struct levelScratch {
+			octreeLevel levels[2];
+		};
+
+		std::vector<uint64_t> _keys, _keysTemp;
+		std::vector<uint32_t> _order, _orderTemp;
+		std::vector<uint64_t> _levelKeys[17];		// keys of the nodes of every level in morton order, level 0 are the leaves
+		std::vector<uint8_t> _levelOccupancy[17];	// children of those nodes
+		std::vector<uint64_t> _leafBegins;			// first point of every leaf, and the point count
+		std::vector<subtree> _subtrees;
+		std::vector<std::vector<uint8_t>> _streams;
+		std::vector<levelScratch> _scratch;
+		std::vector<uint8_t> _colors[3];
+		std::vector<uint8_t> _ransScratch;
+		uint8_t const* _points = nullptr;
+	public:
+		// encode count points in rawSink layout into out (replacing its contents)
+		// leafSize = edge of a leaf in mm, 1 keeps every coordinate. threads = subtrees encoded in parallel
+		inline void encode(uint8_t const* points, uint64_t count, int leafSize, int threads, std::vector<uint8_t>& out) {
+			if (count > std::numeric_limits<uint32_t>::max()) throw std::runtime_error("too many points for octree");
+			leafSize = std::max(1, std::min(leafSize, int(std::numeric_limits<uint16_t>::max())));
+			_points = points;
+
+			// bounding box and leaf coordinates, interleaved into morton keys
+			int16_t minimum[3] = { std::numeric_limits<int16_t>::max(), std::numeric_limits<int16_t>::max(), std::numeric_limits<int16_t>::max() };
+			for (uint64_t i = 0; i < count; i++) {
+				for (int c = 0; c < 3; c++) minimum[c] = std::min(minimum[c], coordinate(i, c));
+			}
+			if (count == 0) std::fill(minimum, minimum + 3, int16_t(0));
+
+			uint32_t maxCell = 0;
+			_keys.resize(count);
+			_order.resize(count);
+			for (uint64_t i = 0; i < count; i++) {
+				uint32_t cell[3];
+				for (int c = 0; c < 3; c++) {
+					cell[c] = uint32_t(int32_t(coordinate(i, c)) - minimum[c]) / leafSize;
+					maxCell |= cell[c];
+				}
+				_keys[i] = (spreadBits3(cell[0]) << 2) | (spreadBits3(cell[1]) << 1) | spreadBits3(cell[2]);
+				_order[i] = uint32_t(i);
+			}
+			uint32_t depth = octreeTopLevels;
+			while (depth < 16 && (maxCell >> depth)) depth++;
+			sortKeys(depth);
+			buildLevels(depth);
+			uint32_t splitLevel = depth - octreeTopLevels;
+
+			uint16_t leaf16 = uint16_t(leafSize);
+			uint8_t depth8 = uint8_t(depth), split8 = uint8_t(splitLevel);
+			out.clear();
+			append(out, "KCO1", 4);
+			append(out, &count, sizeof(count));
+			append(out, &leaf16, sizeof(leaf16));
+			append(out, minimum, sizeof(minimum));
+			append(out, &depth8, 1);
+			append(out, &split8, 1);
+
+			// the top levels, their last level holds the subtree roots
+			int workers = std::max(1, std::min<int>(threads, int(std::max<uint64_t>(1, count))));
+			_scratch.resize(workers);
+			std::vector<uint8_t> top;
+			_subtrees.clear();
+			if (count) {
+				rangeEncoder coder(top);
+				std::unique_ptr<octreeModels> models(new octreeModels());
+				encodeLevels(coder, *models, _scratch[0], 0, depth, splitLevel);
+				coder.finish();
+				for (uint64_t key : _levelKeys[splitLevel]) {
+					uint64_t leaves[2] = { firstNode(0, key, splitLevel), firstNode(0, key + 1, splitLevel) };
+					_subtrees.push_back({ key, _leafBegins[leaves[1]] - _leafBegins[leaves[0]] });
+				}
+			}
+
+			// subtrees in parallel, each worker takes the next unclaimed subtree
+			_streams.resize(_subtrees.size());
+			std::atomic<size_t> next{ 0 };
+			auto work = [&](levelScratch& scratch) {
+				std::unique_ptr<octreeModels> models;
+				for (size_t s = next++; s < _subtrees.size(); s = next++) {
+					models.reset(new octreeModels());
+					_streams[s].clear();
+					rangeEncoder coder(_streams[s]);
+					encodeLevels(coder, *models, scratch, _subtrees[s].key, splitLevel, 0);
+					encodeCounts(coder, *models, _subtrees[s].key, splitLevel);
+					coder.finish();
+				}
+			};
+			std::vector<std::thread> pool;
+			for (int t = 1; t < std::min<int>(workers, int(_subtrees.size())); t++) {
+				pool.emplace_back(work, std::ref(_scratch[t]));
+			}
+			work(_scratch[0]);
+			for (auto& worker : pool) {
+				worker.join();
+			}
+
+			uint32_t subtreeCount = uint32_t(_subtrees.size()), topBytes = uint32_t(top.size());
+			append(out, &subtreeCount, sizeof(subtreeCount));
+			append(out, &topBytes, sizeof(topBytes));
+			append(out, top.data(), top.size());
+			for (size_t s = 0; s < _subtrees.size(); s++) {
+				uint32_t bytes = uint32_t(_streams[s].size()), subtreePoints = uint32_t(_subtrees[s].points);
+				append(out, &bytes, sizeof(bytes));
+				append(out, &subtreePoints, sizeof(subtreePoints));
+			}
+			for (size_t s = 0; s < _subtrees.size(); s++) {
+				append(out, _streams[s].data(), _streams[s].size());
+			}
+
+			// colors in octree order, as the difference to the mean of the preceding points
+			octreeColorPredictor predictor;
+			for (auto& channel : _colors) channel.resize(count);
+			for (uint64_t i = 0; i < count; i++) {
+				uint8_t const* color = _points + uint64_t(_order[i]) * 9 + 6;
+				uint8_t predicted[3];
+				predictor.predict(predicted);
+				for (int c = 0; c < 3; c++) _colors[c][i] = uint8_t(color[c] - predicted[c]);
+				predictor.add(color);
+			}
+			for (auto const& channel : _colors) {
+				ransEncode(channel.data(), count, _ransScratch, out);
+			}
+		}
+
+	private:
+
+		inline int16_t coordinate(uint64_t point, int c) const {
+			int16_t v;
+			memcpy(&v, _points + point * 9 + c * 2, sizeof(v));
+			return v;
+		}
+
+		static inline void append(std::vector<uint8_t>& out, void const* data, size_t size) {
+			out.insert(out.end(), (uint8_t const*)data, (uint8_t const*)data + size);
+		}
+
+		// lsd radix sort of keys and order by the 3 * depth key bits, 16 bits per pass
+		inline void sortKeys(uint32_t depth) {
+			_keysTemp.resize(_keys.size());
+			_orderTemp.resize(_order.size());
+			std::vector<uint32_t> offsets(1 << 16);
+			for (uint32_t shift = 0; shift < depth * 3; shift += 16) {
+				std::fill(offsets.begin(), offsets.end(), 0u);
+				for (uint64_t key : _keys) offsets[(key >> shift) & 0xFFFF]++;
+				uint32_t sum = 0;
+				for (auto& offset : offsets) {
+					uint32_t n = offset;
+					offset = sum;
+					sum += n;
+				}
+				for (size_t i = 0; i < _keys.size(); i++) {
+					uint32_t slot = offsets[(_keys[i] >> shift) & 0xFFFF]++;
+					_keysTemp[slot] = _keys[i];
+					_orderTemp[slot] = _order[i];
+				}
+				_keys.swap(_keysTemp);
+				_order.swap(_orderTemp);
+			}
+		}
+
+		// every level of the tree bottom up from the sorted keys, a node's key is its children's without the last 3 bits
+		inline void buildLevels(uint32_t depth) {
+			_levelKeys[0].clear();
+			_leafBegins.clear();
+			for (size_t i = 0; i < _keys.size(); i++) {
+				if (i == 0 || _keys[i] != _keys[i - 1]) {
+					_levelKeys[0].push_back(_keys[i]);
+					_leafBegins.push_back(i);
+				}
+			}
+			_leafBegins.push_back(_keys.size());
+			for (uint32_t level = 1; level <= depth; level++) {
+				std::vector<uint64_t> const& children = _levelKeys[level - 1];
+				std::vector<uint64_t>& keys = _levelKeys[level];
+				std::vector<uint8_t>& occupancy = _levelOccupancy[level];
+				keys.clear();
+				occupancy.clear();
+				for (uint64_t child : children) {
+					if (keys.empty() || keys.back() != child >> 3) {
+						keys.push_back(child >> 3);
+						occupancy.push_back(0);
+					}
+					occupancy.back() |= uint8_t(1u << (child & 7));
+				}
+			}
+		}
+
+		// index of the first node of level at or after the descendants of the node key at level ancestor
+		inline uint64_t firstNode(uint32_t level, uint64_t key, uint32_t ancestor) const {
+			std::vector<uint64_t> const& keys = _levelKeys[level];
+			return std::lower_bound(keys.begin(), keys.end(), key << ((ancestor - level) * 3)) - keys.begin();
+		}
+
+		// code the occupancy of the levels below the node key at level top down to level last
+		// the nodes of a level below one node are a contiguous run of the level's nodes, in the order children makes them
+		inline void encodeLevels(rangeEncoder& coder, octreeModels& models, levelScratch& scratch, uint64_t key, uint32_t top, uint32_t last) {
+			int current = 0;
+			scratch.levels[current].root(key);
+			for (uint32_t level = top; level > last; level--) {
+				octreeLevel& nodes = scratch.levels[current];
+				uint8_t const* occupancy = _levelOccupancy[level].data() + firstNode(level, key, top);
+				for (size_t n = 0; n < nodes.size(); n++) {
+					// a node is never empty, so if the first 7 children are the last one is implied
+					uint32_t nearOccupancy[3], coded = 0;
+					nodes.nearOccupancy(n, nearOccupancy);
+					for (uint32_t child = 0; child < 8; child++) {
+						uint32_t bit = (occupancy[n] >> child) & 1;
+						if (child < 7 || coded) coder.bit(models.occupancy[octreeLevel::context(nearOccupancy, child, coded, level - 1)], bit);
+						coded |= bit << child;
+					}
+					nodes.occupancy[n] = occupancy[n];
+				}
+				nodes.children(scratch.levels[current ^ 1], level - 1 > last);
+				current ^= 1;
+			}
+		}
+
+		// points per leaf of the subtree below the node key at level top
+		inline void encodeCounts(rangeEncoder& coder, octreeModels& models, uint64_t key, uint32_t top) {
+			for (uint64_t n = firstNode(0, key, top), end = firstNode(0, key + 1, top); n < end; n++) {
+				uint32_t extra = uint32_t(_leafBegins[n + 1] - _leafBegins[n] - 1);
+				coder.byte(models.count, std::min(extra, octreeCountEscape));
+				if (extra >= octreeCountEscape) coder.direct(extra - octreeCountEscape, 32);
+			}
+		}
+	};
+
+	// decode the occupancy of the levels below the root key at level top down to level last, mirror of
+	// octreeEncoder::encodeLevels. returns which of levels holds level last, or -1 if a level has more than maxNodes
+	// nodes, which only corrupt data gets to
+	inline int decodeOctreeLevels(rangeDecoder& coder, octreeModels& models, octreeLevel* levels, uint64_t key, uint32_t top, uint32_t last, uint64_t maxNodes) {
+		int current = 0;
+		levels[current].root(key);
+		for (uint32_t level = top; level > last; level--) {
+			octreeLevel& nodes = levels[current];
+			for (size_t n = 0; n < nodes.size(); n++) {
+				uint32_t nearOccupancy[3], coded = 0;
+				nodes.nearOccupancy(n, nearOccupancy);
+				for (uint32_t child = 0; child < 8; child++) {
+					uint32_t bit = (child < 7 || coded) ? coder.bit(models.occupancy[octreeLevel::context(nearOccupancy, child, coded, level - 1)]) : 1;
+					coded |= bit << child;
+				}
+				nodes.occupancy[n] = uint8_t(coded);
+			}
+			nodes.children(levels[current ^ 1], level - 1 > last);
+			current ^= 1;
+			if (levels[current].size() > maxNodes) return -1;
+		}
+		return current;
+	}
+
+	// decode a blob written by octreeEncoder into points (rawSink layout), returns the number of points
+	// positions are leaf centers. threads = subtrees decoded in parallel. throws if data is not a valid blob
+	uint64_t decodeOctree(uint8_t const* data, size_t size, std::vector<uint8_t>& points, int threads = 1) {
+		uint64_t count = 0;
+		uint16_t leafSize = 0;
+		int16_t minimum[3];
+		uint8_t depth = 0, splitLevel = 0;
+		uint32_t subtreeCount = 0, topBytes = 0;
+		const size_t headerSize = 4 + sizeof(count) + sizeof(leafSize) + sizeof(minimum) + 2 + sizeof(subtreeCount) + sizeof(topBytes);
+		if (size < headerSize || memcmp(data, "KCO1", 4) != 0) throw std::runtime_error("not an octree point cloud");
+		uint8_t const* in = data + 4;
+		memcpy(&count, in, sizeof(count)); in += sizeof(count);
+		memcpy(&leafSize, in, sizeof(leafSize)); in += sizeof(leafSize);
+		memcpy(minimum, in, sizeof(minimum)); in += sizeof(minimum);
+		depth = *in++;
+		splitLevel = *in++;
+		memcpy(&subtreeCount, in, sizeof(subtreeCount)); in += sizeof(subtreeCount);
+		memcpy(&topBytes, in, sizeof(topBytes)); in += sizeof(topBytes);
+		uint8_t const* end = data + size;
+
+		// everything is checked against the header before anything is allocated
+		if (leafSize == 0 || depth < octreeTopLevels || depth > 16 || splitLevel != depth - octreeTopLevels ||
+			count > (uint64_t(1) << 28) || subtreeCount > std::min<uint64_t>(count, 1u << (3 * octreeTopLevels)) ||
+			size_t(end - in) < topBytes || (count && !subtreeCount)) {
+			throw std::runtime_error("bad octree point cloud header");
+		}
+
+		// the top levels name the subtree roots
+		octreeLevel top[2];
+		int roots = -1;
+		if (count) {
+			rangeDecoder coder(in, topBytes);
+			std::unique_ptr<octreeModels> models(new octreeModels());
+			roots = decodeOctreeLevels(coder, *models, top, 0, depth, splitLevel, subtreeCount);
+		}
+		in += topBytes;
+		if (count && (roots < 0 || top[roots].size() != subtreeCount)) throw std::runtime_error("bad octree point cloud subtrees");
+
+		// stream sizes and point counts of the subtrees, the points of subtree s start at first[s]
+		if (size_t(end - in) / (2 * sizeof(uint32_t)) < subtreeCount) throw std::runtime_error("truncated octree point cloud");
+		std::vector<uint8_t const*> streams(subtreeCount);
+		std::vector<uint32_t> streamBytes(subtreeCount), subtreePoints(subtreeCount);
+		std::vector<uint64_t> first(subtreeCount);
+		uint64_t total = 0;
+		for (uint32_t s = 0; s < subtreeCount; s++) {
+			memcpy(&streamBytes[s], in, sizeof(uint32_t));
+			memcpy(&subtreePoints[s], in + sizeof(uint32_t), sizeof(uint32_t));
+			in += 2 * sizeof(uint32_t);
+			first[s] = total;
+			total += subtreePoints[s];
+		}
+		if (total != count) throw std::runtime_error("bad octree point cloud subtrees");
+		for (uint32_t s = 0; s < subtreeCount; s++) {
+			if (size_t(end - in) < streamBytes[s]) throw std::runtime_error("truncated octree point cloud");
+			streams[s] = in;
+			in += streamBytes[s];
+		}
+
+		points.resize(count * 9);
+		std::atomic<bool> corrupt{ false };
+		std::atomic<size_t> next{ 0 };
+		auto work = [&]() {
+			octreeLevel levels[2];
+			std::unique_ptr<octreeModels> models;
+			for (size_t s = next++; s < subtreeCount; s = next++) {
+				models.reset(new octreeModels());
+				rangeDecoder coder(streams[s], streamBytes[s]);
+				int last = decodeOctreeLevels(coder, *models, levels, top[roots].keys[s], splitLevel, 0, subtreePoints[s]);
+				if (last < 0) {
+					corrupt = true;
+					return;
+				}
+
+				// every leaf holds at least one point, the leaves' counts have to add up to the subtree's
+				uint8_t* out = points.data() + first[s] * 9;
+				uint64_t remaining = subtreePoints[s];
+				octreeLevel const& leaves = levels[last];
+				for (size_t n = 0; n < leaves.size(); n++) {
+					uint32_t extra = coder.byte(models->count);
+					if (extra == octreeCountEscape) extra += coder.direct(32);
+					if (uint64_t(extra) + 1 > remaining) {
+						corrupt = true;
+						return;
+					}
+					remaining -= uint64_t(extra) + 1;
+
+					uint64_t key = leaves.keys[n];
+					uint32_t cell[3] = { compactBits3(key >> 2), compactBits3(key >> 1), compactBits3(key) };
+					int16_t position[3];
+					for (int c = 0; c < 3; c++) {
+						position[c] = int16_t(std::min<int64_t>(std::numeric_limits<int16_t>::max(), int64_t(minimum[c]) + int64_t(cell[c]) * leafSize + leafSize / 2));
+					}
+					for (uint32_t i = 0; i <= extra; i++) {
+						memcpy(out, position, sizeof(position));
+						out += 9;
+					}
+				}
+				if (remaining) corrupt = true;
+			}
+		};
+		std::vector<std::thread> workers;
+		for (int t = 1; t < std::min<int>(threads, int(subtreeCount)); t++) {
+			workers.emplace_back(work);
+		}
+		work();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		if (corrupt) throw std::runtime_error("corrupt octree point cloud");
+
+		// colors, in the same order as the points
+		std::vector<uint8_t> colors[3];
+		for (auto& channel : colors) {
+			channel.resize(count);
+			ransDecode(in, end, count, channel.data());
+		}
+		octreeColorPredictor predictor;
+		for (uint64_t i = 0; i < count; i++) {
+			uint8_t* color = points.data() + i * 9 + 6;
+			predictor.predict(color);
+			for (int c = 0; c < 3; c++) color[c] = uint8_t(color[c] + colors[c][i]);
+			predictor.add(color);
+		}
+		return count;
+	}
+}
@@ -0,0 +1,757 @@
+#pragma once
+
+#include "kinectUtil.h"
+#include "reprojection.h"
+#include "fileOutput.h"
+#include "octreeCodec.h"
+#include "voxelGrid.h"
+#include "gridFilters.h"
+#include "cropRegion.h"
+#include "gridNormals.h"
+#include "gridMesh.h"
+
+#include <mutex>
+#include <type_traits>
+
+namespace kinectCloud {
+	// sinks receive an organized point cloud row by row and decide what happens to each point
+	// a sink is a template parameter of the pipeline, so the per point work is inlined into the row loop
+	//   void begin(glm::uvec2 size, uint32_t bands)
+	//       before any row, on the calling thread
+	//   void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width)
+	//       rows of one band arrive in order on one thread, bands run in parallel
+	//       band b covers rows [rowBandStart(rows, bands, b), rowBandStart(rows, bands, b + 1))
+	//       points with xyz (0, 0, 0) are invalid, row data stays valid until finish returns
+	//   void finish()
+	//       after every band, on the calling thread
+	// sinks which take per point normals (see sinkTakesNormals) also have
+	//   void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint8_t const* normals, uint32_t width)
+	//       normals holds normalSize(format) bytes per point, the last row of a band may arrive late, from the
+	//       finish of the stage in front, but still before finish
+
+	// pts text file, one "x y z r g b" line per point
+	// every band formats into its own slice of one buffer, finish writes the slices in order
+	class ptsSink {
+		std::string _path;
+		frameArena* _arena;
+		frameArena _temporary;
+		fileOutput* _output;
+		stdioOutput _stdio;
+		char* _text = nullptr;
+		size_t _rowBytes = 0;
+		std::vector<size_t> _bandStart, _bandLength;
+	public:
+		// text is formatted into the arena if one is given, otherwise into a temporary buffer
+		// the file is written through output if one is given, otherwise synchronously with stdio
+		inline ptsSink(std::string const& path, frameArena* arena = nullptr, fileOutput* output = nullptr) :
+			_path(path), _arena(arena), _output(output ? output : &_stdio) { }
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			_rowBytes = size_t(size.x) * maxPointText;
+			_text = (char*)(_arena ? _arena : &_temporary)->buffer(frameArena::textSlot, _rowBytes * size.y);
+			_bandStart.resize(bands);
+			_bandLength.assign(bands, 0);
+			for (uint32_t b = 0; b < bands; b++) {
+				_bandStart[b] = _rowBytes * rowBandStart(size.y, bands, b);
+			}
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			char* start = _text + _bandStart[band] + _bandLength[band];
+			_bandLength[band] += formatPointRow(start, xyz, bgra, width) - start;
+		}
+
+		inline void finish() {
+			int file = _output->open(_path);
+			uint64_t offset = 0;
+			for (size_t b = 0; b < _bandStart.size(); b++) {
+				_output->write(file, offset, _text + _bandStart[b], _bandLength[b]);
+				offset += _bandLength[b];
+			}
+			_output->close(file);
+			if (_output == &_stdio) _stdio.flush();
+		}
+	};
+
+	// 9 byte points packed back to back
+	//[int16 x 0][int16 y 0][int16 z 0][uint8 r 0][uint8 g 0][uint8 b 0]
+	//...
+	// data must hold 9 bytes for every pixel, every band packs into its own slice and finish moves them together
+	// with normals, the normal of every point is packed into normals the same way, which must hold normalSize(format)
+	// bytes for every pixel
+	class rawSink {
+		uint8_t* _data;
+		uint8_t* _normals;
+		uint32_t _normalSize;
+		uint64_t _points = 0;
+		std::vector<uint64_t> _bandStart, _bandPoints;
+	public:
+		inline rawSink(uint8_t* data, uint8_t* normals = nullptr, normalFormat format = normalFormat::off) :
+			_data(data), _normals(normals), _normalSize(normals ? normalSize(format) : 0) { }
+
+		// number of points written, valid after finish
+		inline uint64_t points() const {
+			return _points;
+		}
+
+		// the packed points
+		inline uint8_t const* data() const {
+			return _data;
+		}
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			_bandStart.resize(bands);
+			_bandPoints.assign(bands, 0);
+			for (uint32_t b = 0; b < bands; b++) {
+				_bandStart[b] = uint64_t(size.x) * rowBandStart(size.y, bands, b);
+			}
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			_bandPoints[band] += compactPoints(xyz, bgra, width, _data + (_bandStart[band] + _bandPoints[band]) * 9);
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint8_t const* normals, uint32_t width) {
+			uint64_t first = _bandStart[band] + _bandPoints[band];
+			if (_normals) compactNormals(xyz, normals, _normalSize, width, _normals + first * _normalSize);
+			row(band, y, xyz, bgra, width);
+		}
+
+		inline void finish() {
+			_points = 0;
+			for (size_t b = 0; b < _bandStart.size(); b++) {
+				if (_bandStart[b] != _points) {
+					memmove(_data + _points * 9, _data + _bandStart[b] * 9, _bandPoints[b] * 9);
+					if (_normals) memmove(_normals + _points * _normalSize, _normals + _bandStart[b] * _normalSize, _bandPoints[b] * _normalSize);
+				}
+				_points += _bandPoints[b];
+			}
+		}
+	};
+
+	template<>
+	struct sinkTakesNormals<rawSink> : std::true_type { };
+
+	// points a band packs before it writes them, 576 KB of plain points
+	constexpr uint64_t plyChunkPoints = 1 << 16;
+
+	// binary little endian ply file, the records are the 9 byte points of rawSink
+	// every band packs points into its own part of a frame sized buffer, points are in row order like rawSink's.
+	// a band's place in the file is known once every band before it has packed its last row; from then on it writes
+	// what it packed every plyChunkPoints points, before that it keeps packing. finish writes what is left in band
+	// order, then the header, once the vertex count is known. the file is the same for any number of bands
+	class plySink {
+		std::string _path;
+		frameArena* _arena;
+		frameArena _temporary;
+		fileOutput* _output;
+		stdioOutput _stdio;
+		int _file = -1;
+		bool _writeFailed = false;
+		uint64_t _points = 0;
+		glm::uvec2 _size = glm::uvec2(0, 0);
+		uint32_t _bands = 0;
+		uint8_t* _data = nullptr;
+		std::vector<uint64_t> _bandPoints, _bandWritten;
+		std::mutex _placeLock;
+		std::vector<uint64_t> _bandOffset; // file offset of band, guarded by _placeLock
+		std::vector<uint8_t> _bandDone; // guarded by _placeLock
+		uint32_t _placedBands = 0; // bands whose offset is known, guarded by _placeLock
+		normalFormat _normals;
+		uint32_t _recordSize;
+	public:
+		// points are packed in the arena if one is given, otherwise in a temporary buffer
+		// the file is written through output if one is given, otherwise synchronously with stdio
+		// with normals every vertex carries its normal, the rows then have to come with normals
+		inline plySink(std::string const& path, frameArena* arena = nullptr, fileOutput* output = nullptr, normalFormat normals = normalFormat::off) :
+			_path(path), _arena(arena), _output(output ? output : &_stdio), _normals(normals), _recordSize(9 + normalSize(normals)) { }
+
+		// number of points written, valid after finish
+		inline uint64_t points() const {
+			return _points;
+		}
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			_file = _output->open(_path);
+			_points = 0;
+			_writeFailed = false;
+			_size = size;
+			_bands = bands;
+			_data = (_arena ? _arena : &_temporary)->buffer(frameArena::textSlot, uint64_t(size.x) * size.y * _recordSize);
+			_bandPoints.assign(bands, 0);
+			_bandWritten.assign(bands, 0);
+			_bandOffset.assign(bands, 0);
+			_bandDone.assign(bands, 0);
+			_bandOffset[0] = header(0, _normals).size();
+			_placedBands = 1;
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			_bandPoints[band] += compactPoints(xyz, bgra, width, bandData(band) + _bandPoints[band] * _recordSize);
+			rowDone(band, y);
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint8_t const* normals, uint32_t width) {
+			_bandPoints[band] += compactPointNormals(xyz, bgra, normals, _recordSize - 9, width, bandData(band) + _bandPoints[band] * _recordSize);
+			rowDone(band, y);
+		}
+
+		inline void finish() {
+			for (uint32_t b = 0; b < _bands; b++) {
+				place(b);
+			}
+			for (uint32_t b = 0; b < _bands; b++) {
+				flush(b);
+				_points += _bandPoints[b];
+			}
+
+			std::string head = header(_points, _normals);
+			_output->write(_file, 0, head.data(), head.size());
+			_output->close(_file);
+			_file = -1;
+			if (_output == &_stdio) _stdio.flush();
+			if (_writeFailed) throw std::runtime_error("failed to write " + _path);
+		}
+
+		// copy constructor removed
+		inline plySink(plySink const& other) = delete;
+
+		// copy assignment removed
+		inline plySink& operator=(plySink const& other) = delete;
+
+		// destructor, closes the file if finish was never reached
+		inline ~plySink() {
+			if (_file >= 0) _output->close(_file);
+		}
+
+	private:
+
+		// the vertex count is zero padded, so the header has the same size before and after the count is known
+		static inline std::string header(uint64_t points, normalFormat normals) {
+			char count[24];
+			snprintf(count, sizeof(count), "%010llu", (unsigned long long)points);
+			std::string normalComment, normalProperties;
+			plyNormalHeader(normals, normalComment, normalProperties);
+			return std::string("ply\nformat binary_little_endian 1.0\ncomment KinectCloud, xyz in millimeters\n") + normalComment +
+				"element vertex " + count + "\n"
+				"property short x\nproperty short y\nproperty short z\n"
+				"property uchar blue\nproperty uchar green\nproperty uchar red\n" +
+				normalProperties +
+				"end_header\n";
+		}
+
+		// a band has room for every pixel of its rows
+		inline uint8_t* bandData(uint32_t band) {
+			return _data + uint64_t(rowBandStart(_size.y, _bands, band)) * _size.x * _recordSize;
+		}
+
+		// after the last row of a band the bands after it may learn their offset, then write what is due
+		inline void rowDone(uint32_t band, uint32_t y) {
+			bool last = y + 1 == rowBandStart(_size.y, _bands, band + 1);
+			if (last) place(band);
+			if (last || _bandPoints[band] - _bandWritten[band] >= plyChunkPoints) flush(band);
+		}
+
+		// mark band as packed and give every following band whose predecessors are packed its offset
+		inline void place(uint32_t band) {
+			std::lock_guard<std::mutex> lock(_placeLock);
+			_bandDone[band] = 1;
+			while (_placedBands < _bands && _bandDone[_placedBands - 1]) {
+				_bandOffset[_placedBands] = _bandOffset[_placedBands - 1] + _bandPoints[_placedBands - 1] * _recordSize;
+				_placedBands++;
+			}
+		}
+
+		// write the points band packed since its last write, if its offset is known. called from the band's thread
+		// errors are recorded and thrown by finish, an exception cannot leave a band thread
+		inline void flush(uint32_t band) {
+			uint64_t offset;
+			{
+				std::lock_guard<std::mutex> lock(_placeLock);
+				if (band >= _placedBands) return;
+				offset = _bandOffset[band];
+			}
+			uint64_t count = _bandPoints[band] - _bandWritten[band];
+			if (count == 0) return;
+			try {
+				_output->write(_file, offset + _bandWritten[band] * _recordSize, bandData(band) + _bandWritten[band] * _recordSize, count * _recordSize);
+			} catch (std::runtime_error const&) {
+				std::lock_guard<std::mutex> lock(_placeLock);
+				_writeFailed = true;
+			}
+			_bandWritten[band] = _bandPoints[band];
+		}
+	};
+
+	template<>
+	struct sinkTakesNormals<plySink> : std::true_type { };
+
+	// octree compressed file, see octreeCodec.h
+	// the octree needs every point before it can be built, so bands pack points like rawSink and finish encodes them
+	class octreeSink {
+		std::string _path;
+		int _leafSize;
+		int _threads;
+		frameArena* _arena;
+		frameArena _temporary;
+		fileOutput* _output;
+		stdioOutput _stdio;
+		octreeEncoder* _encoder;
+		octreeEncoder _temporaryEncoder;
+		std::vector<uint8_t> _encoded;
+		rawSink _points{ nullptr };
+	public:
+		// points are packed into the arena if one is given, otherwise into a temporary buffer
+		// encoder keeps its buffers between frames if one is given. threads = subtrees encoded in parallel
+		// the file is written through output if one is given, otherwise synchronously with stdio
+		inline octreeSink(std::string const& path, int leafSize, int threads, frameArena* arena = nullptr, fileOutput* output = nullptr, octreeEncoder* encoder = nullptr) :
+			_path(path), _leafSize(leafSize), _threads(threads), _arena(arena), _output(output ? output : &_stdio), _encoder(encoder ? encoder : &_temporaryEncoder) { }
+
+		// number of points written, valid after finish
+		inline uint64_t points() const {
+			return _points.points();
+		}
+
+		// size of the file, valid after finish
+		inline size_t bytes() const {
+			return _encoded.size();
+		}
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			uint8_t* data = (_arena ? _arena : &_temporary)->buffer(frameArena::textSlot, uint64_t(size.x) * size.y * 9);
+			_points = rawSink(data);
+			_points.begin(size, bands);
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			_points.row(band, y, xyz, bgra, width);
+		}
+
+		inline void finish() {
+			_points.finish();
+			_encoder->encode(_points.data(), _points.points(), _leafSize, _threads, _encoded);
+			int file = _output->open(_path);
+			_output->write(file, 0, _encoded.data(), _encoded.size());
+			_output->close(file);
+			if (_output == &_stdio) _stdio.flush();
+		}
+	};
+
+	// point cloud as one array per component
+	struct pointArrays {
+		std::vector<int16_t> x, y, z;
+		std::vector<uint8_t> r, g, b;
+
+		inline size_t size() const {
+			return x.size();
+		}
+
+		inline void clear() {
+			x.clear(); y.clear(); z.clear();
+			r.clear(); g.clear(); b.clear();
+		}
+
+		// append all points of other
+		inline void append(pointArrays const& other) {
+			x.insert(x.end(), other.x.begin(), other.x.end());
+			y.insert(y.end(), other.y.begin(), other.y.end());
+			z.insert(z.end(), other.z.begin(), other.z.end());
+			r.insert(r.end(), other.r.begin(), other.r.end());
+			g.insert(g.end(), other.g.begin(), other.g.end());
+			b.insert(b.end(), other.b.begin(), other.b.end());
+		}
+	};
+
+	// fill pointArrays in memory, every band collects its own arrays which finish concatenates in order
+	class soaSink {
+		pointArrays& _out;
+		std::vector<pointArrays> _bands;
+	public:
+		inline soaSink(pointArrays& out) : _out(out) { }
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			_bands.resize(bands);
+			for (auto& band : _bands) band.clear();
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			pointArrays& out = _bands[band];
+			for (uint32_t x = 0; x < width; x++) {
+				int16_t px = xyz[x * 3 + 0], py = xyz[x * 3 + 1], pz = xyz[x * 3 + 2];
+				if (px != 0 || py != 0 || pz != 0) {
+					out.x.push_back(px);
+					out.y.push_back(py);
+					out.z.push_back(pz);
+					out.r.push_back(bgra[x * 4 + 2]);
+					out.g.push_back(bgra[x * 4 + 1]);
+					out.b.push_back(bgra[x * 4 + 0]);
+				}
+			}
+		}
+
+		inline void finish() {
+			_out.clear();
+			for (auto const& band : _bands) _out.append(band);
+		}
+	};
+
+	// run an organized xyz image and a color image of the same size through sink, rows split into bands
+	template<class Sink>
+	void emitPoints(glm::uvec2 size, int16_t const* xyz, uint8_t const* bgra, int threads, Sink& sink) {
+		sink.begin(size, rowBandCount(size.y, threads));
+		forEachRowBand(size.y, threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+			for (uint32_t y = firstRow; y < lastRow; y++) {
+				uint64_t first = uint64_t(y) * size.x;
+				sink.row(band, y, xyz + first * 3, bgra + first * 4, size.x);
+			}
+		});
+		sink.finish();
+	}
+
+	// run the pixels of rect of an organized xyz image and a color image of size through sink, as a grid of the rect's size
+	// points outside crop are zeroed in xyz on the way, if one is given
+	template<class Sink>
+	void emitPoints(glm::uvec2 size, pixelRect const& rect, int16_t* xyz, uint8_t const* bgra, cloudCrop const* crop, int threads, Sink& sink) {
+		sink.begin(glm::uvec2(rect.width(), rect.height()), rowBandCount(rect.height(), threads));
+		forEachRowBand(rect.height(), threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+			for (uint32_t y = firstRow; y < lastRow; y++) {
+				uint64_t first = uint64_t(rect.min.y + y) * size.x + rect.min.x;
+				if (crop) cropPoints(xyz + first * 3, rect.width(), *crop);
+				sink.row(band, y, xyz + first * 3, bgra + first * 4, rect.width());
+			}
+		});
+		sink.finish();
+	}
+
+	// save existing xyz image as pts file
+	// rows are split into one band per thread, bands are formatted in parallel and written in order
+	void savePointCloud(glm::uvec2 size, k4a_image_t xyzImg, k4a_image_t colorImg, std::string const& loc, int threads = 1, frameArena* arena = nullptr, fileOutput* output = nullptr) {
+		ptsSink sink(loc, arena, output);
+		emitPoints(size, (int16_t*)k4a_image_get_buffer(xyzImg), k4a_image_get_buffer(colorImg), threads, sink);
+	}
+
+	// save existing xyz image as binary ply file, see plySink
+	void savePointCloudPly(glm::uvec2 size, k4a_image_t xyzImg, k4a_image_t colorImg, std::string const& loc, int threads = 1, frameArena* arena = nullptr, fileOutput* output = nullptr) {
+		plySink sink(loc, arena, output);
+		emitPoints(size, (int16_t*)k4a_image_get_buffer(xyzImg), k4a_image_get_buffer(colorImg), threads, sink);
+	}
+
+	// save existing xyz image as octree compressed file, see octreeSink
+	void savePointCloudOctree(glm::uvec2 size, k4a_image_t xyzImg, k4a_image_t colorImg, std::string const& loc, int leafSize = 1, int threads = 1, frameArena* arena = nullptr, fileOutput* output = nullptr) {
+		octreeSink sink(loc, leafSize, threads, arena, output);
+		emitPoints(size, (int16_t*)k4a_image_get_buffer(xyzImg), k4a_image_get_buffer(colorImg), threads, sink);
+	}
+
+	// save existing xyz and color image in data block, see rawSink for the layout
+	// data must be able to hold 9 bytes for every pixel, returns number of points
+	uint64_t savePointCloudRaw(glm::uvec2 size, k4a_image_t xyzImg, k4a_image_t colorImg, uint8_t* data, int threads = 1) {
+		rawSink sink(data);
+		emitPoints(size, (int16_t*)k4a_image_get_buffer(xyzImg), k4a_image_get_buffer(colorImg), threads, sink);
+		return sink.points();
+	}
+
+	// true if files of format can carry per point normals, that is if the sink save writes them with takes them
+	bool cloudFormatTakesNormals(cloudFormat format) {
+		switch (format) {
+		case cloudFormat::ply: return sinkTakesNormals<plySink>::value;
+		case cloudFormat::mesh: return sinkTakesNormals<meshSink>::value;
+		case cloudFormat::octree: return sinkTakesNormals<octreeSink>::value;
+		default: return sinkTakesNormals<ptsSink>::value;
+		}
+	}
+
+	// turns depth and color into point clouds for one calibration, the same code runs for capture, playback and server
+	// owns the sdk transformation, the reprojection tables, the reused frame buffers and the temporal depth history
+	// not thread safe, pipelines of the same calibration on other threads can share its ray tables
+	class cloudPipeline {
+		k4a_transformation_t _transform = nullptr;
+		depthReprojector _reprojector;
+		frameArena _arena;
+		frameArena* _sharedArena = nullptr; // used instead of _arena if set
+		octreeEncoder _octree;
+		voxelGrid _voxels;
+		temporalFilter _temporal;
+
+		// roi of the last crop, recomputed when the crop or the space changes
+		cloudCrop _crop;
+		cloudSpace _cropSpace = cloudSpace::color;
+		depthRoi _cropRoi;
+		bool _hasCropRoi = false;
+	public:
+		inline cloudPipeline() = default;
+
+		inline cloudPipeline(k4a_calibration_t const& cali) : _reprojector(cali) {
+			_transform = k4a_transformation_create(&cali);
+			if (!_transform) throw std::runtime_error("failed to create transformation");
+		}
+
+		// pipeline of the calibration of tables which shares its ray tables, for another thread
+		// with arena the frame buffers come from arena, which pipelines that never run at the same time can share
+		inline cloudPipeline(depthReprojector const& tables, frameArena* arena = nullptr) : _reprojector(tables.share()), _sharedArena(arena) {
+			_transform = k4a_transformation_create(&tables.calibration());
+			if (!_transform) throw std::runtime_error("failed to create transformation");
+		}
+
+		// buffers reused across frames, see frameArena
+		inline frameArena& arena() {
+			return _sharedArena ? *_sharedArena : _arena;
+		}
+
+		// reprojection kernel of the color space path
+		inline depthReprojector& reprojector() {
+			return _reprojector;
+		}
+
+		// size of the point grid for the given space
+		inline glm::uvec2 gridSize(cloudSpace space) const {
+			return space == cloudSpace::depth ? _reprojector.depthRays().size : _reprojector.colorRays().size;
+		}
+
+		// depth pixels and depths the pipeline looks at for the crop of opts, see cropToDepthRoi
+		inline depthRoi const& cropRoi(cloudOptions const& opts) {
+			if (!_hasCropRoi || !(_crop == opts.crop) || _cropSpace != opts.space) {
+				_cropRoi = cropToDepthRoi(opts.crop, opts.space, _reprojector.calibration(), _reprojector.depthRays());
+				_crop = opts.crop;
+				_cropSpace = opts.space;
+				_hasCropRoi = true;
+			}
+			return _cropRoi;
+		}
+
+		// run the depth and color image of capture through sink
+		// returns false if capture is missing either image
+		template<class Sink>
+		bool run(k4a_capture_t capture, cloudOptions const& opts, Sink& sink) {
+			if (capture == nullptr) return false;
+			k4a_image_t depthImage = k4a_capture_get_depth_image(capture);
+			k4a_image_t colorImage = k4a_capture_get_color_image(capture);
+			if (depthImage == nullptr || colorImage == nullptr) {
+				if (depthImage) k4a_image_release(depthImage);
+				if (colorImage) k4a_image_release(colorImage);
+				return false;
+			}
+
+			try {
+				run(depthImage, colorImage, opts, sink);
+			} catch (...) {
+				k4a_image_release(depthImage);
+				k4a_image_release(colorImage);
+				throw;
+			}
+
+			k4a_image_release(depthImage);
+			k4a_image_release(colorImage);
+			return true;
+		}
+
+		// save the point cloud of capture as a file in opts.format
+		// with an asynchronous opts.output the file may still be in flight when this returns
+		// returns false if capture is missing either image
+		inline bool save(k4a_capture_t capture, std::string const& path, cloudOptions const& opts) {
+			if (opts.format == cloudFormat::ply) {
+				plySink sink(path, &arena(), opts.output, opts.normals);
+				return run(capture, opts, sink);
+			}
+			if (opts.format == cloudFormat::mesh) {
+				if (opts.voxelSize > 0) throw std::runtime_error("meshes need the organized grid, they can't be combined with voxels");
+				meshSink sink(path, opts.meshJump, &arena(), opts.output, opts.normals);
+				return run(capture, opts, sink);
+			}
+			if (opts.format == cloudFormat::octree) {
+				octreeSink sink(path, opts.leafSize, opts.threads, &arena(), opts.output, &_octree);
+				return run(capture, opts, sink);
+			}
+			ptsSink sink(path, &arena(), opts.output);
+			return run(capture, opts, sink);
+		}
+
+		// run a depth16 image and a bgra32 color image from this calibration through sink
+		// the stages selected by opts sit between the point grid and sink, the depth filters run before either
+		template<class Sink>
+		void run(k4a_image_t depthImg, k4a_image_t colorImg, cloudOptions const& opts, Sink& sink) {
+			if (opts.normals != normalFormat::off && opts.voxelSize > 0) {
+				throw std::runtime_error("normals need the organized grid, they can't be combined with voxels");
+			}
+			k4a_image_t filteredDepth = nullptr;
+			if (opts.flyingPixelJump > 0.f || opts.temporal != temporalMode::off) {
+				filteredDepth = filterDepth(depthImg, opts);
+				depthImg = filteredDepth;
+			}
+
+			try {
+				if (opts.voxelSize > 0) {
+					voxelSink<Sink> voxels(_voxels, opts.voxelSize, opts.voxels, opts.threads, sink);
+					filter(depthImg, colorImg, opts, voxels);
+				} else if (opts.normals != normalFormat::off) {
+					withNormals(depthImg, colorImg, opts, sink, sinkTakesNormals<Sink>());
+				} else {
+					filter(depthImg, colorImg, opts, sink);
+				}
+			} catch (...) {
+				if (filteredDepth) k4a_image_release(filteredDepth);
+				throw;
+			}
+			if (filteredDepth) k4a_image_release(filteredDepth);
+		}
+
+		// copy constructor removed
+		inline cloudPipeline(cloudPipeline const& other) = delete;
+
+		// copy assignment removed
+		inline cloudPipeline& operator=(cloudPipeline const& other) = delete;
+
+		// move constructor (needed for use in std::vector)
+		inline cloudPipeline(cloudPipeline&& other) noexcept {
+			move(other);
+		}
+
+		// move assignment (needed for use in std::vector)
+		inline cloudPipeline& operator=(cloudPipeline&& other) noexcept {
+			if (_transform) k4a_transformation_destroy(_transform);
+			move(other);
+			return *this;
+		}
+
+		// destructor
+		inline ~cloudPipeline() {
+			if (_transform) {
+				k4a_transformation_destroy(_transform);
+			}
+		}
+
+	private:
+
+		// copy of depthImg after the temporal and flying pixel filters, in the arena
+		inline k4a_image_t filterDepth(k4a_image_t depthImg, cloudOptions const& opts) {
+			glm::uvec2 size = _reprojector.depthRays().size;
+			if (uint32_t(k4a_image_get_width_pixels(depthImg)) != size.x || uint32_t(k4a_image_get_height_pixels(depthImg)) != size.y) {
+				throw std::runtime_error("depth image does not match calibration");
+			}
+			k4a_image_t filtered = nullptr;
+			if (K4A_RESULT_SUCCEEDED != arena().createImage(frameArena::filteredDepthSlot, K4A_IMAGE_FORMAT_DEPTH16, size.x, size.y, size.x * sizeof(uint16_t), &filtered)) {
+				throw std::runtime_error("failed to create filtered depth image");
+			}
+			uint16_t const* depth = (uint16_t const*)k4a_image_get_buffer(depthImg);
+			uint16_t* out = (uint16_t*)k4a_image_get_buffer(filtered);
+			if (opts.temporal != temporalMode::off) {
+				uint16_t* smoothed = opts.flyingPixelJump > 0.f ? (uint16_t*)arena().buffer(frameArena::temporalDepthSlot, uint64_t(size.x) * size.y * sizeof(uint16_t)) : out;
+				_temporal.apply(depth, smoothed, size, opts);
+				depth = smoothed;
+			}
+			if (opts.flyingPixelJump > 0.f) removeFlyingPixels(depth, out, size, opts.flyingPixelJump, opts.threads);
+			return filtered;
+		}
+
+		// normals are computed on the grid after the outliers are gone, right before sink
+		template<class Sink>
+		void withNormals(k4a_image_t depthImg, k4a_image_t colorImg, cloudOptions const& opts, Sink& sink, std::true_type) {
+			normalSink<Sink> normals(opts.normals, sink, &arena());
+			filter(depthImg, colorImg, opts, normals);
+		}
+
+		template<class Sink>
+		void withNormals(k4a_image_t depthImg, k4a_image_t colorImg, cloudOptions const& opts, Sink& sink, std::false_type) {
+			throw std::runtime_error("this output can't carry normals");
+		}
+
+		// stages which need the organized grid, before anything changes its layout
+		template<class Sink>
+		void filter(k4a_image_t depthImg, k4a_image_t colorImg, cloudOptions const& opts, Sink& sink) {
+			if (opts.outlierRadius > 0) {
+				outlierSink<Sink> outliers(opts.outlierRadius, opts.outlierDeviations, opts.threads, sink, &arena());
+				generate(depthImg, colorImg, opts, outliers);
+				return;
+			}
+			generate(depthImg, colorImg, opts, sink);
+		}
+
+		// point grid of the depth and color image, before any stage
+		// with a crop only the pixels which can reach it are generated and the grid is the rectangle they cover,
+		// points outside the crop are dropped as rows are emitted
+		template<class Sink>
+		void generate(k4a_image_t depthImg, k4a_image_t colorImg, cloudOptions const& opts, Sink& sink) {
+			cloudCrop const* crop = opts.crop.enabled() ? &opts.crop : nullptr;
+			if (opts.space == cloudSpace::depth) {
+				depthRoi roi = crop ? cropRoi(opts) : _reprojector.fullRoi();
+				k4a_image_t xyzImg = nullptr;
+				k4a_image_t mappedColorImg = nullptr;
+				createDepthSpaceCloud(_transform, _reprojector.depthRays(), arena(), depthImg, colorImg, roi.rect, xyzImg, mappedColorImg);
+				try {
+					emitPoints(gridSize(cloudSpace::depth), roi.rect, (int16_t*)k4a_image_get_buffer(xyzImg), k4a_image_get_buffer(mappedColorImg), crop, opts.threads, sink);
+				} catch (...) {
+					k4a_image_release(xyzImg);
+					k4a_image_release(mappedColorImg);
+					throw;
+				}
+				k4a_image_release(xyzImg);
+				k4a_image_release(mappedColorImg);
+				return;
+			}
+
+			glm::uvec2 size = gridSize(cloudSpace::color);
+			if (uint32_t(k4a_image_get_width_pixels(colorImg)) != size.x || uint32_t(k4a_image_get_height_pixels(colorImg)) != size.y) {
+				throw std::runtime_error("color image does not match calibration");
+			}
+			uint64_t count = uint64_t(size.x) * size.y;
+			uint16_t* colorDepth = (uint16_t*)arena().buffer(frameArena::colorDepthSlot, count * sizeof(uint16_t));
+			int16_t* xyz = (int16_t*)arena().buffer(frameArena::xyzSlot, count * sizeof(int16_t) * 3);
+			uint8_t const* bgra = k4a_image_get_buffer(colorImg);
+
+			// one fused pass, each row is emitted as soon as it has been rasterized and unprojected
+			pixelRect rect;
+			_reprojector.reprojectRows((uint16_t*)k4a_image_get_buffer(depthImg), crop ? &cropRoi(opts) : nullptr, colorDepth, xyz, opts.threads, [&](pixelRect const& colorRect) {
+				rect = colorRect;
+				sink.begin(glm::uvec2(rect.width(), rect.height()), rowBandCount(rect.height(), opts.threads));
+			}, [&](uint32_t band, uint32_t y) {
+				uint64_t first = uint64_t(y) * size.x + rect.min.x;
+				if (crop) cropPoints(xyz + first * 3, rect.width(), *crop);
+				sink.row(band, y - rect.min.y, xyz + first * 3, bgra + first * 4, rect.width());
+			});
+			sink.finish();
+		}
+
+		// copy values from other to this, then clear values from other
+		inline void move(cloudPipeline& other) {
+			_transform = other._transform;
+			_reprojector = std::move(other._reprojector);
+			_arena = std::move(other._arena);
+			_sharedArena = other._sharedArena;
+			_octree = std::move(other._octree);
+			_voxels = std::move(other._voxels);
+			_temporal = std::move(other._temporal);
+			_crop = other._crop;
+			_cropSpace = other._cropSpace;
+			_cropRoi = other._cropRoi;
+			_hasCropRoi = other._hasCropRoi;
+
+			other._transform = nullptr;
+		}
+	};
+
+#if KINECTCLOUD_EXPERIMENTAL
+	// load color image, load depth image, then convert into point cloud and save as pts file
+	// colorLoc = input color path
+	// depthLoc = input depth path
+	// expLoc   = output pts path
+	// conf     = config from the device which produced the color and depth images
+	void transformImage(std::string colorLoc, std::string depthLoc, std::string expLoc, deviceConfig const& conf) {
+		k4a_image_t colorImg = loadPNGtoK4A(colorLoc);
+		k4a_image_t depthImg = loadPNGtoK4A(depthLoc);
+
+		try {
+			if (colorImg == nullptr) throw std::runtime_error("failed to load color image");
+
+			if (depthImg == nullptr) throw std::runtime_error("failed to load depth image");
+
+			cloudPipeline pipeline(conf.cali);
+			ptsSink sink(expLoc);
+			pipeline.run(depthImg, colorImg, cloudOptions(), sink);
+		} catch (std::runtime_error const& er) {
+			std::cout << er.what() << "\n";
+		}
+
+		if (colorImg) k4a_image_release(colorImg);
+		if (depthImg) k4a_image_release(depthImg);
+	}
+#endif
+}
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <memory>
+
+#include "kinectUtil.h"
+
+namespace kinectCloud {
+	// number of bands rows can be split into with the given number of threads
+	inline uint32_t rowBandCount(uint32_t rows, int threads) {
+		return std::max(1u, std::min(uint32_t(std::max(1, threads)), rows));
+	}
+
+	// first row of band, bands split rows evenly
+	inline uint32_t rowBandStart(uint32_t rows, uint32_t bands, uint32_t band) {
+		return uint32_t(uint64_t(rows) * band / bands);
+	}
+
+	// split rows [0, rows) into rowBandCount(rows, threads) bands and run fn(band, firstRow, lastRow) on each
+	// band 0 runs on the calling thread
+	template<class F>
+	void forEachRowBand(uint32_t rows, int threads, F&& fn) {
+		uint32_t bands = rowBandCount(rows, threads);
+		std::vector<std::thread> workers;
+		for (uint32_t b = 1; b < bands; b++) {
+			workers.emplace_back([&fn, rows, bands, b]() { fn(b, rowBandStart(rows, bands, b), rowBandStart(rows, bands, b + 1)); });
+		}
+		fn(0u, 0u, rowBandStart(rows, bands, 1));
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	// intrinsics of one camera, projects the same way as k4a_calibration_3d_to_2d
+	struct lensModel {
+		k4a_calibration_intrinsic_parameters_t params;
+		bool rational = false;
+		float maxRadiusSquared = 0.f;
+
+		lensModel() : params{} {}
+
+		lensModel(k4a_calibration_camera_t const& cam) : params(cam.intrinsics.parameters) {
+			rational = cam.intrinsics.type == K4A_CALIBRATION_LENS_DISTORTION_MODEL_RATIONAL_6KT;
+			float radius = params.param.metric_radius;
+			maxRadiusSquared = radius > 0.f ? radius * radius : std::numeric_limits<float>::infinity();
+		}
+
+		// project a point in camera coordinates (mm, z > 0) onto the image
+		// returns false outside the calibrated radius of the lens
+		inline bool project(float x, float y, float z, float& u, float& v) const {
+			auto const& p = params.param;
+			float xp = x / z - p.codx, yp = y / z - p.cody;
+			float xp2 = xp * xp, yp2 = yp * yp, xyp = xp * yp, rs = xp2 + yp2;
+			if (rs > maxRadiusSquared) return false;
+
+			float rss = rs * rs, rsc = rss * rs;
+			float a = 1.f + p.k1 * rs + p.k2 * rss + p.k3 * rsc;
+			float b = 1.f + p.k4 * rs + p.k5 * rss + p.k6 * rsc;
+			float d = a * (b != 0.f ? 1.f / b : 1.f);
+
+			// brown conrady doubles the cross term of the tangential distortion, rational 6kt does not
+			float cross = rational ? 1.f : 2.f;
+			float xpd = xp * d + (rs + 2.f * xp2) * p.p2 + cross * xyp * p.p1;
+			float ypd = yp * d + (rs + 2.f * yp2) * p.p1 + cross * xyp * p.p2;
+
+			u = (xpd + p.codx) * p.fx + p.cx;
+			v = (ypd + p.cody) * p.fy + p.cy;
+			return true;
+		}
+	};
+
+	// depth pixels a reprojection looks at, a rectangle of the depth image and a window of depth values
+	// pixels outside either are treated as invalid, see cropToDepthRoi
+	struct depthRoi {
+		pixelRect rect;
+		uint16_t minDepth = 1;
+		uint16_t maxDepth = 65535;
+	};
+
+	// depth to color reprojection for one calibration, replaces k4a_transformation_depth_image_to_color_camera
+	// depth pixels are projected into the color camera and every 2x2 block of valid depth is rasterized as two
+	// triangles into a color sized z buffer, the nearest surface wins. color rows are split into bands,
+	// each band owns its rows of the z buffer so no synchronization is needed.
+	// reprojectRows additionally unprojects each finished row and hands it on while it is still in cache,
+	// which replaces the sdk transform and the point cloud transform with one kernel
+	class depthReprojector {
+		k4a_calibration_t _cali;
+		lensModel _colorLens;
+		k4a_calibration_extrinsics_t _depthToColor;
+		// read only once built, shared by every reprojector of the calibration, see share
+		std::shared_ptr<rayTable const> _colorRays;
+		std::shared_ptr<rayTable const> _depthRays;
+
+		// the lens model is checked against the sdk on construction, if it disagrees every pixel is projected by the sdk
+		bool _sdkProjection = false;
+
+		// depth pixels projected into the color camera, z is 0 where invalid. reused across frames, one set per reprojector
+		std::vector<float> _u, _v, _z;
+
+		// color rows the projected pixels of each depth row span, min > max if the row has none. a band of color rows
+		// only visits the quads of the depth rows which can reach it
+		std::vector<float> _rowMinV, _rowMaxV;
+	public:
+		// quads whose depth varies by more than this fraction of their nearest depth span a silhouette
+		// and are left empty instead of being stretched between foreground and background
+		static constexpr float maxDepthStep = 0.05f;
+
+		depthReprojector() : _cali{}, _depthToColor{}, _colorRays(std::make_shared<rayTable const>()), _depthRays(std::make_shared<rayTable const>()) {}
+
+		depthReprojector(k4a_calibration_t const& cali) : _cali(cali) {
+			_colorLens = lensModel(cali.color_camera_calibration);
+			_depthToColor = cali.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR];
+			_colorRays = std::make_shared<rayTable const>(createRayTable(cali, K4A_CALIBRATION_TYPE_COLOR));
+			_depthRays = std::make_shared<rayTable const>(createRayTable(cali, K4A_CALIBRATION_TYPE_DEPTH));
+
+			_sdkProjection = projectionError() > 0.01f;
+		}
+
+		// reprojector of the same calibration for another thread, the ray tables are shared and only the projection
+		// buffers, allocated on its first frame, are its own
+		inline depthReprojector share() const {
+			depthReprojector res;
+			res._cali = _cali;
+			res._colorLens = _colorLens;
+			res._depthToColor = _depthToColor;
+			res._colorRays = _colorRays;
+			res._depthRays = _depthRays;
+			res._sdkProjection = _sdkProjection;
+			return res;
+		}
+
+		inline rayTable const& colorRays() const {
+			return *_colorRays;
+		}
+
+		inline rayTable const& depthRays() const {
+			return *_depthRays;
+		}
+
+		inline k4a_calibration_t const& calibration() const {
+			return _cali;
+		}
+
+		// every depth pixel and depth
+		inline depthRoi fullRoi() const {
+			depthRoi roi;
+			roi.rect.max = depthRays().size;
+			return roi;
+		}
+
+		// true if the lens model did not match the sdk and projection goes through k4a_calibration_3d_to_2d
+		inline bool usesSdkProjection() const {
+			return _sdkProjection;
+		}
+
+		// largest difference in pixels between the lens model and k4a_calibration_3d_to_2d over a grid of depth pixels
+		float projectionError() const {
+			float maxError = 0.f;
+			for (uint32_t y = 0; y < depthRays().size.y; y += 7) {
+				for (uint32_t x = 0; x < depthRays().size.x; x += 7) {
+					uint64_t i = uint64_t(y) * depthRays().size.x + x;
+					if (std::isnan(depthRays().x[i])) continue;
+					for (float depth : { 500.f, 1500.f, 4000.f }) {
+						k4a_float3_t point;
+						point.xyz.x = depthRays().x[i] * depth;
+						point.xyz.y = depthRays().y[i] * depth;
+						point.xyz.z = depth;
+						k4a_float2_t sdk;
+						int valid = 0;
+						if (K4A_RESULT_SUCCEEDED != k4a_calibration_3d_to_2d(&_cali, &point, K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_COLOR, &sdk, &valid) || !valid) continue;
+
+						float u, v;
+						glm::vec3 c = toColor(point.xyz.x, point.xyz.y, point.xyz.z);
+						if (c.z <= 0.f || !_colorLens.project(c.x, c.y, c.z, u, v)) return std::numeric_limits<float>::infinity();
+						maxError = std::max(maxError, std::max(std::abs(u - sdk.xy.x), std::abs(v - sdk.xy.y)));
+					}
+				}
+			}
+			return maxError;
+		}
+
+		// depth16 in depth camera geometry to depth16 in color camera geometry (colorDepth must be color sized)
+		void depthToColor(uint16_t const* depth, uint16_t* colorDepth, int threads) {
+			depthRoi roi = fullRoi();
+			pixelRect colorRect;
+			colorRect.max = colorRays().size;
+			projectRoi(depth, roi, threads);
+			forEachRowBand(colorRays().size.y, threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+				rasterizeRows(colorDepth, roi.rect, colorRect, firstRow, lastRow);
+			});
+		}
+
+		// depthToColor followed by unprojection into xyz (3 int16 per color pixel), one band of color rows per thread
+		// only the depth pixels of roi are reprojected, and only the color pixels they can cover are touched, so the
+		// work scales with the roi. without a roi every depth pixel and every color pixel is used
+		// begin(colorRect) is called on the calling thread once the color rectangle is known, before any row.
+		// the rows of colorRect are split into rowBandCount(colorRect.height(), threads) bands
+		// fn(band, y) is called on the band's thread as soon as row y of xyz is complete, rows of a band in order
+		// xyz and colorDepth outside colorRect are left undefined
+		template<class B, class F>
+		void reprojectRows(uint16_t const* depth, depthRoi const* roi, uint16_t* colorDepth, int16_t* xyz, int threads, B&& begin, F&& fn) {
+			uint32_t width = colorRays().size.x;
+			depthRoi used = roi ? *roi : fullRoi();
+			pixelRect colorRect = projectRoi(depth, used, threads);
+			if (!roi) {
+				colorRect.min = glm::uvec2(0, 0);
+				colorRect.max = colorRays().size;
+			}
+			begin(colorRect);
+			forEachRowBand(colorRect.height(), threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+				rasterizeRows(colorDepth, used.rect, colorRect, colorRect.min.y + firstRow, colorRect.min.y + lastRow);
+				for (uint32_t y = colorRect.min.y + firstRow; y < colorRect.min.y + lastRow; y++) {
+					uint64_t first = uint64_t(y) * width + colorRect.min.x;
+					depthToXyz(colorRays(), colorDepth + first, xyz + first * 3, first, colorRect.width());
+					fn(band, y);
+				}
+			});
+		}
+
+	private:
+		// projection buffers for every depth pixel, once
+		inline void allocateProjection() {
+			uint64_t depthCount = uint64_t(depthRays().size.x) * depthRays().size.y;
+			_u.resize(depthCount);
+			_v.resize(depthCount);
+			_z.resize(depthCount);
+			_rowMinV.resize(depthRays().size.y);
+			_rowMaxV.resize(depthRays().size.y);
+		}
+
+		// depth camera coordinates to color camera coordinates
+		inline glm::vec3 toColor(float x, float y, float z) const {
+			float const* r = _depthToColor.rotation;
+			float const* t = _depthToColor.translation;
+			return glm::vec3(
+				r[0] * x + r[1] * y + r[2] * z + t[0],
+				r[3] * x + r[4] * y + r[5] * z + t[1],
+				r[6] * x + r[7] * y + r[8] * z + t[2]
+			);
+		}
+
+		// project the depth pixels of roi into the color camera, split by depth rows, and note the color rows each
+		// depth row spans. returns the color pixels whose centers the projected pixels can cover
+		pixelRect projectRoi(uint16_t const* depth, depthRoi const& roi, int threads) {
+			allocateProjection();
+			glm::uvec2 size = depthRays().size;
+			uint32_t bands = rowBandCount(roi.rect.height(), threads);
+			std::vector<glm::vec2> low(bands, glm::vec2(std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()));
+			std::vector<glm::vec2> high(bands, glm::vec2(-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()));
+			forEachRowBand(roi.rect.height(), threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+				glm::vec2 bandLow = low[band], bandHigh = high[band];
+				for (uint32_t y = roi.rect.min.y + firstRow; y < roi.rect.min.y + lastRow; y++) {
+					float rowMinV = std::numeric_limits<float>::infinity(), rowMaxV = -std::numeric_limits<float>::infinity();
+					for (uint64_t i = uint64_t(y) * size.x + roi.rect.min.x; i < uint64_t(y) * size.x + roi.rect.max.x; i++) {
+						_z[i] = 0.f;
+						float rayX = depthRays().x[i], rayY = depthRays().y[i];
+						if (depth[i] < roi.minDepth || depth[i] > roi.maxDepth || std::isnan(rayX)) continue;
+
+						float d = float(depth[i]);
+						glm::vec3 c = toColor(rayX * d, rayY * d, d);
+						if (c.z <= 0.f) continue;
+
+						float u, v;
+						if (_sdkProjection) {
+							k4a_float3_t point;
+							point.xyz.x = c.x;
+							point.xyz.y = c.y;
+							point.xyz.z = c.z;
+							k4a_float2_t pixel;
+							int valid = 0;
+							if (K4A_RESULT_SUCCEEDED != k4a_calibration_3d_to_2d(&_cali, &point, K4A_CALIBRATION_TYPE_COLOR, K4A_CALIBRATION_TYPE_COLOR, &pixel, &valid) || !valid) continue;
+							u = pixel.xy.x;
+							v = pixel.xy.y;
+						} else if (!_colorLens.project(c.x, c.y, c.z, u, v)) {
+							continue;
+						}
+
+						_u[i] = u;
+						_v[i] = v;
+						_z[i] = c.z;
+						rowMinV = std::min(rowMinV, v);
+						rowMaxV = std::max(rowMaxV, v);
+						bandLow.x = std::min(bandLow.x, u);
+						bandHigh.x = std::max(bandHigh.x, u);
+					}
+					_rowMinV[y] = rowMinV;
+					_rowMaxV[y] = rowMaxV;
+					bandLow.y = std::min(bandLow.y, rowMinV);
+					bandHigh.y = std::max(bandHigh.y, rowMaxV);
+				}
+				low[band] = bandLow;
+				high[band] = bandHigh;
+			});
+
+			pixelRect res;
+			glm::vec2 minUv = low[0], maxUv = high[0];
+			for (uint32_t b = 1; b < bands; b++) {
+				minUv = glm::vec2(std::min(minUv.x, low[b].x), std::min(minUv.y, low[b].y));
+				maxUv = glm::vec2(std::max(maxUv.x, high[b].x), std::max(maxUv.y, high[b].y));
+			}
+			if (minUv.x > maxUv.x) return res;
+			glm::vec2 limit(float(colorRays().size.x), float(colorRays().size.y));
+			res.min = glm::uvec2(uint32_t(std::ceil(std::max(0.f, std::min(limit.x, minUv.x)))), uint32_t(std::ceil(std::max(0.f, std::min(limit.y, minUv.y)))));
+			res.max = glm::uvec2(uint32_t(std::floor(std::max(-1.f, std::min(limit.x - 1.f, maxUv.x))) + 1.f), uint32_t(std::floor(std::max(-1.f, std::min(limit.y - 1.f, maxUv.y))) + 1.f));
+			return res;
+		}
+
+		// clear rows [firstRow, lastRow) of colorRect in the z buffer and rasterize every quad of depthRect which touches them
+		// colorRect must hold every projected pixel of depthRect. depth rows which can't reach these rows are skipped whole,
+		// so with several bands the quads are still scanned about once in total
+		void rasterizeRows(uint16_t* colorDepth, pixelRect const& depthRect, pixelRect const& colorRect, uint32_t firstRow, uint32_t lastRow) {
+			glm::uvec2 depthSize = depthRays().size;
+			uint32_t colorWidth = colorRays().size.x;
+			for (uint32_t y = firstRow; y < lastRow; y++) {
+				uint16_t* row = colorDepth + uint64_t(y) * colorWidth;
+				std::fill(row + colorRect.min.x, row + colorRect.max.x, uint16_t(0));
+			}
+
+			for (uint32_t y = depthRect.min.y; y + 1 < depthRect.max.y; y++) {
+				if (std::max(_rowMaxV[y], _rowMaxV[y + 1]) < float(firstRow) || std::min(_rowMinV[y], _rowMinV[y + 1]) > float(lastRow) - 1.f) continue;
+				for (uint32_t x = depthRect.min.x; x + 1 < depthRect.max.x; x++) {
+					uint64_t a = uint64_t(y) * depthSize.x + x, b = a + 1, c = a + depthSize.x, d = c + 1;
+					float za = _z[a], zb = _z[b], zc = _z[c], zd = _z[d];
+					if (za == 0.f || zb == 0.f || zc == 0.f || zd == 0.f) continue;
+
+					float minV = std::min(std::min(_v[a], _v[b]), std::min(_v[c], _v[d]));
+					float maxV = std::max(std::max(_v[a], _v[b]), std::max(_v[c], _v[d]));
+					if (maxV < float(firstRow) || minV > float(lastRow) - 1.f) continue;
+
+					float minZ = std::min(std::min(za, zb), std::min(zc, zd));
+					float maxZ = std::max(std::max(za, zb), std::max(zc, zd));
+					if (maxZ - minZ > minZ * maxDepthStep) continue;
+
+					rasterizeTriangle(colorDepth, a, b, c, firstRow, lastRow);
+					rasterizeTriangle(colorDepth, b, d, c, firstRow, lastRow);
+				}
+			}
+		}
+
+		// fill pixel centers covered by a triangle of projected depth pixels with interpolated depth, nearest wins
+		inline void rasterizeTriangle(uint16_t* colorDepth, uint64_t i0, uint64_t i1, uint64_t i2, uint32_t firstRow, uint32_t lastRow) {
+			float u0 = _u[i0], v0 = _v[i0], u1 = _u[i1], v1 = _v[i1], u2 = _u[i2], v2 = _v[i2];
+			float area = (u1 - u0) * (v2 - v0) - (u2 - u0) * (v1 - v0);
+			if (std::abs(area) < 1e-6f) return;
+			float invArea = 1.f / area;
+
+			int colorWidth = int(colorRays().size.x);
+			int xBegin = std::max(0, int(std::ceil(std::min(std::min(u0, u1), u2))));
+			int xEnd = std::min(colorWidth - 1, int(std::floor(std::max(std::max(u0, u1), u2))));
+			int yBegin = std::max(int(firstRow), int(std::ceil(std::min(std::min(v0, v1), v2))));
+			int yEnd = std::min(int(lastRow) - 1, int(std::floor(std::max(std::max(v0, v1), v2))));
+
+			// small tolerance so edges shared by neighbouring triangles never leave a crack
+			const float eps = -1e-4f;
+			for (int y = yBegin; y <= yEnd; y++) {
+				for (int x = xBegin; x <= xEnd; x++) {
+					float w0 = ((u1 - float(x)) * (v2 - float(y)) - (u2 - float(x)) * (v1 - float(y))) * invArea;
+					float w1 = ((u2 - float(x)) * (v0 - float(y)) - (u0 - float(x)) * (v2 - float(y))) * invArea;
+					float w2 = 1.f - w0 - w1;
+					if (w0 < eps || w1 < eps || w2 < eps) continue;
+
+					float z = w0 * _z[i0] + w1 * _z[i1] + w2 * _z[i2];
+					uint16_t depth = uint16_t(std::min(z + 0.5f, 65535.f));
+					uint16_t& current = colorDepth[uint64_t(y) * colorWidth + x];
+					if (current == 0 || depth < current) current = depth;
+				}
+			}
+		}
+	};
+}
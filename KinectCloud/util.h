@@ -2,6 +2,8 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
 #include <iostream>
@@ -10,6 +12,12 @@
 #include <glm/ext.hpp>
 #include <lodepng.h>
 
+// sse4.1 is available on every x64 host that meets the azure kinect sdk requirements
+#if defined(_M_X64) || defined(__SSE4_1__)
+#define KINECTCLOUD_SSE
+#include <smmintrin.h>
+#endif
+
 namespace kinectCloud {
 
 	// convert all uppercase chars into lowercase chars
@@ -88,26 +96,38 @@ namespace kinectCloud {
 		return base;
 	}
 
-	char*	data;
-	char*	begins[65536];
-	int		sizes[65536];
-
-	// create list of all int16s
-	void initFastString() {
-		data = (char*)malloc(500 * 1024 * 1024);
-		begins[0] = data;
-		for (int i = 0; i <= ((int)std::numeric_limits<int16_t>::max() - (int)std::numeric_limits<int16_t>::min()); ++i) {
-			sprintf(begins[i], "%hd", i + (int)std::numeric_limits<int16_t>::min());
-			sizes[i] = strlen(begins[i]);
-			if (i != ((int)std::numeric_limits<int16_t>::max() - (int)std::numeric_limits<int16_t>::min())) begins[i + 1] = begins[i] + sizes[i];
+	// zero padded 4 digit strings "0000" to "9999" back to back, built once at static init
+	// (a constexpr loop of 10000 steps is close to msvc's default constexpr evaluation limit)
+	// padded by 3 bytes so a 4 byte copy may start anywhere inside the last entry
+	struct fixedDigitTable {
+		char digits[10000 * 4 + 3];
+
+		fixedDigitTable() : digits() {
+			for (int i = 0; i < 10000; i++) {
+				digits[i * 4 + 0] = '0' + (i / 1000) % 10;
+				digits[i * 4 + 1] = '0' + (i / 100) % 10;
+				digits[i * 4 + 2] = '0' + (i / 10) % 10;
+				digits[i * 4 + 3] = '0' + i % 10;
+			}
 		}
-	}
-	
+	};
+	const fixedDigitTable fixedDigits;
+
 	// similar to sprintf(start, "%d", val)
-	// but may be slightly faster due to caching all int16s
+	// branch free, the sign and the fifth digit are always stored and only kept when needed,
+	// the last 4 digits are one fixed width copy, so up to 3 bytes past the returned pointer may be overwritten
 	char* fastCopyInt16Str(char* start, int16_t val) {
-		memcpy(start, begins[val - (int)std::numeric_limits<int16_t>::min()], sizes[val - (int)std::numeric_limits<int16_t>::min()]);
-		return start + sizes[val - (int)std::numeric_limits<int16_t>::min()];
+		uint32_t abs = val < 0 ? uint32_t(-int32_t(val)) : uint32_t(val);
+		uint32_t high = abs / 10000, low = abs % 10000;
+
+		*start = '-';
+		start += (val < 0);
+		*start = char('0' + high);
+		start += (high != 0);
+
+		uint32_t length = high ? 4 : 1 + (low >= 10) + (low >= 100) + (low >= 1000);
+		memcpy(start, fixedDigits.digits + low * 4 + (4 - length), 4);
+		return start + length;
 	}
 
 #ifdef KINECTCLOUD_EXPERIMENTAL
@@ -0,0 +1,306 @@
+#pragma once
+
+#include "kinectUtil.h"
+#include "reprojection.h"
+
+namespace kinectCloud {
+	// sums of the points which fell into one voxel
+	struct voxelEntry {
+		uint64_t key;
+		int64_t sum[3];
+		uint32_t color[3];	// b g r
+		uint32_t count;
+		int16_t first[3];
+	};
+
+	// 64 bit murmur3 finalizer, every bit of key affects every bit of the hash
+	inline uint64_t voxelHash(uint64_t key) {
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdull;
+		key ^= key >> 33;
+		key *= 0xc4ceb3fe1a85ec53ull;
+		key ^= key >> 33;
+		return key;
+	}
+
+	// open addressing hash of voxel keys with linear probing, grows at half load
+	// entries stay dense in insertion order, the slots only hold their indices
+	class voxelTable {
+		std::vector<voxelEntry> _entries;
+		std::vector<uint32_t> _slots;
+		uint32_t _shift = 64;
+	public:
+		static constexpr uint32_t emptySlot = 0xFFFFFFFF;
+
+		inline void clear() {
+			_entries.clear();
+			if (_slots.empty()) resize(1 << 12);
+			std::fill(_slots.begin(), _slots.end(), emptySlot);
+		}
+
+		inline std::vector<voxelEntry> const& entries() const {
+			return _entries;
+		}
+
+		// entry of key, created empty if key is new. hash = voxelHash(key)
+		inline voxelEntry& find(uint64_t key, uint64_t hash) {
+			uint64_t mask = _slots.size() - 1;
+			for (uint64_t slot = hash >> _shift; ; slot = (slot + 1) & mask) {
+				uint32_t index = _slots[slot];
+				if (index == emptySlot) {
+					if ((_entries.size() + 1) * 2 > _slots.size()) {
+						resize(_slots.size() * 2);
+						return find(key, hash);
+					}
+					_slots[slot] = uint32_t(_entries.size());
+					_entries.push_back({ key, { 0, 0, 0 }, { 0, 0, 0 }, 0, { 0, 0, 0 } });
+					return _entries.back();
+				}
+				if (_entries[index].key == key) return _entries[index];
+			}
+		}
+
+		// start loading the slot of hash into the cache, lookups of a row would otherwise wait on memory one by one
+		inline void prefetch(uint64_t hash) const {
+#ifdef KINECTCLOUD_SSE
+			_mm_prefetch((char const*)(_slots.data() + (hash >> _shift)), _MM_HINT_T0);
+#elif defined(__GNUC__)
+			__builtin_prefetch(_slots.data() + (hash >> _shift));
+#endif
+		}
+
+		// add the sums of other, which was collected after this entry's points
+		inline void merge(voxelEntry const& other, uint64_t hash) {
+			voxelEntry& entry = find(other.key, hash);
+			if (entry.count == 0) memcpy(entry.first, other.first, sizeof(entry.first));
+			for (int c = 0; c < 3; c++) {
+				entry.sum[c] += other.sum[c];
+				entry.color[c] += other.color[c];
+			}
+			entry.count += other.count;
+		}
+
+	private:
+
+		inline void resize(size_t slots) {
+			_slots.assign(slots, emptySlot);
+			_shift = 64;
+			for (size_t s = slots; s > 1; s >>= 1) _shift--;
+			uint64_t mask = slots - 1;
+			for (uint32_t i = 0; i < _entries.size(); i++) {
+				uint64_t slot = voxelHash(_entries[i].key) >> _shift;
+				while (_slots[slot] != emptySlot) slot = (slot + 1) & mask;
+				_slots[slot] = i;
+			}
+		}
+	};
+
+	// voxel grid downsampling state, buffers are kept between frames. not thread safe
+	// every band collects its voxels into its own table, then the tables are merged in parallel,
+	// each merge thread owning the voxels whose hash falls into its partition. the result does not depend on thread timing
+	class voxelGrid {
+		// prefetch distance of the lookups of a row, in runs
+		static constexpr size_t prefetchRuns = 8;
+
+		std::vector<voxelTable> _bands, _partitions;
+		std::vector<std::vector<voxelEntry>> _runs;
+		std::vector<std::vector<uint64_t>> _hashes;
+		std::vector<std::vector<uint32_t>> _buckets, _bucketStart;
+		std::vector<int16_t> _xyz;
+		std::vector<uint8_t> _bgra;
+		uint64_t _voxels = 0;
+	public:
+		// index of the voxel coordinate v falls into
+		static inline int32_t cell(int16_t v, int32_t size) {
+			return v >= 0 ? v / size : -((-v + size - 1) / size);
+		}
+
+		// 21 bits per axis, enough for any int16 coordinate at a 1 mm voxel
+		static inline uint64_t key(int16_t x, int16_t y, int16_t z, int32_t size) {
+			const int32_t offset = 1 << 20;
+			return (uint64_t(cell(x, size) + offset) << 42) | (uint64_t(cell(y, size) + offset) << 21) | uint64_t(cell(z, size) + offset);
+		}
+
+		// start a frame whose points arrive in bands
+		inline void begin(uint32_t bands) {
+			_bands.resize(bands);
+			_runs.resize(bands);
+			_hashes.resize(bands);
+			for (auto& band : _bands) band.clear();
+		}
+
+		// add the valid points of one row to band
+		// runs of points in the same voxel are summed first, then the runs are looked up with their slots prefetched
+		inline void add(uint32_t band, int16_t const* xyz, uint8_t const* bgra, uint32_t width, int32_t size) {
+			std::vector<voxelEntry>& runs = _runs[band];
+			std::vector<uint64_t>& hashes = _hashes[band];
+			runs.clear();
+			for (uint32_t x = 0; x < width; x++) {
+				int16_t const* p = xyz + x * 3;
+				if (p[0] == 0 && p[1] == 0 && p[2] == 0) continue;
+				uint64_t k = key(p[0], p[1], p[2], size);
+				if (runs.empty() || k != runs.back().key) {
+					runs.push_back({ k, { 0, 0, 0 }, { 0, 0, 0 }, 0, { p[0], p[1], p[2] } });
+				}
+				voxelEntry& run = runs.back();
+				for (int c = 0; c < 3; c++) {
+					run.sum[c] += p[c];
+					run.color[c] += bgra[x * 4 + c];
+				}
+				run.count++;
+			}
+
+			voxelTable& table = _bands[band];
+			hashes.resize(runs.size());
+			for (size_t i = 0; i < runs.size(); i++) {
+				hashes[i] = voxelHash(runs[i].key);
+				if (i < prefetchRuns) table.prefetch(hashes[i]);
+			}
+			for (size_t i = 0; i < runs.size(); i++) {
+				if (i + prefetchRuns < runs.size()) table.prefetch(hashes[i + prefetchRuns]);
+				table.merge(runs[i], hashes[i]);
+			}
+		}
+
+		// merge the bands and build the downsampled points as rows of width, padded with invalid points
+		// returns the number of rows, xyz() and bgra() hold them until the next frame
+		inline uint32_t finish(uint32_t width, voxelMode mode, int threads) {
+			// a single band already holds every voxel once
+			uint32_t partitions = _bands.size() > 1 ? std::max(1, threads) : 1;
+			std::vector<voxelTable> const& merged = _bands.size() > 1 ? _partitions : _bands;
+			if (_bands.size() > 1) {
+				_partitions.resize(partitions);
+				_buckets.resize(_bands.size());
+				_bucketStart.resize(_bands.size());
+
+				// every band sorts its voxels by partition, so a partition only reads its own
+				parallelFor(uint32_t(_bands.size()), [this, partitions](uint32_t b) {
+					std::vector<voxelEntry> const& entries = _bands[b].entries();
+					std::vector<uint64_t>& hashes = _hashes[b];
+					std::vector<uint32_t>& start = _bucketStart[b];
+					hashes.resize(entries.size());
+					_buckets[b].resize(entries.size());
+					start.assign(partitions + 1, 0);
+					for (size_t i = 0; i < entries.size(); i++) {
+						hashes[i] = voxelHash(entries[i].key);
+						start[uint32_t(hashes[i]) % partitions + 1]++;
+					}
+					for (uint32_t p = 0; p < partitions; p++) start[p + 1] += start[p];
+					std::vector<uint32_t> next(start.begin(), start.end() - 1);
+					for (uint32_t i = 0; i < entries.size(); i++) {
+						_buckets[b][next[uint32_t(hashes[i]) % partitions]++] = i;
+					}
+				});
+
+				parallelFor(partitions, [this](uint32_t p) {
+					voxelTable& table = _partitions[p];
+					table.clear();
+					for (size_t b = 0; b < _bands.size(); b++) {
+						std::vector<voxelEntry> const& entries = _bands[b].entries();
+						std::vector<uint32_t> const& bucket = _buckets[b];
+						uint32_t end = _bucketStart[b][p + 1];
+						for (uint32_t k = _bucketStart[b][p]; k < end; k++) {
+							if (k + prefetchRuns < end) table.prefetch(_hashes[b][bucket[k + prefetchRuns]]);
+							table.merge(entries[bucket[k]], _hashes[b][bucket[k]]);
+						}
+					}
+				});
+			}
+
+			std::vector<uint64_t> start(partitions + 1, 0);
+			for (uint32_t p = 0; p < partitions; p++) {
+				start[p + 1] = start[p] + merged[p].entries().size();
+			}
+			_voxels = start[partitions];
+			uint32_t rows = uint32_t((_voxels + width - 1) / width);
+			uint64_t padded = uint64_t(rows) * width;
+			_xyz.resize(padded * 3);
+			_bgra.resize(padded * 4);
+			std::fill(_xyz.begin() + _voxels * 3, _xyz.end(), int16_t(0));
+
+			parallelFor(partitions, [&](uint32_t p) {
+				uint64_t i = start[p];
+				for (auto const& entry : merged[p].entries()) {
+					int16_t* xyz = _xyz.data() + i * 3;
+					uint8_t* bgra = _bgra.data() + i * 4;
+					for (int c = 0; c < 3; c++) {
+						xyz[c] = mode == voxelMode::first ? entry.first[c] : int16_t(std::llround(double(entry.sum[c]) / entry.count));
+						bgra[c] = uint8_t((entry.color[c] + entry.count / 2) / entry.count);
+					}
+					// a centroid can round to the origin, which marks invalid points
+					if (xyz[0] == 0 && xyz[1] == 0 && xyz[2] == 0) xyz[2] = 1;
+					bgra[3] = 255;
+					i++;
+				}
+			});
+			return rows;
+		}
+
+		// number of voxels of the last frame
+		inline uint64_t voxels() const {
+			return _voxels;
+		}
+
+		inline int16_t const* xyz() const {
+			return _xyz.data();
+		}
+
+		inline uint8_t const* bgra() const {
+			return _bgra.data();
+		}
+
+	private:
+
+		// run fn(i) for every i in [0, n), each on its own thread, 0 on the calling thread
+		template<class F>
+		static void parallelFor(uint32_t n, F&& fn) {
+			std::vector<std::thread> workers;
+			for (uint32_t i = 1; i < n; i++) {
+				workers.emplace_back([&fn, i]() { fn(i); });
+			}
+			if (n) fn(0u);
+			for (auto& worker : workers) {
+				worker.join();
+			}
+		}
+	};
+
+	// pipeline stage which downsamples to one point per voxel before handing the points to sink
+	// the voxel points reach sink as rows as wide as the input grid, so any sink works unchanged
+	template<class Sink>
+	class voxelSink {
+		voxelGrid& _grid;
+		int32_t _size;
+		voxelMode _mode;
+		int _threads;
+		Sink& _sink;
+		uint32_t _width = 0;
+	public:
+		// size = voxel edge in mm
+		inline voxelSink(voxelGrid& grid, int size, voxelMode mode, int threads, Sink& sink) :
+			_grid(grid), _size(std::max(1, size)), _mode(mode), _threads(threads), _sink(sink) { }
+
+		inline void begin(glm::uvec2 size, uint32_t bands) {
+			_width = size.x;
+			_grid.begin(bands);
+		}
+
+		inline void row(uint32_t band, uint32_t y, int16_t const* xyz, uint8_t const* bgra, uint32_t width) {
+			_grid.add(band, xyz, bgra, width, _size);
+		}
+
+		inline void finish() {
+			uint32_t rows = _grid.finish(_width, _mode, _threads);
+			int16_t const* xyz = _grid.xyz();
+			uint8_t const* bgra = _grid.bgra();
+			_sink.begin(glm::uvec2(_width, rows), rowBandCount(rows, _threads));
+			forEachRowBand(rows, _threads, [&](uint32_t band, uint32_t firstRow, uint32_t lastRow) {
+				for (uint32_t y = firstRow; y < lastRow; y++) {
+					uint64_t first = uint64_t(y) * _width;
+					_sink.row(band, y, xyz + first * 3, bgra + first * 4, _width);
+				}
+			});
+			_sink.finish();
+		}
+	};
+}
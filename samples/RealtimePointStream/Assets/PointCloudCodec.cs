@@ -0,0 +1,84 @@
+﻿using System;
+
+// decoder for the compressed frames served at /frame/{n}/compressed, see cloudCodec.h for the format
+public static class PointCloudCodec
+{
+    const int ProbBits = 12;
+    const uint LowerBound = 1u << 23;
+
+    // decode a compressed frame into the same layout as /frame/{n}:
+    // [uint64 numPoints] then 9 bytes per point, [int16 x][int16 y][int16 z][uint8 b][uint8 g][uint8 r]
+    public static byte[] Decode(byte[] data) {
+        if (data.Length < 14 || data[0] != 'K' || data[1] != 'C' || data[2] != 'Z' || data[3] != '1') {
+            throw new FormatException("not a compressed point cloud");
+        }
+        int count = (int)BitConverter.ToUInt64(data, 4);
+        int step = BitConverter.ToUInt16(data, 12);
+        int pos = 14;
+
+        byte[][] symbols = new byte[6][];
+        for (int s = 0; s < 6; s++) {
+            symbols[s] = DecodeStream(data, ref pos, count);
+        }
+
+        int escapeCount = (int)BitConverter.ToUInt32(data, pos);
+        pos += 4;
+        int nextEscape = pos;
+
+        byte[] res = new byte[8 + (long)count * 9];
+        BitConverter.GetBytes((ulong)count).CopyTo(res, 0);
+        int[] previous = new int[3];
+        byte[] previousColor = new byte[3];
+        for (int i = 0; i < count; i++) {
+            int o = 8 + i * 9;
+            for (int c = 0; c < 3; c++) {
+                int s = symbols[c][i];
+                if (s == 255) {
+                    previous[c] = BitConverter.ToInt16(data, nextEscape);
+                    nextEscape += 2;
+                } else {
+                    previous[c] += (s >> 1) ^ -(s & 1);
+                }
+                short v = (short)(previous[c] * step);
+                res[o + c * 2] = (byte)v;
+                res[o + c * 2 + 1] = (byte)(v >> 8);
+            }
+            for (int c = 0; c < 3; c++) {
+                previousColor[c] = (byte)(previousColor[c] + symbols[3 + c][i]);
+                res[o + 6 + c] = previousColor[c];
+            }
+        }
+        return res;
+    }
+
+    // one rans stream, [uint16 freq[256]][uint32 numBytes][bytes]
+    static byte[] DecodeStream(byte[] data, ref int pos, int count) {
+        uint[] freq = new uint[256];
+        uint[] start = new uint[256];
+        byte[] slotSymbol = new byte[1 << ProbBits];
+        uint cumulative = 0;
+        for (int s = 0; s < 256; s++) {
+            freq[s] = BitConverter.ToUInt16(data, pos + s * 2);
+            start[s] = cumulative;
+            for (uint k = 0; k < freq[s]; k++) slotSymbol[cumulative + k] = (byte)s;
+            cumulative += freq[s];
+        }
+        int bytes = (int)BitConverter.ToUInt32(data, pos + 512);
+        int ptr = pos + 516;
+        pos = ptr + bytes;
+
+        byte[] symbols = new byte[count];
+        const uint mask = (1u << ProbBits) - 1;
+        uint x = BitConverter.ToUInt32(data, ptr);
+        ptr += 4;
+        for (int i = 0; i < count; i++) {
+            byte s = slotSymbol[x & mask];
+            symbols[i] = s;
+            x = freq[s] * (x >> ProbBits) + (x & mask) - start[s];
+            while (x < LowerBound) {
+                x = (x << 8) | data[ptr++];
+            }
+        }
+        return symbols;
+    }
+}
@@ -17,7 +17,14 @@ public class PointStream : MonoBehaviour
 
     UnityWebRequestAsyncOperation responseResult = null;
 
-    public string URI = "http://localhost:5687/frame/latest";
+    // long poll, the server answers once a frame newer than the last one received exists
+    public string URI = "http://localhost:5687/frame/next";
+
+    // set when URI points at a compressed endpoint, e.g. /frame/next/compressed
+    public bool Compressed = false;
+
+    // number of the last frame received, from the X-Frame-Number header
+    string lastFrame = null;
 
     void Start() {
         _mf = GetComponent<MeshFilter>();
@@ -25,10 +32,20 @@ public class PointStream : MonoBehaviour
 
     void Update() {
         if (responseResult == null) {
-            responseResult = UnityWebRequest.Get(URI).SendWebRequest();
+            string uri = lastFrame != null ? URI + "?after=" + lastFrame : URI;
+            responseResult = UnityWebRequest.Get(uri).SendWebRequest();
         }
         if (responseResult != null && responseResult.isDone) {
+            // 204 => no new frame within the server's timeout, ask again
+            if (responseResult.webRequest.responseCode != 200) {
+                responseResult = null;
+                return;
+            }
+            string frame = responseResult.webRequest.GetResponseHeader("X-Frame-Number");
+            if (frame != null) lastFrame = frame;
+
             byte[] data = responseResult.webRequest.downloadHandler.data;
+            if (Compressed) data = PointCloudCodec.Decode(data);
 
             int numPoints = (int)BitConverter.ToUInt64(data, 0);
             //if (numPoints > pointLimit) numPoints = pointLimit;